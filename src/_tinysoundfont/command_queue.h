@@ -0,0 +1,105 @@
+//
+// Python bindings for TinySoundFont
+// https://github.com/nwhitehead/tinysoundfont-pybind
+//
+// Copyright (C) 2024 Nathan Whitehead
+//
+// This code is licensed under the MIT license (see LICENSE for details)
+//
+
+// Wait-free single producer, single consumer ring of timestamped MIDI channel commands.
+// A control thread pushes commands without taking the lock of the SoundFont, and the
+// render drains the ones that are due at their sample frame. The ring is allocated once,
+// so neither side allocates or waits.
+//
+// Each index is only written by one side: the producer advances tail after writing a
+// slot (release), the consumer advances head after reading one (release), and each side
+// reads the index of the other with acquire. Both sides also cache the last index they
+// read from the other side, so the shared cache lines are only touched when the ring
+// looks full or empty.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace command_queue {
+
+// A MIDI channel event to apply before the sample frame frame, counted from the first
+// render of the SoundFont. Commands for earlier frames are applied as soon as possible.
+struct Command {
+    long long frame;
+    int32_t type;
+    int32_t channel;
+    int32_t data1;
+    int32_t data2;
+};
+
+// Keeps the indices of the two sides on separate cache lines
+constexpr size_t CACHE_LINE = 64;
+
+class Queue {
+public:
+    // Capacity is rounded up to a power of two
+    explicit Queue(size_t capacity) {
+        size = 1;
+        while (size < capacity) {
+            size *= 2;
+        }
+        slots.reset(new Command[size]);
+    }
+
+    Queue(const Queue&) = delete;
+    Queue& operator=(const Queue&) = delete;
+
+    size_t capacity() const { return size; }
+
+    // Producer side, returns false without waiting if the ring is full. Never called by two
+    // threads at once.
+    bool push(const Command& command) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - headCache >= size) {
+            headCache = head.load(std::memory_order_acquire);
+            if (t - headCache >= size) {
+                return false;
+            }
+        }
+        slots[t & (size - 1)] = command;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, the oldest command or nullptr if the ring is empty
+    const Command* front() {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tailCache) {
+            tailCache = tail.load(std::memory_order_acquire);
+            if (h == tailCache) {
+                return nullptr;
+            }
+        }
+        return &slots[h & (size - 1)];
+    }
+
+    // Consumer side, removes the command returned by front
+    void pop() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    size_t size;
+    std::unique_ptr<Command[]> slots;
+    char padding0[CACHE_LINE];
+    // Written by the consumer
+    std::atomic<size_t> head{0};
+    size_t tailCache = 0;
+    char padding1[CACHE_LINE];
+    // Written by the producer
+    std::atomic<size_t> tail{0};
+    size_t headCache = 0;
+    char padding2[CACHE_LINE];
+};
+
+} // end namespace command_queue
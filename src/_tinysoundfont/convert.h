@@ -0,0 +1,227 @@
+//
+// Python bindings for TinySoundFont
+// https://github.com/nwhitehead/tinysoundfont-pybind
+//
+// Copyright (C) 2024 Nathan Whitehead
+//
+// This code is licensed under the MIT license (see LICENSE for details)
+//
+
+// Conversion of rendered float samples to integer output buffers, with clipping, optional
+// TPDF dither and a count of clipped samples. Must be included after simd.h.
+//
+// Without dither, int16 samples are converted like tsf_render_short (scaled by 32767.5 and
+// truncated). With dither, the noise of two uniform random values from 0 to 1 LSB is
+// subtracted from each other and added before rounding to nearest. The noise comes from 4
+// xorshift32 generators used in turn by consecutive samples, so the SSE2 kernels and the
+// scalar kernels give identical output. The SSE2 kernels are used unless SIMD is disabled
+// with set_simd("scalar").
+
+#pragma once
+
+#include <bitset>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace convert {
+
+// Same scale as tsf_render_short
+constexpr float INT16_SCALE = 32767.5f;
+
+// Limit before converting to int32, far enough outside the int16 range to still count as clipped
+constexpr float INT16_LIMIT = 40000.0f;
+
+constexpr float INT32_SCALE = 2147483648.0f;
+
+// Seeds of the dither generators of a new SoundFont
+constexpr uint32_t DITHER_SEEDS[4] = { 0x9E3779B9u, 0x7F4A7C15u, 0x94D049BBu, 0x2545F491u };
+
+inline uint32_t xorshift(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// Uniform random value in [0, 1) with 24 bits
+inline float uniform(uint32_t& state) {
+    return static_cast<float>(xorshift(state) >> 8) * (1.0f / 16777216.0f);
+}
+
+// Triangular noise from -1 to 1 for sample i of a call
+inline float tpdf(uint32_t* dither, int i) {
+    uint32_t& state = dither[i & 3];
+    float a = uniform(state);
+    float b = uniform(state);
+    return a - b;
+}
+
+// Convert count samples to int16, adding them to out if mix is set. Dither is null or the
+// 4 generator states. Returns the number of samples that had to be clipped.
+inline int to_int16_scalar(const float* in, int16_t* out, int count, bool mix, uint32_t* dither) {
+    int clipped = 0;
+    for (int i = 0; i < count; i++) {
+        float x = in[i] * INT16_SCALE;
+        if (dither) {
+            x += tpdf(dither, i);
+        }
+        // Same order of operands as the SSE2 min and max, so NaN becomes the upper limit
+        x = (x < INT16_LIMIT ? x : INT16_LIMIT);
+        x = (x > -INT16_LIMIT ? x : -INT16_LIMIT);
+        int32_t value = (dither ? static_cast<int32_t>(std::lrint(x)) : static_cast<int32_t>(x));
+        bool clip = (value > 32767 || value < -32768);
+        value = (value > 32767 ? 32767 : (value < -32768 ? -32768 : value));
+        if (mix) {
+            value += out[i];
+            clip = clip || value > 32767 || value < -32768;
+            value = (value > 32767 ? 32767 : (value < -32768 ? -32768 : value));
+        }
+        out[i] = static_cast<int16_t>(value);
+        clipped += clip;
+    }
+    return clipped;
+}
+
+// Convert count samples to int32, adding them to out if mix is set. Returns the number of
+// samples that had to be clipped, samples of 1.0 and above are clipped to the maximum.
+inline int to_int32_scalar(const float* in, int32_t* out, int count, bool mix) {
+    int clipped = 0;
+    for (int i = 0; i < count; i++) {
+        float x = in[i] * INT32_SCALE;
+        int64_t value;
+        bool clip = true;
+        if (x >= INT32_SCALE) {
+            value = INT32_MAX;
+        } else if (!(x >= -INT32_SCALE)) {
+            value = INT32_MIN;
+        } else {
+            value = static_cast<int64_t>(std::lrint(x));
+            clip = false;
+        }
+        if (mix) {
+            value += out[i];
+            clip = clip || value > INT32_MAX || value < INT32_MIN;
+            value = (value > INT32_MAX ? INT32_MAX : (value < INT32_MIN ? INT32_MIN : value));
+        }
+        out[i] = static_cast<int32_t>(value);
+        clipped += clip;
+    }
+    return clipped;
+}
+
+#ifdef TSFPY_SIMD_X86
+
+TSFPY_TARGET("sse2")
+static inline __m128i xorshift_sse2(__m128i& state) {
+    state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+    state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+    state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+    return state;
+}
+
+TSFPY_TARGET("sse2")
+static inline __m128 tpdf_sse2(__m128i& state) {
+    const __m128 scale = _mm_set1_ps(1.0f / 16777216.0f);
+    __m128 a = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(xorshift_sse2(state), 8)), scale);
+    __m128 b = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(xorshift_sse2(state), 8)), scale);
+    return _mm_sub_ps(a, b);
+}
+
+TSFPY_TARGET("sse2")
+static int to_int16_sse2(const float* in, int16_t* out, int count, bool mix, uint32_t* dither) {
+    const __m128 scale = _mm_set1_ps(INT16_SCALE), hi = _mm_set1_ps(INT16_LIMIT), lo = _mm_set1_ps(-INT16_LIMIT);
+    const __m128i max = _mm_set1_epi32(32767), min = _mm_set1_epi32(-32768), ones = _mm_set1_epi32(-1);
+    __m128i state = (dither ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(dither)) : _mm_setzero_si128());
+    int clipped = 0;
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128 x0 = _mm_mul_ps(_mm_loadu_ps(in + i), scale);
+        __m128 x1 = _mm_mul_ps(_mm_loadu_ps(in + i + 4), scale);
+        __m128i v0, v1;
+        if (dither) {
+            x0 = _mm_add_ps(x0, tpdf_sse2(state));
+            x1 = _mm_add_ps(x1, tpdf_sse2(state));
+            v0 = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(x0, hi), lo));
+            v1 = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(x1, hi), lo));
+        } else {
+            v0 = _mm_cvttps_epi32(_mm_max_ps(_mm_min_ps(x0, hi), lo));
+            v1 = _mm_cvttps_epi32(_mm_max_ps(_mm_min_ps(x1, hi), lo));
+        }
+        __m128i clip0 = _mm_or_si128(_mm_cmpgt_epi32(v0, max), _mm_cmplt_epi32(v0, min));
+        __m128i clip1 = _mm_or_si128(_mm_cmpgt_epi32(v1, max), _mm_cmplt_epi32(v1, min));
+        // Packing saturates to the int16 range, and turns the clip masks into 16-bit masks
+        __m128i value = _mm_packs_epi32(v0, v1);
+        __m128i clip = _mm_packs_epi32(clip0, clip1);
+        __m128i* o = reinterpret_cast<__m128i*>(out + i);
+        if (mix) {
+            __m128i old = _mm_loadu_si128(o);
+            __m128i sum = _mm_adds_epi16(old, value);
+            // The saturating sum differs from the wrapping sum where it clipped
+            clip = _mm_or_si128(clip, _mm_xor_si128(_mm_cmpeq_epi16(sum, _mm_add_epi16(old, value)), ones));
+            value = sum;
+        }
+        _mm_storeu_si128(o, value);
+        clipped += static_cast<int>(std::bitset<16>(_mm_movemask_epi8(clip)).count() / 2);
+    }
+    if (dither) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dither), state);
+    }
+    // i is a multiple of 4, so the remaining samples start with the first generator
+    return clipped + to_int16_scalar(in + i, out + i, count - i, mix, dither);
+}
+
+TSFPY_TARGET("sse2")
+static int to_int32_sse2(const float* in, int32_t* out, int count, bool mix) {
+    const __m128 scale = _mm_set1_ps(INT32_SCALE), lo = _mm_set1_ps(-INT32_SCALE);
+    const __m128i max = _mm_set1_epi32(INT32_MAX);
+    const __m128d maxd = _mm_set1_pd(INT32_MAX), mind = _mm_set1_pd(INT32_MIN);
+    int clipped = 0;
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_mul_ps(_mm_loadu_ps(in + i), scale);
+        __m128 high = _mm_cmpge_ps(x, scale);
+        __m128 clip = _mm_or_ps(high, _mm_cmpnge_ps(x, lo));
+        // Out of range conversions give INT32_MIN, which is right for low samples
+        __m128i value = _mm_cvtps_epi32(x);
+        __m128i highMask = _mm_castps_si128(high);
+        value = _mm_or_si128(_mm_andnot_si128(highMask, value), _mm_and_si128(highMask, max));
+        int mask = _mm_movemask_ps(clip);
+        __m128i* o = reinterpret_cast<__m128i*>(out + i);
+        if (mix) {
+            // Sums of two int32 values are exact in double precision
+            __m128i old = _mm_loadu_si128(o);
+            __m128d sumLow = _mm_add_pd(_mm_cvtepi32_pd(old), _mm_cvtepi32_pd(value));
+            __m128d sumHigh = _mm_add_pd(_mm_cvtepi32_pd(_mm_srli_si128(old, 8)), _mm_cvtepi32_pd(_mm_srli_si128(value, 8)));
+            mask |= _mm_movemask_pd(_mm_or_pd(_mm_cmpgt_pd(sumLow, maxd), _mm_cmplt_pd(sumLow, mind)));
+            mask |= _mm_movemask_pd(_mm_or_pd(_mm_cmpgt_pd(sumHigh, maxd), _mm_cmplt_pd(sumHigh, mind))) << 2;
+            sumLow = _mm_max_pd(_mm_min_pd(sumLow, maxd), mind);
+            sumHigh = _mm_max_pd(_mm_min_pd(sumHigh, maxd), mind);
+            value = _mm_unpacklo_epi64(_mm_cvtpd_epi32(sumLow), _mm_cvtpd_epi32(sumHigh));
+        }
+        _mm_storeu_si128(o, value);
+        clipped += static_cast<int>(std::bitset<4>(mask).count());
+    }
+    return clipped + to_int32_scalar(in + i, out + i, count - i, mix);
+}
+
+#endif // TSFPY_SIMD_X86
+
+struct Kernels {
+    int (*to_int16)(const float* in, int16_t* out, int count, bool mix, uint32_t* dither);
+    int (*to_int32)(const float* in, int32_t* out, int count, bool mix);
+};
+
+// Kernels for the SIMD level selected with simd::set_level
+inline const Kernels& active() {
+    static const Kernels scalar = { &to_int16_scalar, &to_int32_scalar };
+#ifdef TSFPY_SIMD_X86
+    static const Kernels sse2 = { &to_int16_sse2, &to_int32_sse2 };
+    if (std::strcmp(simd::current().name, "scalar") != 0) {
+        return sse2;
+    }
+#endif
+    return scalar;
+}
+
+} // end namespace convert
@@ -0,0 +1,77 @@
+//
+// Python bindings for TinySoundFont
+// https://github.com/nwhitehead/tinysoundfont-pybind
+//
+// Copyright (C) 2024 Nathan Whitehead
+//
+// This code is licensed under the MIT license (see LICENSE for details)
+//
+
+// Decoding the compressed samples of a SoundFont on several threads while it
+// loads. Must be included after the TinySoundFont implementation and
+// thread_pool.h. TinySoundFont calls tsfpy_decode_samples (through
+// TSF_DECODE_SAMPLES) with the parts of the sample data of an .sf3 or .sfo
+// file, which write to separate ranges of the output buffer.
+//
+// Every part opens its Ogg stream and seeks to its start, and stb_vorbis
+// decodes exactly the same samples after a seek, so the samples do not depend
+// on the number of threads. The CRC table of stb_vorbis is built when the
+// module is imported, so streams opened on several threads only read it. The
+// parts run on a pool of their own instead of the shared pool, which would
+// make renders of other SoundFonts wait for the whole load. If its threads
+// cannot be started, the parts are decoded on the calling thread.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+namespace decode_threads {
+
+// Fewer samples in total are not worth starting threads
+constexpr unsigned MIN_SAMPLES = 1 << 20;
+
+} // end namespace decode_threads
+
+static int tsfpy_decode_samples(const tsf_lazy_sample* parts, int count, float* output) {
+    unsigned long long total = 0;
+    for (int i = 0; i < count; i++) {
+        total += parts[i].size;
+    }
+    if (total < decode_threads::MIN_SAMPLES) {
+        return tsf_decode_samples(parts, count, output);
+    }
+    // Exceptions must not leave through the C frames of TinySoundFont, so if the threads cannot be
+    // started (std::system_error) or allocated, also those of the shared pool which reports the
+    // number of threads, decode on this thread
+    int threads = 1;
+    std::vector<int> order;
+    std::unique_ptr<thread_pool::Pool> pool;
+    try {
+        threads = std::min(thread_pool::threads(), count);
+        if (threads > 1) {
+            order.resize(count);
+            pool.reset(new thread_pool::Pool(threads - 1));
+        }
+    } catch (const std::exception&) {
+        threads = 1;
+    }
+    if (threads <= 1) {
+        return tsf_decode_samples(parts, count, output);
+    }
+    // Start with the longest parts, so the last ones to finish are short
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [parts](int a, int b) { return parts[a].size > parts[b].size; });
+    std::atomic<bool> ok(true);
+    pool->run(count, [&](int i) {
+        const tsf_lazy_sample& part = parts[order[i]];
+        if (ok.load(std::memory_order_relaxed) && !tsf_decode_window(&part, output + part.start)) {
+            ok.store(false, std::memory_order_relaxed);
+        }
+    });
+    return ok.load() ? 1 : 0;
+}
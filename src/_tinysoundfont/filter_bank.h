@@ -0,0 +1,270 @@
+//
+// Python bindings for TinySoundFont
+// https://github.com/nwhitehead/tinysoundfont-pybind
+//
+// Copyright (C) 2024 Nathan Whitehead
+//
+// This code is licensed under the MIT license (see LICENSE for details)
+//
+
+// Rendering of voices with single precision low-pass filters in groups.
+// Must be included after the TinySoundFont implementation, simd.h and
+// voice_render.h. filter_bank::render_voices renders a range of the active
+// voice list, tsfpy_render_voices in render_threads.h calls it.
+//
+// The biquad of a single voice is a chain of dependent operations per
+// sample. With tsf_set_float_filters enabled, consecutive voices with an
+// active filter are rendered together in lockstep, and their filters run in
+// the lanes of one SIMD register. The steps are the same as in
+// tsf_voice_render and voices are still mixed in order, so the output is
+// bit-identical to rendering the voices one by one.
+
+#pragma once
+
+namespace filter_bank {
+
+constexpr int LANES = 4;
+
+// Filter the values of up to LANES voices, values[lane] is nullptr for lanes without an active filter.
+// Lanes have counts[lane] values, fewer than count only when their sample ended in this chunk, so
+// they stop for the rest of the block. The lanes run in lockstep over count values, the missing
+// values of shorter lanes are filtered as zeros and not written back.
+inline void process(struct tsf_voice_lowpassf* filters[LANES], float* values[LANES], const int counts[LANES], int count) {
+    alignas(16) float a0[LANES] = {}, a1[LANES] = {}, b1[LANES] = {}, b2[LANES] = {}, z1[LANES] = {}, z2[LANES] = {};
+    alignas(16) float x[TSF_RENDER_EFFECTSAMPLEBLOCK][LANES] = {};
+    for (int lane = 0; lane < LANES; lane++) {
+        if (!values[lane]) continue;
+        a0[lane] = filters[lane]->a0; a1[lane] = filters[lane]->a1; b1[lane] = filters[lane]->b1; b2[lane] = filters[lane]->b2;
+        z1[lane] = filters[lane]->z1; z2[lane] = filters[lane]->z2;
+        for (int i = 0; i < counts[lane]; i++) x[i][lane] = values[lane][i];
+    }
+#if defined(TSFPY_SIMD_X86)
+    __m128 va0 = _mm_load_ps(a0), va1 = _mm_load_ps(a1), vb1 = _mm_load_ps(b1), vb2 = _mm_load_ps(b2);
+    __m128 vz1 = _mm_load_ps(z1), vz2 = _mm_load_ps(z2);
+    for (int i = 0; i < count; i++) {
+        __m128 in = _mm_load_ps(x[i]);
+        __m128 out = _mm_add_ps(_mm_mul_ps(in, va0), vz1);
+        vz1 = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(in, va1), vz2), _mm_mul_ps(vb1, out));
+        vz2 = _mm_sub_ps(_mm_mul_ps(in, va0), _mm_mul_ps(vb2, out));
+        _mm_store_ps(x[i], out);
+    }
+    _mm_store_ps(z1, vz1);
+    _mm_store_ps(z2, vz2);
+#elif defined(TSFPY_SIMD_NEON)
+    float32x4_t va0 = vld1q_f32(a0), va1 = vld1q_f32(a1), vb1 = vld1q_f32(b1), vb2 = vld1q_f32(b2);
+    float32x4_t vz1 = vld1q_f32(z1), vz2 = vld1q_f32(z2);
+    for (int i = 0; i < count; i++) {
+        float32x4_t in = vld1q_f32(x[i]);
+        float32x4_t out = vaddq_f32(vmulq_f32(in, va0), vz1);
+        vz1 = vsubq_f32(vaddq_f32(vmulq_f32(in, va1), vz2), vmulq_f32(vb1, out));
+        vz2 = vsubq_f32(vmulq_f32(in, va0), vmulq_f32(vb2, out));
+        vst1q_f32(x[i], out);
+    }
+    vst1q_f32(z1, vz1);
+    vst1q_f32(z2, vz2);
+#else
+    for (int i = 0; i < count; i++) {
+        for (int lane = 0; lane < LANES; lane++) {
+            float in = x[i][lane], out = in * a0[lane] + z1[lane];
+            z1[lane] = in * a1[lane] + z2[lane] - b1[lane] * out;
+            z2[lane] = in * a0[lane] - b2[lane] * out;
+            x[i][lane] = out;
+        }
+    }
+#endif
+    for (int lane = 0; lane < LANES; lane++) {
+        if (!values[lane]) continue;
+        filters[lane]->z1 = z1[lane];
+        filters[lane]->z2 = z2[lane];
+        for (int i = 0; i < counts[lane]; i++) values[lane][i] = x[i][lane];
+    }
+}
+
+// Render state of one voice, split into the steps of tsf_voice_render so voices can run in lockstep
+struct Lane {
+    struct tsf_voice* v;
+    bool updateModEnv, updateModLFO, updateVibLFO, looping, fixedPoint, dynamicLowpass, dynamicPitch, dynamicGain, gainRamp;
+    bool done, sampleEnded;
+    double sampleEndDbl, position, pitchRatio;
+    tsf_u64 sampleEndPhase, phase;
+    struct tsf_voice_lowpass lowpass;
+    struct tsf_voice_lowpassf lowpassF;
+    float noteGain, gainMono, gainStep;
+    float* outL;
+    float* outR;
+    int count;
+    unsigned int pos[TSF_RENDER_EFFECTSAMPLEBLOCK], nextPos[TSF_RENDER_EFFECTSAMPLEBLOCK];
+    float alpha[TSF_RENDER_EFFECTSAMPLEBLOCK], values[TSF_RENDER_EFFECTSAMPLEBLOCK];
+
+    void begin(tsf* f, struct tsf_voice* voice, float* outputBuffer, int numSamples) {
+        const struct tsf_region* region = voice->region;
+        v = voice;
+        updateModEnv = (region->modEnvToPitch || region->modEnvToFilterFc);
+        updateModLFO = (v->modlfo.delta && (region->modLfoToPitch || region->modLfoToFilterFc || region->modLfoToVolume));
+        updateVibLFO = (v->viblfo.delta && (region->vibLfoToPitch));
+        looping = (v->loopStart < v->loopEnd);
+        fixedPoint = (f->fixedPointPhase != 0);
+        dynamicLowpass = (region->modLfoToFilterFc || region->modEnvToFilterFc);
+        dynamicPitch = (region->modLfoToPitch || region->modEnvToPitch || region->vibLfoToPitch);
+        dynamicGain = (region->modLfoToVolume != 0);
+        gainRamp = (f->gainRamp != 0);
+        done = sampleEnded = false;
+        sampleEndDbl = (double)region->end;
+        sampleEndPhase = (tsf_u64)region->end << 32;
+        position = v->sourceSamplePosition;
+        phase = v->sourceSamplePhase;
+        lowpass = v->lowpass;
+        tsf_voice_lowpassf_load(&lowpassF, &lowpass);
+        pitchRatio = (dynamicPitch ? 0 : tsf_timecents2Secsd(v->pitchInputTimecents) * v->pitchOutputFactor);
+        noteGain = (dynamicGain ? 0 : tsf_decibelsToGain(v->noteGainDB));
+        outL = outputBuffer;
+        outR = (f->outputmode == TSF_STEREO_UNWEAVED ? outL + numSamples : nullptr);
+    }
+
+    // Update the parameters at the start of a block
+    void control(tsf* f, int blockSamples) {
+        const struct tsf_region* region = v->region;
+        const float sampleRate = f->outSampleRate;
+        if (dynamicLowpass) {
+            float fres = (float)region->initialFilterFc + v->modlfo.level * (float)region->modLfoToFilterFc + v->modenv.level * (float)region->modEnvToFilterFc;
+            float lowpassFc = (fres <= 13500 ? tsf_cents2Hertz(fres) / sampleRate : 1.0f);
+            lowpass.active = (lowpassFc < 0.499f);
+            if (lowpass.active) tsf_voice_lowpassf_setup(&lowpassF, (float)lowpass.QInv, lowpassFc);
+        }
+        if (dynamicPitch) {
+            pitchRatio = tsf_timecents2Secsd(v->pitchInputTimecents + (v->modlfo.level * (float)region->modLfoToPitch + v->viblfo.level * (float)region->vibLfoToPitch + v->modenv.level * (float)region->modEnvToPitch)) * v->pitchOutputFactor;
+        }
+        if (dynamicGain) {
+            noteGain = tsf_decibelsToGain(v->noteGainDB + (v->modlfo.level * ((float)region->modLfoToVolume * 0.1f)));
+        }
+        gainMono = noteGain * v->ampenv.level;
+        gainStep = 0;
+        tsf_voice_envelope_process(&v->ampenv, blockSamples, sampleRate);
+        if (updateModEnv) tsf_voice_envelope_process(&v->modenv, blockSamples, sampleRate);
+        if (updateModLFO) tsf_voice_lfo_process(&v->modlfo, blockSamples);
+        if (updateVibLFO) tsf_voice_lfo_process(&v->viblfo, blockSamples);
+        if (gainRamp) {
+            float gainNext = (dynamicGain ? tsf_decibelsToGain(v->noteGainDB + (v->modlfo.level * ((float)region->modLfoToVolume * 0.1f))) : noteGain) * v->ampenv.level;
+            gainStep = (gainNext - gainMono) / blockSamples;
+        }
+        sampleEnded = false;
+    }
+
+    // Sample positions and interpolated values of the next chunk
+    void interpolate(tsf* f, const struct tsf_render_kernels* kernels, int chunkSamples) {
+        if (fixedPoint) {
+            const tsf_u64 phaseIncrement = (tsf_u64)(pitchRatio * 4294967296.0 + 0.5);
+            count = (looping ? voice_render::positions_fixed<true>(phase, phaseIncrement, v->loopStart, v->loopEnd, sampleEndPhase, pos, nextPos, alpha, chunkSamples)
+                             : voice_render::positions_fixed<false>(phase, phaseIncrement, v->loopStart, v->loopEnd, sampleEndPhase, pos, nextPos, alpha, chunkSamples));
+            sampleEnded = (phase >= sampleEndPhase);
+        } else {
+            count = (looping ? voice_render::positions_double<true>(position, pitchRatio, v->loopStart, v->loopEnd, sampleEndDbl, pos, nextPos, alpha, chunkSamples)
+                             : voice_render::positions_double<false>(position, pitchRatio, v->loopStart, v->loopEnd, sampleEndDbl, pos, nextPos, alpha, chunkSamples));
+            sampleEnded = (position >= sampleEndDbl);
+        }
+        tsf_voice_interpolate(f, v, kernels, pitchRatio, pos, nextPos, alpha, values, count);
+    }
+
+    void mix(tsf* f, const struct tsf_render_kernels* kernels) {
+        tsf_voice_mix(f->outputmode, kernels, &outL, &outR, values, count, gainMono, gainStep, v->panFactorLeft, v->panFactorRight, gainRamp);
+        if (gainRamp) gainMono += gainStep * count;
+    }
+
+    // End of a block, returns false if the voice has finished
+    bool end_block() {
+        if (sampleEnded || v->ampenv.segment == TSF_SEGMENT_DONE) {
+            tsf_voice_kill(v);
+            done = true;
+        }
+        return !done;
+    }
+
+    void finish() {
+        v->sourceSamplePosition = position;
+        v->sourceSamplePhase = phase;
+        tsf_voice_lowpassf_store(&lowpassF, &lowpass);
+        if (lowpass.active || dynamicLowpass) v->lowpass = lowpass;
+    }
+};
+
+inline void render_group(tsf* f, Lane* lanes, int laneCount, int numSamples) {
+    const struct tsf_render_kernels* kernels = f->renderKernels;
+    bool playing = true;
+    while (numSamples && playing) {
+        int blockSamples = (numSamples > f->effectSampleBlock ? f->effectSampleBlock : numSamples);
+        numSamples -= blockSamples;
+        for (int lane = 0; lane < laneCount; lane++) {
+            if (!lanes[lane].done) lanes[lane].control(f, blockSamples);
+        }
+        for (int chunkSamples; blockSamples; blockSamples -= chunkSamples) {
+            chunkSamples = (blockSamples > TSF_RENDER_EFFECTSAMPLEBLOCK ? TSF_RENDER_EFFECTSAMPLEBLOCK : blockSamples);
+            struct tsf_voice_lowpassf* filters[LANES] = {};
+            float* values[LANES] = {};
+            int counts[LANES] = {};
+            bool rendering[LANES] = {}, any = false;
+            for (int lane = 0; lane < laneCount; lane++) {
+                Lane& l = lanes[lane];
+                // Voices that reached the end of the sample stop for the rest of the block
+                if (l.done || l.sampleEnded) continue;
+                l.interpolate(f, kernels, chunkSamples);
+                if (l.lowpass.active) {
+                    filters[lane] = &l.lowpassF;
+                    values[lane] = l.values;
+                    counts[lane] = l.count;
+                }
+                rendering[lane] = any = true;
+            }
+            if (!any) break;
+            process(filters, values, counts, chunkSamples);
+            for (int lane = 0; lane < laneCount; lane++) {
+                if (rendering[lane]) lanes[lane].mix(f, kernels);
+            }
+        }
+        playing = false;
+        for (int lane = 0; lane < laneCount; lane++) {
+            if (!lanes[lane].done && lanes[lane].end_block()) playing = true;
+        }
+    }
+    for (int lane = 0; lane < laneCount; lane++) {
+        if (!lanes[lane].done) lanes[lane].finish();
+    }
+}
+
+inline bool filtered(const struct tsf_voice* v) {
+    return v->lowpass.active || v->region->modLfoToFilterFc || v->region->modEnvToFilterFc;
+}
+
+// Render the playing voices of the active voice list from begin to end, specialized is the
+// value of voice_render::enabled() for the whole render
+inline void render_voices(tsf* f, const int* begin, const int* end, float* buffer, int samples, bool specialized) {
+    if (!f->floatFilters || !specialized) {
+        for (const int* a = begin; a != end; a++) {
+            struct tsf_voice* v = &f->voices[*a];
+            if (v->playingPreset != -1) voice_render::render(f, v, buffer, samples, specialized);
+        }
+        return;
+    }
+    // Group consecutive filtered voices, so voices are still mixed in order
+    Lane lanes[LANES];
+    int laneCount = 0;
+    for (const int* a = begin; a != end; a++) {
+        struct tsf_voice* v = &f->voices[*a];
+        if (v->playingPreset == -1) continue;
+        if (filtered(v)) {
+            lanes[laneCount++].begin(f, v, buffer, samples);
+            if (laneCount == LANES) {
+                render_group(f, lanes, laneCount, samples);
+                laneCount = 0;
+            }
+        } else {
+            if (laneCount) {
+                render_group(f, lanes, laneCount, samples);
+                laneCount = 0;
+            }
+            voice_render::render(f, v, buffer, samples, true);
+        }
+    }
+    if (laneCount) render_group(f, lanes, laneCount, samples);
+}
+
+} // end namespace filter_bank
@@ -8,40 +8,372 @@
 //
 
 #include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
 
 namespace py = pybind11;
 using namespace pybind11::literals;
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 // Include support for OGG Vorbis file format (detected automatically by TinySoundFont header)
 #include "stb/stb_vorbis.c"
 
+// Render voices with the specialized functions from voice_render.h, voices
+// with float filters in groups with filter_bank.h, and the voices of one
+// SoundFont on several threads with render_threads.h. Each render loads the
+// kernels of the SIMD level selected in simd.h. Compressed samples are
+// decoded on several threads while loading with decode_threads.h
+#define TSF_VOICE_RENDER tsfpy_voice_render
+#define TSF_RENDER_VOICES tsfpy_render_voices
+#define TSF_RENDER_KERNELS tsfpy_render_kernels
+#define TSF_DECODE_SAMPLES tsfpy_decode_samples
+// Allocations of TinySoundFont go through realtime.h, which checks them in a build with TSFPY_REALTIME_CHECKS
+#include "realtime.h"
 #define TSF_IMPLEMENTATION
 #include "tsf/tsf.h"
 
 #define TML_IMPLEMENTATION
 #include "tsf/tml.h"
 
+#include "simd.h"
+#include "convert.h"
+#include "voice_render.h"
+#include "filter_bank.h"
+#include "thread_pool.h"
+#include "render_threads.h"
+#include "decode_threads.h"
+#include "stems.h"
+#include "command_queue.h"
+#include "wav_writer.h"
+#include "mapped_file.h"
+
 namespace {
 
 inline const char* string_none_if_nullptr(const char* s) {
     return s ? s : "<None>";
 }
 
+// Lock a mutex for one call. If another thread holds it (most likely while rendering), wait
+// without the GIL so that thread can finish.
+std::unique_lock<std::mutex> lock_without_gil(std::mutex& mutex) {
+    std::unique_lock<std::mutex> guard(mutex, std::try_to_lock);
+    if (!guard.owns_lock()) {
+        py::gil_scoped_release release;
+        guard.lock();
+    }
+    return guard;
+}
+
+enum class SampleType {
+    Float32,
+    Int16,
+    Int32,
+};
+
+// Returns the sample type of a render buffer, 1 dimensional buffers are bytes of float32 samples
+SampleType buffer_sample_type(const py::buffer_info& info) {
+    if (info.ndim == 2 && info.itemsize == 2 && info.format == py::format_descriptor<int16_t>::format()) {
+        return SampleType::Int16;
+    }
+    if (info.ndim == 2 && info.itemsize == 4 && (info.format == "i" || info.format == "l")) {
+        return SampleType::Int32;
+    }
+    return SampleType::Float32;
+}
+
+// Returns the number of sample frames in a render buffer after checking its format
+int buffer_frames(const py::buffer_info& info, int output_channels, SampleType type = SampleType::Float32) {
+    if (info.ndim == 1) {
+        // 1D buffers must be contiguous byte arrays
+        if (info.format != py::format_descriptor<unsigned char>::format()) {
+            throw std::runtime_error("Incompatible buffer format, must be unsigned char");
+        }
+        if (info.shape[0] % (sizeof(float) * output_channels)) {
+            throw std::runtime_error("Buffer length does not divide evenly into sample frames");
+        }
+        return info.shape[0] / (sizeof(float) * output_channels);
+    }
+    if (type == SampleType::Float32 && info.format != py::format_descriptor<float>::format()) {
+        throw std::runtime_error("Incompatible buffer format, must be float32, int16 or int32");
+    }
+    if (info.ndim != 2) {
+        throw std::runtime_error("Incompatible buffer dimension, must be 1 dimensional bytearray or 2 dimensional of size (samples, channels)");
+    }
+    if (info.shape[1] != output_channels) {
+        throw std::runtime_error(std::string("Incompatible buffer length, channel size must be ") + std::string(output_channels == 1 ? "1 for mono" : "2 for stereo"));
+    }
+    return info.shape[0];
+}
+
+// Returns the number of sample frames in a stem buffer of shape (stems, samples, 2) after checking its format
+int stem_buffer_frames(const py::buffer_info& info) {
+    if (info.format != py::format_descriptor<float>::format()) {
+        throw std::runtime_error("Incompatible buffer format, must be float32");
+    }
+    if (info.ndim != 3 || info.shape[2] != 2) {
+        throw std::runtime_error("Incompatible buffer dimension, must be 3 dimensional of size (stems, samples, 2)");
+    }
+    if (info.strides[2] != sizeof(float) || info.strides[1] != 2 * sizeof(float) || info.strides[0] != info.shape[1] * info.strides[1]) {
+        throw std::runtime_error("Stem buffer must be C contiguous");
+    }
+    return info.shape[1];
+}
+
+enum class MidiMessageType {
+    NOTE_OFF = 0x80,
+    NOTE_ON = 0x90,
+    KEY_PRESSURE = 0xA0,
+    CONTROL_CHANGE = 0xB0,
+    PROGRAM_CHANGE = 0xC0,
+    CHANNEL_PRESSURE = 0xD0,
+    PITCH_BEND = 0xE0,
+    SET_TEMPO = 0x51
+};
+
+// A MIDI channel event at a sample frame offset, packed as 5 int32 values for SoundFont.render_events
+struct FrameEvent {
+    int32_t offset;
+    int32_t type;
+    int32_t channel;
+    int32_t data1;
+    int32_t data2;
+};
+
+// Check the channel and data values of a MIDI channel event
+void check_event(int type, int channel, int data1, int data2) {
+    if (channel < 0 || channel > 15) {
+        throw std::runtime_error("Event channel must be between 0 and 15");
+    }
+    bool valid = true;
+    switch (type) {
+        case TML_NOTE_OFF:
+        case TML_NOTE_ON:
+        case TML_CONTROL_CHANGE:
+            valid = data1 >= 0 && data1 <= 127 && data2 >= 0 && data2 <= 127;
+            break;
+        case TML_PROGRAM_CHANGE:
+            valid = data1 >= 0 && data1 <= 127;
+            break;
+        case TML_PITCH_BEND:
+            valid = data1 >= 0 && data1 <= 16383;
+            break;
+        default:
+            // Other events have no effect
+            break;
+    }
+    if (!valid) {
+        throw std::runtime_error("Event data out of range");
+    }
+}
+
+// Returns the events of a buffer of shape (events, 5) or (events * 5,) after checking their
+// format and values against a render of samples frames
+std::pair<const FrameEvent*, size_t> frame_events(const py::buffer_info& info, int samples) {
+    bool int32 = info.itemsize == sizeof(int32_t) && !info.format.empty() && (info.format.back() == 'i' || info.format.back() == 'l');
+    if (!int32) {
+        throw std::runtime_error("Incompatible event format, must be int32");
+    }
+    bool packed = (info.ndim == 1 && info.shape[0] % 5 == 0 && info.strides[0] == sizeof(int32_t))
+        || (info.ndim == 2 && info.shape[1] == 5 && info.strides[1] == sizeof(int32_t) && info.strides[0] == sizeof(FrameEvent));
+    if (!packed) {
+        throw std::runtime_error("Incompatible event buffer, must be contiguous with 5 values (frame_offset, type, channel, data1, data2) per event");
+    }
+    const FrameEvent* events = static_cast<const FrameEvent*>(info.ptr);
+    size_t count = static_cast<size_t>(info.size / 5);
+    int offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        const FrameEvent& e = events[i];
+        if (e.offset < offset || e.offset > samples) {
+            throw std::runtime_error("Event frame offsets must be in order and between 0 and the number of frames");
+        }
+        offset = e.offset;
+        check_event(e.type, e.channel, e.data1, e.data2);
+    }
+    return std::make_pair(events, count);
+}
+
+// Apply one MIDI channel event, returns false if TinySoundFont could not allocate memory for it
+bool apply_event(tsf* f, int type, int channel, int data1, int data2) {
+    switch (type) {
+        case TML_NOTE_OFF:
+            tsf_channel_note_off(f, channel, data1);
+            return true;
+        case TML_NOTE_ON:
+            return tsf_channel_note_on(f, channel, data1, data2 / 127.0f) != 0;
+        case TML_CONTROL_CHANGE:
+            return tsf_channel_midi_control(f, channel, data1, data2) != 0;
+        case TML_PROGRAM_CHANGE:
+            // Like Sequencer.send, selecting a preset that does not exist is not an error
+            tsf_channel_set_presetnumber(f, channel, data1, data2 ? 1 : 0);
+            return true;
+        case TML_PITCH_BEND:
+            return tsf_channel_set_pitchwheel(f, channel, data1) != 0;
+        default:
+            return true;
+    }
+}
+
+// Render samples frames from frame offset into a buffer of total frames. Unweaved stereo
+// output has the left and right channels in separate halves of the buffer, so that part
+// is rendered into scratch first.
+void render_frames(tsf* f, float* buffer, int total, int offset, int samples, bool mix, realtime::vector<float>& scratch) {
+    switch (f->outputmode) {
+        case TSF_STEREO_INTERLEAVED:
+            tsf_render_float(f, buffer + offset * 2, samples, mix ? 1 : 0);
+            break;
+        case TSF_MONO:
+            tsf_render_float(f, buffer + offset, samples, mix ? 1 : 0);
+            break;
+        default:
+            if (offset == 0 && samples == total) {
+                tsf_render_float(f, buffer, samples, mix ? 1 : 0);
+                break;
+            }
+            if (scratch.size() < static_cast<size_t>(samples) * 2) {
+                scratch.resize(static_cast<size_t>(samples) * 2);
+            }
+            if (mix) {
+                std::copy(buffer + offset, buffer + offset + samples, scratch.begin());
+                std::copy(buffer + total + offset, buffer + total + offset + samples, scratch.begin() + samples);
+            }
+            tsf_render_float(f, scratch.data(), samples, mix ? 1 : 0);
+            std::copy(scratch.begin(), scratch.begin() + samples, buffer + offset);
+            std::copy(scratch.begin() + samples, scratch.begin() + samples * 2, buffer + total + offset);
+            break;
+    }
+}
+
+// Frames rendered at a time before converting them to integers. The conversion is not fused into
+// the mixing of voices, which adds each voice into the float output in turn, so only the final
+// sums can be converted. A block of 4096 stereo frames (32 KB) is still in cache when it is
+// converted: smaller blocks measured no faster, and the conversion takes about 5% of a render of
+// 12 voices with the SSE2 kernels (bench_render_integer).
+constexpr int CONVERT_BLOCK_FRAMES = 4096;
+
+// Render samples frames from frame offset into an int16 or int32 buffer of total frames,
+// returns the number of clipped samples. The float samples are rendered in blocks of a
+// multiple of the effect block size, so the result is the same as converting one render.
+long long render_converted(tsf* f, void* buffer, SampleType type, int total, int offset, int samples, bool mix, uint32_t* dither, realtime::vector<float>& scratch) {
+    const convert::Kernels& kernels = convert::active();
+    int channels = (f->outputmode == TSF_MONO ? 1 : 2);
+    int block = std::max(1, CONVERT_BLOCK_FRAMES / f->effectSampleBlock) * f->effectSampleBlock;
+    if (scratch.size() < static_cast<size_t>(block) * channels) {
+        scratch.resize(static_cast<size_t>(block) * channels);
+    }
+    // Convert count samples into the buffer from sample offset
+    auto convert_samples = [&](const float* input, size_t offset, int count) -> long long {
+        if (type == SampleType::Int16) {
+            return kernels.to_int16(input, static_cast<int16_t*>(buffer) + offset, count, mix, dither);
+        }
+        return kernels.to_int32(input, static_cast<int32_t*>(buffer) + offset, count, mix);
+    };
+    long long clipped = 0;
+    for (int position = 0; position < samples; position += block) {
+        int count = std::min(block, samples - position);
+        tsf_render_float(f, scratch.data(), count, 0);
+        size_t frame = static_cast<size_t>(offset) + position;
+        if (f->outputmode == TSF_STEREO_UNWEAVED) {
+            clipped += convert_samples(scratch.data(), frame, count);
+            clipped += convert_samples(scratch.data() + count, total + frame, count);
+        } else {
+            clipped += convert_samples(scratch.data(), frame * channels, count * channels);
+        }
+    }
+    return clipped;
+}
+
+// Render samples frames, applying each event right before the frame at its offset. Returns the
+// index of an event TinySoundFont could not allocate memory for, or -1. If indices is given,
+// it has the index to return for each event, and events with a negative index are dropped
+// when they fail.
+long render_with_events(tsf* f, float* buffer, int samples, bool mix, const FrameEvent* events, size_t count, realtime::vector<float>& scratch, const long* indices = nullptr) {
+    int position = 0;
+    size_t i = 0;
+    for (;;) {
+        for (; i < count && events[i].offset <= position; i++) {
+            if (!apply_event(f, events[i].type, events[i].channel, events[i].data1, events[i].data2)) {
+                if (!indices) {
+                    return static_cast<long>(i);
+                }
+                if (indices[i] >= 0) {
+                    return indices[i];
+                }
+            }
+        }
+        if (position == samples) {
+            return -1;
+        }
+        int end = (i < count ? events[i].offset : samples);
+        render_frames(f, buffer, samples, position, end - position, mix, scratch);
+        position = end;
+    }
+}
+
+// Commands that can wait in the command queue of a SoundFont
+constexpr size_t COMMAND_QUEUE_SIZE = 4096;
+
+// Without a maximum number of voices, real-time mode asks for more voices when fewer than
+// 1 / REALTIME_GROW_FREE_FRACTION of them are free after a render
+constexpr int REALTIME_GROW_FREE_FRACTION = 4;
+
 } // end anonymous namespace
 
+// Every method locks the object, so calls from several Python threads are safe. Loading and
+// rendering run without holding the GIL, so other Python threads (and other SoundFont objects)
+// keep running in the meantime. Renders take the lock once per call too, so a render waits
+// for a note or channel call on another thread. Only queue_event never waits for a render.
+// In real-time mode notes and channel events run inside a realtime::Section like renders, since
+// they must not allocate either.
 class SoundFont {
 public:
     tsf* obj = nullptr;
+    mutable std::mutex mutex;
+    realtime::vector<float> scratch;
+    // Scratch buffers of renders of this object on several threads (render_threads.h)
+    realtime::vector<float> thread_scratch;
+    uint32_t dither[4] = { convert::DITHER_SEEDS[0], convert::DITHER_SEEDS[1], convert::DITHER_SEEDS[2], convert::DITHER_SEEDS[3] };
+    long long clipped = 0;
+    std::vector<stems::Bus> stem_buses;
+    stems::Scratch stem_scratch;
+    command_queue::Queue commands{COMMAND_QUEUE_SIZE};
+    // Makes the threads calling queue_event one producer of commands, renders never take it
+    std::mutex producer_mutex;
+    // Frames rendered since loading, the time base of queued commands
+    std::atomic<long long> frame_position{0};
+    // Queued commands due in the current render, as events at frame offsets
+    std::vector<FrameEvent> due = std::vector<FrameEvent>(commands.capacity());
+    realtime::vector<FrameEvent> merged;
+    realtime::vector<long> merged_index;
+    // Real-time mode, voices and channels are reserved and TinySoundFont never allocates
+    bool realtime_mode = false;
+    // Frames the scratch buffers are reserved for in real-time mode
+    int realtime_frames = 0;
+    // Set by a render in real-time mode when voices run low to the number of voices to grow to,
+    // queue_event grows them
+    std::atomic<int> grow_voice_num{0};
 
     SoundFont(py::bytes bytes)
     {
         py::buffer_info info(py::buffer(bytes).request());
-        obj = tsf_load_memory(info.ptr, info.size);
+        {
+            py::gil_scoped_release release;
+            obj = tsf_load_memory(info.ptr, info.size);
+        }
         if (!obj) {
             throw std::runtime_error(std::string("Could not load SoundFont from bytes"));
         }
@@ -49,13 +381,42 @@ public:
 
     SoundFont(const std::string& filename)
     {
-        obj = tsf_load_filename(filename.c_str());
+        {
+            py::gil_scoped_release release;
+            obj = tsf_load_filename(filename.c_str());
+        }
         if (!obj) {
             throw std::runtime_error(std::string("Could not load SoundFont file: ") + filename);
         }
     }
 
+    // Takes ownership of a loaded tsf
+    explicit SoundFont(tsf* loaded) : obj(loaded) {}
+
+    static std::unique_ptr<SoundFont> from_mmap(const std::string& filename, bool lazy) {
+        tsf* loaded;
+        {
+            py::gil_scoped_release release;
+            std::unique_ptr<mapped_file::File> file(new mapped_file::File(filename));
+            if (file->size() > static_cast<size_t>(INT_MAX)) {
+                throw std::runtime_error("SoundFont file is too large: " + filename);
+            }
+            // The tsf releases the mapping when it and all its copies are closed
+            auto load = (lazy ? &tsf_load_memory_inplace_lazy : &tsf_load_memory_inplace);
+            loaded = load(file->data(), static_cast<int>(file->size()), &mapped_file::File::release, file.get());
+            if (loaded) {
+                file.release();
+            }
+        }
+        if (!loaded) {
+            throw std::runtime_error(std::string("Could not load SoundFont file: ") + filename);
+        }
+        return std::unique_ptr<SoundFont>(new SoundFont(loaded));
+    }
+
     SoundFont(const SoundFont &other) {
+        auto guard = other.lock();
+        stem_buses = other.stem_buses;
         obj = tsf_copy(other.obj);
         if (!obj) {
             throw std::runtime_error("Could not clone existing SoundFont object");
@@ -66,167 +427,559 @@ public:
         tsf_close(obj);
     }
 
-    void reset() { tsf_reset(obj); }
+    std::unique_lock<std::mutex> lock() const { return lock_without_gil(mutex); }
+
+    // Move the queued commands due before the end of the next samples frames into due, as
+    // events at frame offsets in queue order. Returns the number of events.
+    size_t take_commands(int samples) {
+        long long start = frame_position.load(std::memory_order_relaxed);
+        size_t count = 0;
+        const command_queue::Command* command;
+        while (count < due.size() && (command = commands.front()) && command->frame < start + samples) {
+            // Late commands and commands queued out of order are applied as soon as possible
+            long long offset = std::max(command->frame - start, static_cast<long long>(count ? due[count - 1].offset : 0));
+            due[count++] = FrameEvent{ static_cast<int32_t>(offset), command->type, command->channel, command->data1, command->data2 };
+            commands.pop();
+        }
+        return count;
+    }
+
+    // Render samples frames with render(offset, count), in pieces split at the queued commands
+    // that are due. Called with the object locked.
+    template<class Render>
+    void render_commands(int samples, Render render) {
+        size_t count = take_commands(samples);
+        int position = 0;
+        for (size_t i = 0; i < count; i++) {
+            const FrameEvent& e = due[i];
+            if (e.offset > position) {
+                render(position, e.offset - position);
+                position = e.offset;
+            }
+            // Nobody can be told on the render thread, so a command that fails is dropped
+            apply_event(obj, e.type, e.channel, e.data1, e.data2);
+        }
+        if (position < samples) {
+            render(position, samples - position);
+        }
+        frame_position.store(frame_position.load(std::memory_order_relaxed) + samples, std::memory_order_release);
+        request_growth();
+    }
+
+    // Ask for more voices if a render in real-time mode left few free. Called with the object locked.
+    void request_growth() {
+        if (realtime_mode && !obj->maxVoiceNum && (obj->voiceNum - obj->activeVoiceNum) * REALTIME_GROW_FREE_FRACTION < obj->voiceNum) {
+            grow_voice_num.store(obj->voiceNum * 2, std::memory_order_relaxed);
+        }
+    }
+
+    // Grow the voices as asked for by a render. The storage is allocated and freed without the
+    // lock, which is only held to swap it in, and not at all while a render is running. Called
+    // without the lock.
+    void grow_voices() {
+        int voices = grow_voice_num.load(std::memory_order_relaxed);
+        if (!voices) {
+            return;
+        }
+        tsf_voice_storage storage;
+        if (!tsf_voice_storage_alloc(&storage, voices)) {
+            return;
+        }
+        // Stems sort the active voices in buffers of their own
+        stems::Scratch stem_storage;
+        stems::reserve(stem_storage, voices, 0, 0);
+        {
+            std::unique_lock<std::mutex> guard(mutex, std::try_to_lock);
+            if (guard.owns_lock() && grow_voice_num.compare_exchange_strong(voices, 0, std::memory_order_relaxed)) {
+                tsf_swap_voices(obj, &storage);
+                stem_scratch.order.swap(stem_storage.order);
+                stem_scratch.pans.swap(stem_storage.pans);
+            }
+        }
+        tsf_voice_storage_free(&storage);
+    }
+
+    // Reserve the scratch buffers for a render of samples frames, so the render does not allocate
+    // them inside its Section. Called with the object locked.
+    void reserve_render(int samples) {
+        int block = std::max(1, CONVERT_BLOCK_FRAMES / obj->effectSampleBlock) * obj->effectSampleBlock;
+        scratch.reserve(static_cast<size_t>(std::max(samples, block)) * 2);
+        thread_scratch.reserve(render_threads::scratch_size(obj, samples));
+    }
+
+    // Render into a float buffer in the output mode. Called with the object locked.
+    void render_float(float* buffer, int samples, bool mix) {
+        reserve_render(samples);
+        render_threads::Lend lend(thread_scratch);
+        realtime::Section section(realtime_mode);
+        render_commands(samples, [&](int offset, int count) {
+            render_frames(obj, buffer, samples, offset, count, mix, scratch);
+        });
+    }
+
+    // Like render_float, in steps of whole effect blocks of about step frames within each piece
+    // between commands, which gives the same samples as rendering each piece at once. wait(end)
+    // is called before rendering up to frame end and done(end) after. Called with the object locked.
+    template<class Wait, class Done>
+    void render_float_steps(float* buffer, int samples, bool mix, int step, Wait wait, Done done) {
+        reserve_render(samples);
+        render_threads::Lend lend(thread_scratch);
+        realtime::Section section(realtime_mode);
+        int size = std::max(1, step / obj->effectSampleBlock) * obj->effectSampleBlock;
+        render_commands(samples, [&](int offset, int count) {
+            for (int i = 0; i < count; i += size) {
+                int end = offset + std::min(i + size, count);
+                wait(end);
+                render_frames(obj, buffer, samples, offset + i, end - offset - i, mix, scratch);
+                done(end);
+            }
+        });
+    }
+
+    void reset() { auto guard = lock(); realtime::Section section(realtime_mode); tsf_reset(obj); }
+
+    int get_preset_index(int bank, int number) { auto guard = lock(); return tsf_get_presetindex(obj, bank, number); }
+
+    int get_preset_count() { auto guard = lock(); return tsf_get_presetcount(obj); }
+
+    std::string get_preset_name(int index) { auto guard = lock(); return string_none_if_nullptr(tsf_get_presetname(obj, index)); }
+
+    std::string get_preset_name(int bank, int number) { auto guard = lock(); return string_none_if_nullptr(tsf_bank_get_presetname(obj, bank, number)); }
+
+    void set_output(enum TSFOutputMode output_mode, int samplerate, float global_gain_db) {
+        auto guard = lock();
+        tsf_set_output(obj, output_mode, samplerate, global_gain_db);
+        reserve_render(realtime_frames);
+    }
+
+    void set_volume(float global_gain) { auto guard = lock(); tsf_set_volume(obj, global_gain); }
+
+    void set_max_voices(int max_voices) {
+        auto guard = lock();
+        // In real-time mode the steal heap is allocated now, not by the next note that steals a voice
+        if (!tsf_set_max_voices(obj, max_voices) || (realtime_mode && !tsf_reserve(obj, 0, 0))) {
+            throw std::runtime_error("Error in set_max_voices");
+        }
+    }
+
+    void set_realtime(bool enabled, int voices, int channels, int frames) {
+        if (voices < 0 || channels < 0 || frames < 0) {
+            throw std::runtime_error("Number of voices, channels and frames to reserve must not be negative");
+        }
+        auto guard = lock();
+        if (enabled && !tsf_reserve(obj, voices, channels)) {
+            throw std::runtime_error("Could not reserve voices and channels");
+        }
+        tsf_set_realtime(obj, enabled ? 1 : 0);
+        realtime_mode = enabled;
+        realtime_frames = (enabled ? frames : 0);
+        grow_voice_num.store(0, std::memory_order_relaxed);
+        reserve_render(realtime_frames);
+        stems::reserve(stem_scratch, obj->voiceNum, channels, realtime_frames);
+    }
+
+    bool get_realtime() { auto guard = lock(); return realtime_mode; }
+
+    void set_voice_stealing(enum TSFVoiceStealing policy) { auto guard = lock(); tsf_set_voice_stealing(obj, policy); }
+
+    int active_voice_count() { auto guard = lock(); return tsf_active_voice_count(obj); }
+
+    int stolen_voice_count() { auto guard = lock(); return tsf_stolen_voice_count(obj); }
+
+    int dropped_voice_count() { auto guard = lock(); return tsf_dropped_voice_count(obj); }
+
+    long long clipped_sample_count() { auto guard = lock(); return clipped; }
+
+    size_t sample_memory_bytes() {
+        auto guard = lock();
+        if (obj->lazySamples) {
+            return static_cast<size_t>(obj->sampleCacheStats.bytes);
+        }
+        if (obj->fontSamples) {
+            return obj->fontSampleCount * sizeof(float);
+        }
+        // 16-bit samples read from a file mapping have no storage of their own
+        return (obj->fontSampleStorage ? obj->fontSampleCount * sizeof(uint16_t) : 0);
+    }
+
+    void set_sample_format(enum TSFSampleFormat format) {
+        auto guard = lock();
+        py::gil_scoped_release release;
+        if (!tsf_set_sample_format(obj, format)) {
+            throw std::runtime_error("Could not convert samples, the SoundFont has copies, decodes samples lazily or is out of memory");
+        }
+    }
 
-    int get_preset_index(int bank, int number) { return tsf_get_presetindex(obj, bank, number); }
+    void set_sample_cache(unsigned long long max_bytes) { auto guard = lock(); tsf_set_sample_cache(obj, max_bytes); }
 
-    int get_preset_count() { return tsf_get_presetcount(obj); }
+    void decode_presets(const std::vector<int>& preset_indices) {
+        auto guard = lock();
+        for (int index : preset_indices) {
+            if (index < 0 || index >= obj->presetNum) {
+                throw std::runtime_error("Preset index out of range");
+            }
+        }
+        py::gil_scoped_release release;
+        if (!tsf_decode_presets(obj, preset_indices.data(), static_cast<int>(preset_indices.size()))) {
+            throw std::runtime_error("Could not decode the samples of the presets");
+        }
+    }
 
-    std::string get_preset_name(int index) { return string_none_if_nullptr(tsf_get_presetname(obj, index)); }
+    py::dict sample_cache_stats() {
+        struct tsf_sample_cache_stats stats;
+        {
+            auto guard = lock();
+            tsf_get_sample_cache_stats(obj, &stats);
+        }
+        py::dict d;
+        d["hits"] = stats.hits;
+        d["misses"] = stats.misses;
+        d["evictions"] = stats.evictions;
+        d["decodes"] = stats.decodes;
+        d["bytes"] = stats.bytes;
+        return d;
+    }
 
-    std::string get_preset_name(int bank, int number) { return string_none_if_nullptr(tsf_bank_get_presetname(obj, bank, number)); }
+    enum TSFSampleFormat get_sample_format() { auto guard = lock(); return tsf_get_sample_format(obj); }
 
-    void set_output(enum TSFOutputMode output_mode, int samplerate, float global_gain_db) { tsf_set_output(obj, output_mode, samplerate, global_gain_db); }
+    void set_fixed_point_phase(bool enabled) { auto guard = lock(); tsf_set_fixedpoint_phase(obj, enabled ? 1 : 0); }
 
-    void set_volume(float global_gain) { tsf_set_volume(obj, global_gain); }
+    void set_interpolation(enum TSFInterpolation interpolation) {
+        // The cubic and windowed-sinc tables take about 1.3 MB, so they are built the first time
+        // they are selected, and only once while renders on other threads may read them
+        if (interpolation != TSF_INTERP_LINEAR) {
+            static std::once_flag tables;
+            std::call_once(tables, &tsf_interp_setup_tables);
+        }
+        auto guard = lock();
+        tsf_set_interpolation(obj, interpolation);
+    }
+
+    void set_block_size(int block_size, bool gain_ramp) {
+        if (block_size < 1) {
+            throw std::runtime_error("Block size must be at least 1");
+        }
+        auto guard = lock();
+        tsf_set_effect_block(obj, block_size, gain_ramp ? 1 : 0);
+    }
 
-    void set_max_voices(int max_voices) { tsf_set_max_voices(obj, max_voices); }
+    void set_float_filters(bool enabled) { auto guard = lock(); tsf_set_float_filters(obj, enabled ? 1 : 0); }
+
+    void set_render_threads(int threads) {
+        if (threads < 1) {
+            throw std::runtime_error("Number of render threads must be at least 1");
+        }
+        auto guard = lock();
+        tsf_set_render_threads(obj, threads);
+        reserve_render(realtime_frames);
+    }
 
     void note_on(int index, int key, float velocity) {
+        auto guard = lock();
+        realtime::Section section(realtime_mode);
         if (!tsf_note_on(obj, index, key, velocity)) {
             throw std::runtime_error(std::string("Error in note_on"));
         }
     }
 
     void note_on(int bank, int number, int key, float velocity) {
+        auto guard = lock();
+        realtime::Section section(realtime_mode);
         if (!tsf_bank_note_on(obj, bank, number, key, velocity)) {
             throw std::runtime_error("Error in note_on");
         }
     }
 
-    void note_off() { tsf_note_off_all(obj); }
+    void note_off() { auto guard = lock(); realtime::Section section(realtime_mode); tsf_note_off_all(obj); }
 
-    void note_off(int index, int key) { tsf_note_off(obj, index, key); }
+    void note_off(int index, int key) { auto guard = lock(); realtime::Section section(realtime_mode); tsf_note_off(obj, index, key); }
 
-    void note_off(int bank, int number, int key) { tsf_bank_note_off(obj, bank, number, key); }
+    void note_off(int bank, int number, int key) { auto guard = lock(); realtime::Section section(realtime_mode); tsf_bank_note_off(obj, bank, number, key); }
 
-    void render(py::buffer buffer, bool mix) {
+    void render(py::buffer buffer, bool mix, bool dither_output) {
         py::buffer_info info = buffer.request();
-        int output_channels = obj->outputmode == TSF_MONO ? 1 : 2;
-        if (info.ndim == 1) {
-            // 1D buffers must be contiguous byte arrays
-            if (info.format != py::format_descriptor<unsigned char>::format()) {
-                throw std::runtime_error("Incompatible buffer format, must be unsigned char");
-            }
-            if (info.shape[0] % (sizeof(float) * output_channels)) {
-                throw std::runtime_error("Buffer length does not divide evenly into sample frames");
-            }
-            int samples = info.shape[0] / (sizeof(float) * output_channels);
-            tsf_render_float(obj, static_cast<float *>(info.ptr), samples, mix ? 1 : 0);
-            return;
+        auto guard = lock();
+        SampleType type = buffer_sample_type(info);
+        int samples = buffer_frames(info, obj->outputmode == TSF_MONO ? 1 : 2, type);
+        py::gil_scoped_release release;
+        if (type == SampleType::Float32) {
+            render_float(static_cast<float *>(info.ptr), samples, mix);
+        } else {
+            reserve_render(samples);
+            render_threads::Lend lend(thread_scratch);
+            realtime::Section section(realtime_mode);
+            render_commands(samples, [&](int offset, int count) {
+                clipped += render_converted(obj, info.ptr, type, samples, offset, count, mix, dither_output ? dither : nullptr, scratch);
+            });
         }
-        if (info.format != py::format_descriptor<float>::format()) {
-            throw std::runtime_error("Incompatible buffer format, must be float32");
+    }
+
+    void render_stems(py::buffer buffer, bool mix) {
+        py::buffer_info info = buffer.request();
+        int samples = stem_buffer_frames(info);
+        auto guard = lock();
+        py::gil_scoped_release release;
+        float* output = static_cast<float *>(info.ptr);
+        stems::reserve(stem_scratch, obj->voiceNum, static_cast<int>(info.shape[0]), samples);
+        realtime::Section section(realtime_mode);
+        render_commands(samples, [&](int offset, int count) {
+            stems::render(obj, output + offset * 2, static_cast<int>(info.shape[0]), samples, count, mix, stem_buses, stem_scratch);
+        });
+    }
+
+    // Does not lock the object, so control threads never wait for a render. The queue has a
+    // single producer, so concurrent callers take turns on producer_mutex. The GIL already
+    // serializes them, the mutex keeps that true without it.
+    bool queue_event(enum MidiMessageType type, int channel, int data1, int data2, long long frame) {
+        int32_t kind = static_cast<int32_t>(type);
+        check_event(kind, channel, data1, data2);
+        grow_voices();
+        std::lock_guard<std::mutex> guard(producer_mutex);
+        return commands.push(command_queue::Command{ frame, kind, channel, data1, data2 });
+    }
+
+    long long get_frame_position() const { return frame_position.load(std::memory_order_acquire); }
+
+    void set_stem_bus(int channel, float gain_db, float pan) {
+        if (channel < 0) {
+            throw std::runtime_error("Error in set_stem_bus");
         }
-        if (info.ndim != 2) {
-            throw std::runtime_error("Incompatible buffer dimension, must be 1 dimensional bytearray or 2 dimensional of size (samples, channels)");
+        auto guard = lock();
+        if (stem_buses.size() <= static_cast<size_t>(channel)) {
+            stem_buses.resize(channel + 1);
         }
-        if (info.shape[1] != output_channels) {
-            throw std::runtime_error(std::string("Incompatible buffer length, channel size must be ") + std::string(output_channels == 1 ? "1 for mono" : "2 for stereo"));
+        stem_buses[channel] = stems::make_bus(gain_db, pan);
+    }
+
+    void render_events(py::buffer buffer, py::buffer events, bool mix) {
+        py::buffer_info info = buffer.request();
+        py::buffer_info event_info = events.request();
+        auto guard = lock();
+        int samples = buffer_frames(info, obj->outputmode == TSF_MONO ? 1 : 2);
+        std::pair<const FrameEvent*, size_t> frame_events_checked = frame_events(event_info, samples);
+        long failed;
+        {
+            py::gil_scoped_release release;
+            const FrameEvent* events = frame_events_checked.first;
+            size_t count = frame_events_checked.second;
+            reserve_render(samples);
+            merged.reserve(count + due.size());
+            merged_index.reserve(count + due.size());
+            render_threads::Lend lend(thread_scratch);
+            realtime::Section section(realtime_mode);
+            size_t queued = take_commands(samples);
+            if (queued) {
+                // Queued commands go before the events at the same offset
+                merged.clear();
+                merged_index.clear();
+                for (size_t i = 0, j = 0; i < queued || j < count;) {
+                    if (i < queued && (j == count || due[i].offset <= events[j].offset)) {
+                        merged.push_back(due[i++]);
+                        merged_index.push_back(-1);
+                    } else {
+                        merged_index.push_back(static_cast<long>(j));
+                        merged.push_back(events[j++]);
+                    }
+                }
+                events = merged.data();
+                count = merged.size();
+            }
+            failed = render_with_events(obj, static_cast<float *>(info.ptr), samples, mix, events, count, scratch, queued ? merged_index.data() : nullptr);
+            frame_position.store(frame_position.load(std::memory_order_relaxed) + samples, std::memory_order_release);
+            request_growth();
+        }
+        if (failed >= 0) {
+            throw std::runtime_error("Error in render_events at event " + std::to_string(failed));
         }
-        int samples = info.shape[0];
-        tsf_render_float(obj, static_cast<float *>(info.ptr), samples, mix ? 1 : 0);
-        return;
     }
 
     void channel_set_preset_index(int channel, int index) {
+        auto guard = lock();
+        realtime::Section section(realtime_mode);
         if (!tsf_channel_set_presetindex(obj, channel, index)) {
             throw std::runtime_error("Error in channel_set_preset_index");
         }
     }
 
     void channel_set_preset_number(int channel, int number, bool drum) {
+        auto guard = lock();
+        realtime::Section section(realtime_mode);
         if (!tsf_channel_set_presetnumber(obj, channel, number, drum ? 1 : 0)) {
             throw std::runtime_error("Error in channel_set_preset_number");
         }
     }
 
     void channel_set_bank(int channel, int bank) {
+        auto guard = lock();
+        realtime::Section section(realtime_mode);
         if (!tsf_channel_set_bank(obj, channel, bank)) {
             throw std::runtime_error("Error in channel_set_bank");
         }
     }
 
     void channel_set_bank_preset(int channel, int bank, int number) {
+        auto guard = lock();
+        realtime::Section section(realtime_mode);
         if (!tsf_channel_set_bank_preset(obj, channel, bank, number)) {
             throw std::runtime_error("Error in channel_set_bank_preset");
         }
     }
 
     void channel_set_pan(int channel, float pan) {
+        auto guard = lock();
+        realtime::Section section(realtime_mode);
         if (!tsf_channel_set_pan(obj, channel, pan)) {
             throw std::runtime_error("Error in channel_set_pan");
         }
     }
 
     void channel_set_volume(int channel, float volume) {
+        auto guard = lock();
+        realtime::Section section(realtime_mode);
         if (!tsf_channel_set_volume(obj, channel, volume)) {
             throw std::runtime_error("Error in channel_set_volume");
         }
     }
 
     void channel_set_pitch_wheel(int channel, int pitch_wheel) {
+        auto guard = lock();
+        realtime::Section section(realtime_mode);
         if (!tsf_channel_set_pitchwheel(obj, channel, pitch_wheel)) {
             throw std::runtime_error("Error in channel_set_pitch_wheel");
         }
     }
 
     void channel_set_pitch_range(int channel, float range) {
+        auto guard = lock();
+        realtime::Section section(realtime_mode);
         if (!tsf_channel_set_pitchrange(obj, channel, range)) {
             throw std::runtime_error("Error in channel_set_pitch_range");
         }
     }
 
     void channel_set_tuning(int channel, float tuning) {
+        auto guard = lock();
+        realtime::Section section(realtime_mode);
         if (!tsf_channel_set_tuning(obj, channel, tuning)) {
             throw std::runtime_error("Error in channel_set_tuning");
         }
     }
 
     void channel_note_on(int channel, int key, float velocity) {
+        auto guard = lock();
+        realtime::Section section(realtime_mode);
         if (!tsf_channel_note_on(obj, channel, key, velocity)) {
             throw std::runtime_error(std::string("Error in channel_note_on"));
         }
     }
 
-    void channel_note_off(int channel, int key) { tsf_channel_note_off(obj, channel, key); }
+    void channel_note_off(int channel, int key) { auto guard = lock(); realtime::Section section(realtime_mode); tsf_channel_note_off(obj, channel, key); }
 
-    void channel_note_off(int channel) { tsf_channel_note_off_all(obj, channel); }
+    void channel_note_off(int channel) { auto guard = lock(); realtime::Section section(realtime_mode); tsf_channel_note_off_all(obj, channel); }
 
-    void channel_sounds_off(int channel) { tsf_channel_sounds_off_all(obj, channel); }
+    void channel_sounds_off(int channel) { auto guard = lock(); realtime::Section section(realtime_mode); tsf_channel_sounds_off_all(obj, channel); }
 
     void channel_midi_control(int channel, int controller, int control_value) {
+        auto guard = lock();
+        realtime::Section section(realtime_mode);
         if (!tsf_channel_midi_control(obj, channel, controller, control_value)) {
             throw std::runtime_error(std::string("Error in channel_midi_control"));
         }
     }
 
-    int channel_get_preset_index(int channel) { return tsf_channel_get_preset_index(obj, channel); }
+    int channel_get_preset_index(int channel) { auto guard = lock(); return tsf_channel_get_preset_index(obj, channel); }
 
-    int channel_get_preset_bank(int channel) { return tsf_channel_get_preset_bank(obj, channel); }
+    int channel_get_preset_bank(int channel) { auto guard = lock(); return tsf_channel_get_preset_bank(obj, channel); }
 
-    int channel_get_preset_number(int channel) { return tsf_channel_get_preset_number(obj, channel); }
+    int channel_get_preset_number(int channel) { auto guard = lock(); return tsf_channel_get_preset_number(obj, channel); }
 
-    float channel_get_pan(int channel) { return tsf_channel_get_pan(obj, channel); }
+    float channel_get_pan(int channel) { auto guard = lock(); return tsf_channel_get_pan(obj, channel); }
 
-    float channel_get_volume(int channel) { return tsf_channel_get_volume(obj, channel); }
+    float channel_get_volume(int channel) { auto guard = lock(); return tsf_channel_get_volume(obj, channel); }
 
-    int channel_get_pitch_wheel(int channel) { return tsf_channel_get_pitchwheel(obj, channel); }
+    int channel_get_pitch_wheel(int channel) { auto guard = lock(); return tsf_channel_get_pitchwheel(obj, channel); }
 
-    float channel_get_pitch_range(int channel) { return tsf_channel_get_pitchrange(obj, channel); }
+    float channel_get_pitch_range(int channel) { auto guard = lock(); return tsf_channel_get_pitchrange(obj, channel); }
 
-    float channel_get_tuning(int channel) { return tsf_channel_get_tuning(obj, channel); }
+    float channel_get_tuning(int channel) { auto guard = lock(); return tsf_channel_get_tuning(obj, channel); }
 };
 
-enum class MidiMessageType {
-    NOTE_OFF = 0x80,
-    NOTE_ON = 0x90,
-    KEY_PRESSURE = 0xA0,
-    CONTROL_CHANGE = 0xB0,
-    PROGRAM_CHANGE = 0xC0,
-    CHANNEL_PRESSURE = 0xD0,
-    PITCH_BEND = 0xE0,
-    SET_TEMPO = 0x51
+// Steps each SoundFont of a Mixer renders the buffer in
+constexpr int MIXER_STEPS = 8;
+
+// Mixes several SoundFonts into one buffer, each one adding its voices to the buffer in turn like
+// render with mix=True. On the shared thread pool the SoundFonts render as a pipeline: each one
+// renders the buffer in steps, and a step starts once the SoundFont before it has rendered those
+// frames. So the samples are added in the same order as rendering one SoundFont after the other.
+class Mixer {
+public:
+    void render(const std::vector<SoundFont*>& soundfonts, py::buffer buffer, bool mix) {
+        py::buffer_info info = buffer.request();
+        // Lock in address order, so mixers sharing SoundFonts cannot deadlock
+        std::vector<SoundFont*> order(soundfonts);
+        std::sort(order.begin(), order.end());
+        if (std::adjacent_find(order.begin(), order.end()) != order.end()) {
+            throw std::runtime_error("Each SoundFont can only be mixed once");
+        }
+        if (!order.empty() && !order.front()) {
+            throw std::runtime_error("Cannot mix None");
+        }
+        std::vector<std::unique_lock<std::mutex>> guards;
+        for (SoundFont* soundfont : order) {
+            guards.push_back(soundfont->lock());
+        }
+        if (soundfonts.empty()) {
+            if (!mix) {
+                std::memset(info.ptr, 0, info.size * info.itemsize);
+            }
+            return;
+        }
+        enum TSFOutputMode output_mode = soundfonts[0]->obj->outputmode;
+        for (SoundFont* soundfont : soundfonts) {
+            if (soundfont->obj->outputmode != output_mode) {
+                throw std::runtime_error("All mixed SoundFonts must have the same output mode");
+            }
+        }
+        int output_channels = output_mode == TSF_MONO ? 1 : 2;
+        int samples = buffer_frames(info, output_channels);
+        float* output = static_cast<float *>(info.ptr);
+        py::gil_scoped_release release;
+        std::shared_ptr<thread_pool::Pool> pool = thread_pool::shared();
+        // SoundFonts that render on several threads themselves sum their voices in chunks that
+        // depend on the steps, so they are rendered one after the other
+        bool pipeline = soundfonts.size() > 1 && pool->workers() > 0;
+        for (SoundFont* soundfont : soundfonts) {
+            pipeline = pipeline && soundfont->obj->renderThreads <= 1;
+        }
+        if (!pipeline) {
+            for (size_t i = 0; i < soundfonts.size(); i++) {
+                soundfonts[i]->render_float(output, samples, mix || i > 0);
+            }
+            return;
+        }
+        // Frames rendered by each SoundFont. A SoundFont only waits for the ones before it, which
+        // the pool started earlier, so the pipeline always makes progress.
+        std::vector<int> progress(soundfonts.size(), 0);
+        std::mutex progress_mutex;
+        std::condition_variable progress_changed;
+        int step = std::max(1, samples / MIXER_STEPS);
+        pool->run(static_cast<int>(soundfonts.size()), [&](int i) {
+            auto wait = [&](int end) {
+                if (i > 0) {
+                    std::unique_lock<std::mutex> guard(progress_mutex);
+                    progress_changed.wait(guard, [&]() { return progress[i - 1] >= end; });
+                }
+            };
+            auto done = [&](int end) {
+                {
+                    std::lock_guard<std::mutex> guard(progress_mutex);
+                    progress[i] = end;
+                }
+                progress_changed.notify_all();
+            };
+            soundfonts[i]->render_float_steps(output, samples, mix || i > 0, step, wait, done);
+        });
+    }
 };
 
 
@@ -291,13 +1044,426 @@ py::list midi_load_memory(py::bytes bytes) {
     return result;
 }
 
+// Frame of a MIDI message time in milliseconds, rounded to the nearest frame
+long long midi_frame(unsigned int time, int samplerate) {
+    return (static_cast<long long>(time) * samplerate + 500) / 1000;
+}
+
+// Append the channel messages of a MIDI song as frame events, returns the frame of the last message
+long long midi_frame_events(const tml_message* messages, int samplerate, std::vector<FrameEvent>& events) {
+    long long last = 0;
+    for (const tml_message* pos = messages; pos; pos = pos->next) {
+        last = midi_frame(pos->time, samplerate);
+        int32_t offset = static_cast<int32_t>(std::min<long long>(last, INT_MAX));
+        int32_t channel = pos->channel;
+        switch (pos->type) {
+            case TML_NOTE_OFF:
+            case TML_NOTE_ON:
+                events.push_back(FrameEvent{offset, pos->type, channel, pos->key, pos->velocity});
+                break;
+            case TML_CONTROL_CHANGE:
+                events.push_back(FrameEvent{offset, pos->type, channel, pos->control, pos->control_value});
+                break;
+            case TML_PROGRAM_CHANGE:
+                events.push_back(FrameEvent{offset, pos->type, channel, pos->program, channel == 9 ? 1 : 0});
+                break;
+            case TML_PITCH_BEND:
+                events.push_back(FrameEvent{offset, pos->type, channel, pos->pitch_bend, 0});
+                break;
+            default:
+                break;
+        }
+    }
+    return last;
+}
+
+// Number of frames of a song with a tail after the last message, that fit in one buffer
+int song_frames(long long last, double tail_seconds, int samplerate, int output_channels) {
+    long long frames = last + static_cast<long long>(tail_seconds * samplerate + 0.5);
+    if (frames > INT_MAX / output_channels) {
+        throw std::runtime_error("MIDI song is too long to render into one buffer");
+    }
+    return static_cast<int>(frames);
+}
+
+// Prepare a copy of a SoundFont that has not played anything yet for a MIDI song. Every channel
+// starts on preset 0, channel 10 with MIDI drum rules.
+void start_song(tsf* f, int samplerate) {
+    tsf_set_output(f, f->outputmode, samplerate, f->globalGainDB);
+    for (int channel = 0; channel < 16; channel++) {
+        tsf_channel_set_presetnumber(f, channel, 0, channel == 9 ? 1 : 0);
+    }
+}
+
+// Render a MIDI song with a copy of a SoundFont that has not played anything yet
+void render_song(tsf* f, float* buffer, int samples, int samplerate, const std::vector<FrameEvent>& events, realtime::vector<float>& scratch) {
+    start_song(f, samplerate);
+    long failed = render_with_events(f, buffer, samples, false, events.data(), events.size(), scratch);
+    if (failed >= 0) {
+        throw std::runtime_error("Error in render_midi at event " + std::to_string(failed));
+    }
+}
+
+// Render a MIDI song like render_song in pieces of up to chunk_frames frames, calling
+// write(samples, frames) for each piece. The output mode must be interleaved or mono. Stretches
+// between events that do not fit in a piece are cut at multiples of the effect block size, so
+// voices are updated at the same frames and the output is the same as from render_song.
+template <class Write>
+void render_song_chunks(tsf* f, int samples, int samplerate, const std::vector<FrameEvent>& events, int chunk_frames, std::vector<float>& buffer, Write write) {
+    start_song(f, samplerate);
+    int channels = (f->outputmode == TSF_MONO ? 1 : 2);
+    int block = f->effectSampleBlock;
+    chunk_frames = std::max(chunk_frames, block);
+    buffer.resize(static_cast<size_t>(chunk_frames) * channels);
+    int position = 0;
+    int filled = 0;
+    size_t i = 0;
+    for (;;) {
+        for (; i < events.size() && events[i].offset <= position; i++) {
+            if (!apply_event(f, events[i].type, events[i].channel, events[i].data1, events[i].data2)) {
+                throw std::runtime_error("Error in render_midi at event " + std::to_string(i));
+            }
+        }
+        if (position == samples) {
+            break;
+        }
+        int end = (i < events.size() ? events[i].offset : samples);
+        int rendered = 0;
+        while (position < end) {
+            int count = end - position;
+            int space = chunk_frames - filled;
+            if (count > space) {
+                count = space - (space + rendered) % block;
+                if (count <= 0) {
+                    write(buffer.data(), filled);
+                    filled = 0;
+                    continue;
+                }
+            }
+            tsf_render_float(f, buffer.data() + static_cast<size_t>(filled) * channels, count, 0);
+            filled += count;
+            position += count;
+            rendered += count;
+        }
+    }
+    if (filled) {
+        write(buffer.data(), filled);
+    }
+}
+
+// Frames rendered at a time when streaming to a file
+constexpr int WAV_CHUNK_FRAMES = 16384;
+
+// Copy a SoundFont for rendering songs, the copy must be closed while holding the GIL
+std::unique_ptr<tsf, void (*)(tsf*)> copy_soundfont(const SoundFont& soundfont) {
+    std::unique_ptr<tsf, void (*)(tsf*)> copy(nullptr, tsf_close);
+    {
+        auto guard = soundfont.lock();
+        copy.reset(tsf_copy(soundfont.obj));
+    }
+    if (!copy) {
+        throw std::runtime_error("Could not clone existing SoundFont object");
+    }
+    return copy;
+}
+
+// Render a whole MIDI song with a copy of a SoundFont, so the SoundFont itself is not affected.
+// The messages are applied at their frames without calling into Python. The copy keeps the
+// output mode and gain of the SoundFont, the audio is returned as a bytearray of 32-bit floats.
+py::bytearray render_midi(const SoundFont& soundfont, py::bytes midi, int samplerate, double tail_seconds) {
+    if (samplerate < 1) {
+        throw std::runtime_error("Sample rate must be at least 1");
+    }
+    if (!(tail_seconds >= 0.0)) {
+        throw std::runtime_error("Tail must not be negative");
+    }
+    py::buffer_info info(py::buffer(midi).request());
+    std::unique_ptr<tsf, void (*)(tsf*)> copy = copy_soundfont(soundfont);
+    tsf* f = copy.get();
+    std::vector<FrameEvent> events;
+    long long last = 0;
+    bool loaded;
+    {
+        py::gil_scoped_release release;
+        tml_message* parsed = tml_load_memory(info.ptr, static_cast<int>(info.size));
+        loaded = (parsed != nullptr);
+        last = midi_frame_events(parsed, samplerate, events);
+        tml_free(parsed);
+    }
+    if (!loaded) {
+        throw std::runtime_error("Could not load MIDI data");
+    }
+    int channels = (f->outputmode == TSF_MONO ? 1 : 2);
+    int samples = song_frames(last, tail_seconds, samplerate, channels);
+    py::bytearray result(nullptr, static_cast<size_t>(samples) * channels * sizeof(float));
+    float* buffer = reinterpret_cast<float*>(PyByteArray_AsString(result.ptr()));
+    {
+        py::gil_scoped_release release;
+        realtime::vector<float> scratch;
+        render_song(f, buffer, samples, samplerate, events, scratch);
+    }
+    return result;
+}
+
+// Render a whole MIDI song like render_midi straight into a WAV file, a piece at a time so memory
+// use does not depend on the length of the song. File is a filename or a file descriptor. Stereo
+// is always written interleaved. Returns the number of frames written.
+long long render_midi_wav(const SoundFont& soundfont, py::bytes midi, py::object file, int samplerate, double tail_seconds, wav_writer::Format format) {
+    if (samplerate < 1) {
+        throw std::runtime_error("Sample rate must be at least 1");
+    }
+    if (!(tail_seconds >= 0.0)) {
+        throw std::runtime_error("Tail must not be negative");
+    }
+    bool is_fd = py::isinstance<py::int_>(file);
+    if (!is_fd && !py::isinstance<py::str>(file)) {
+        throw std::runtime_error("File must be a filename or a file descriptor");
+    }
+    int fd = (is_fd ? file.cast<int>() : -1);
+    std::string path = (is_fd ? std::string() : file.cast<std::string>());
+    py::buffer_info info(py::buffer(midi).request());
+    std::unique_ptr<tsf, void (*)(tsf*)> copy = copy_soundfont(soundfont);
+    tsf* f = copy.get();
+    py::gil_scoped_release release;
+    tml_message* parsed = tml_load_memory(info.ptr, static_cast<int>(info.size));
+    if (!parsed) {
+        throw std::runtime_error("Could not load MIDI data");
+    }
+    std::vector<FrameEvent> events;
+    long long last = midi_frame_events(parsed, samplerate, events);
+    tml_free(parsed);
+    if (f->outputmode == TSF_STEREO_UNWEAVED) {
+        f->outputmode = TSF_STEREO_INTERLEAVED;
+    }
+    int channels = (f->outputmode == TSF_MONO ? 1 : 2);
+    int samples = song_frames(last, tail_seconds, samplerate, channels);
+    wav_writer::Writer writer(is_fd ? wav_writer::open_fd(fd) : wav_writer::open_path(path), format, channels, samplerate, samples);
+    std::vector<float> buffer;
+    render_song_chunks(f, samples, samplerate, events, WAV_CHUNK_FRAMES, buffer, [&](const float* output, int frames) {
+        writer.write(output, frames);
+    });
+    writer.close();
+    return samples;
+}
+
+// Result of one song of a MidiBatch
+struct MidiBatchResult {
+    int index = 0;
+    py::object audio;
+    double seconds = 0.0;
+    std::string error;
+};
+
+// Renders many MIDI songs with one SoundFont on a pool of threads, each with its own copy of the
+// SoundFont, and hands out the songs in the order they finish. The songs render in the
+// background from construction on, the Python thread only waits for the next finished song.
+class MidiBatch {
+public:
+    MidiBatch(const SoundFont& soundfont, py::list midis, int samplerate, double tail_seconds, int threads)
+        : samplerate(samplerate), tail_seconds(tail_seconds)
+    {
+        if (samplerate < 1) {
+            throw std::runtime_error("Sample rate must be at least 1");
+        }
+        if (!(tail_seconds >= 0.0)) {
+            throw std::runtime_error("Tail must not be negative");
+        }
+        if (threads < 0) {
+            throw std::runtime_error("Number of threads must not be negative");
+        }
+        for (py::handle midi : midis) {
+            Job job;
+            if (py::isinstance<py::bytes>(midi)) {
+                job.data = midi.cast<std::string>();
+            } else if (py::isinstance<py::str>(midi)) {
+                job.path = true;
+                job.data = midi.cast<std::string>();
+            } else {
+                throw std::runtime_error("MIDI songs must be bytes or filenames");
+            }
+            jobs.push_back(std::move(job));
+        }
+        if (threads == 0) {
+            threads = thread_pool::threads();
+        }
+        threads = std::max(1, std::min(threads, static_cast<int>(jobs.size())));
+        for (int i = 0; i < threads; i++) {
+            copies.push_back(copy_soundfont(soundfont));
+            idle.push_back(copies.back().get());
+        }
+        voice_play_index = copies.front()->voicePlayIndex;
+        pool.reset(new thread_pool::Pool(threads - 1));
+        driver = std::thread([this]() {
+            pool->run(static_cast<int>(jobs.size()), [this](int index) { render(index); });
+        });
+    }
+
+    ~MidiBatch() {
+        stopping = true;
+        {
+            py::gil_scoped_release release;
+            driver.join();
+            pool.reset();
+        }
+    }
+
+    MidiBatch(const MidiBatch&) = delete;
+    MidiBatch& operator=(const MidiBatch&) = delete;
+
+    size_t size() const { return jobs.size(); }
+
+    MidiBatchResult next() {
+        Finished song;
+        bool done;
+        {
+            py::gil_scoped_release release;
+            std::unique_lock<std::mutex> guard(mutex);
+            changed.wait(guard, [this]() { return !finished.empty() || delivered == jobs.size(); });
+            done = finished.empty();
+            if (!done) {
+                song = std::move(finished.front());
+                finished.pop_front();
+                delivered++;
+            }
+        }
+        if (done) {
+            throw py::stop_iteration();
+        }
+        MidiBatchResult result;
+        result.index = song.index;
+        result.seconds = song.seconds;
+        result.error = song.error;
+        if (song.error.empty()) {
+            result.audio = py::bytearray(reinterpret_cast<const char*>(song.audio.data()), song.audio.size() * sizeof(float));
+        } else {
+            result.audio = py::none();
+        }
+        return result;
+    }
+
+private:
+    struct Job {
+        std::string data;
+        bool path = false;
+    };
+
+    struct Finished {
+        int index = 0;
+        std::vector<float> audio;
+        double seconds = 0.0;
+        std::string error;
+    };
+
+    // Render one song on a pool thread, with the GIL released
+    void render(int index) {
+        if (stopping) {
+            return;
+        }
+        auto start = std::chrono::steady_clock::now();
+        Finished song;
+        song.index = index;
+        tsf* f;
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            f = idle.back();
+            idle.pop_back();
+        }
+        try {
+            const Job& job = jobs[index];
+            tml_message* parsed = (job.path ? tml_load_filename(job.data.c_str()) : tml_load_memory(job.data.data(), static_cast<int>(job.data.size())));
+            if (!parsed) {
+                throw std::runtime_error(job.path ? "Could not load MIDI file: " + job.data : std::string("Could not load MIDI data"));
+            }
+            std::vector<FrameEvent> events;
+            long long last = midi_frame_events(parsed, samplerate, events);
+            tml_free(parsed);
+            int channels = (f->outputmode == TSF_MONO ? 1 : 2);
+            int samples = song_frames(last, tail_seconds, samplerate, channels);
+            song.audio.resize(static_cast<size_t>(samples) * channels);
+            tsf_restart(f, voice_play_index);
+            render_song(f, song.audio.data(), samples, samplerate, events, scratch());
+        } catch (const std::exception& e) {
+            song.audio.clear();
+            song.error = e.what();
+        }
+        song.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            idle.push_back(f);
+            finished.push_back(std::move(song));
+        }
+        changed.notify_all();
+    }
+
+    // Scratch buffer for unweaved output of the rendering thread
+    static realtime::vector<float>& scratch() {
+        static thread_local realtime::vector<float> buffer;
+        return buffer;
+    }
+
+    int samplerate;
+    double tail_seconds;
+    unsigned int voice_play_index = 0;
+    std::vector<Job> jobs;
+    std::vector<std::unique_ptr<tsf, void (*)(tsf*)>> copies;
+    std::vector<tsf*> idle;
+    std::unique_ptr<thread_pool::Pool> pool;
+    std::thread driver;
+    std::atomic<bool> stopping{false};
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Finished> finished;
+    size_t delivered = 0;
+};
+
+void set_threads(int threads) {
+    if (threads < 1) {
+        throw std::runtime_error("Number of threads must be at least 1");
+    }
+    thread_pool::set_threads(threads);
+}
+
+void set_simd(const std::string& name) {
+    if (!simd::set_level(name)) {
+        throw std::runtime_error(std::string("Unsupported SIMD level: ") + name);
+    }
+}
+
 PYBIND11_MODULE(_tinysoundfont, m) {
     m.doc() = "TinySoundFont module";
+    simd::select_best();
+    // Build the shared lookup tables now, loading and rendering without the GIL only read them.
+    // The interpolation tables are built by SoundFont::set_interpolation when first needed.
+#ifdef TSF_FASTMATH
+    tsf_fastmath_setup();
+#endif
+    tsf_lowpass_setup_table();
+    crc32_init();
     py::enum_<enum TSFOutputMode>(m, "OutputMode")
         .value("StereoInterleaved", TSF_STEREO_INTERLEAVED)
         .value("StereoUnweaved", TSF_STEREO_UNWEAVED)
         .value("Mono", TSF_MONO)
     ;
+    py::enum_<enum TSFInterpolation>(m, "Interpolation")
+        .value("Linear", TSF_INTERP_LINEAR, "2-point linear interpolation")
+        .value("Cubic", TSF_INTERP_CUBIC, "4-point cubic (Catmull-Rom) interpolation")
+        .value("Sinc8", TSF_INTERP_SINC8, "8-tap windowed-sinc interpolation")
+        .value("Sinc16", TSF_INTERP_SINC16, "16-tap windowed-sinc interpolation")
+    ;
+    py::enum_<enum TSFSampleFormat>(m, "SampleFormat")
+        .value("Float32", TSF_SAMPLES_FLOAT, "32-bit float samples")
+        .value("Int16", TSF_SAMPLES_SHORT, "16-bit integer samples, the same values as the float samples of uncompressed SoundFonts")
+        .value("Float16", TSF_SAMPLES_HALF, "16-bit half-precision float samples with 11 significant bits")
+    ;
+    py::enum_<enum TSFVoiceStealing>(m, "VoiceStealing")
+        .value("Release", TSF_STEAL_RELEASE, "Steal the voice furthest into its release phase, drop the new voice if none is releasing")
+        .value("Quietest", TSF_STEAL_QUIETEST, "Steal the quietest voice (releasing or not) and fade it out quickly")
+    ;
+    py::enum_<wav_writer::Format>(m, "WavFormat")
+        .value("Float32", wav_writer::Format::Float32, "32-bit float samples")
+        .value("Int16", wav_writer::Format::Int16, "16-bit integer samples")
+        .value("Int24", wav_writer::Format::Int24, "24-bit integer samples")
+    ;
     py::enum_<enum MidiMessageType>(m, "MidiMessageType")
         .value("NOTE_OFF", MidiMessageType::NOTE_OFF, "Turn off note")
         .value("NOTE_ON", MidiMessageType::NOTE_ON, "Turn on note")
@@ -309,6 +1475,39 @@ PYBIND11_MODULE(_tinysoundfont, m) {
         .value("SET_TEMPO", MidiMessageType::SET_TEMPO, "Change tempo of playback")
     ;
     m.def("_midi_load_memory", &midi_load_memory, "Load MIDI file data in Standard MIDI File format");
+    m.def("render_midi", &render_midi,
+        "Render a MIDI song in Standard MIDI File format with a copy of a SoundFont, without going through Python for each event. Channels start on preset 0 (channel 10 as MIDI drums) and program changes on channel 10 select drum kits. Returns a bytearray of 32-bit float samples in the output mode and gain of the SoundFont, covering the song plus tail_seconds. The SoundFont itself is not changed.",
+        "soundfont"_a, "midi"_a, "samplerate"_a = 44100, "tail_seconds"_a = 1.0);
+    m.def("render_midi_wav", &render_midi_wav,
+        "Render a MIDI song like render_midi and stream it into a WAV file (a filename, or a file descriptor that is left open), a piece at a time so memory use does not depend on the length of the song. Stereo is written interleaved. Integer formats are clipped and rounded. Returns the number of frames written.",
+        "soundfont"_a, "midi"_a, "file"_a, "samplerate"_a = 44100, "tail_seconds"_a = 1.0, "format"_a = wav_writer::Format::Float32);
+    m.def("simd_levels", &simd::supported_levels,
+        "Returns the names of the SIMD render kernels supported by this CPU, best last");
+    m.def("get_simd", []() { return simd::current_level(); },
+        "Returns the name of the SIMD render kernels currently in use");
+    m.def("set_simd", &set_simd,
+        "Select the SIMD render kernels to use for all SoundFonts (\"scalar\" disables SIMD), renders already running finish with the kernels they started with",
+        "level"_a);
+    m.def("get_fast_math", []() {
+#ifdef TSF_FASTMATH
+            return true;
+#else
+            return false;
+#endif
+        },
+        "Returns whether the module was built with table based approximations for pitch, frequency and gain conversions (CMake option TINYSOUNDFONT_FAST_MATH)");
+    m.def("get_realtime_checks", &realtime::checks_enabled,
+        "Returns whether the module was built to abort on allocations by TinySoundFont during a render in real-time mode (CMake option TINYSOUNDFONT_REALTIME_CHECKS)");
+    m.def("get_specialized_render", []() { return voice_render::enabled().load(); },
+        "Returns whether voices are rendered by functions specialized for their output mode, filter, loop and modulation");
+    m.def("set_specialized_render", [](bool enabled) { voice_render::enabled().store(enabled); },
+        "Enable or disable rendering voices with specialized functions (the generic renderer gives identical output, but is slower)",
+        "enabled"_a);
+    m.def("get_threads", &thread_pool::threads,
+        "Returns the number of threads used to render in parallel, including the calling thread");
+    m.def("set_threads", &set_threads,
+        "Set the number of threads used to render in parallel, including the calling thread (1 renders everything on the calling thread)",
+        "threads"_a);
     py::class_<SoundFont>(m, "SoundFont")
         // Need bytes constructor first, otherwise bytes would be converted and match string constructor
         .def(py::init<py::bytes>(),
@@ -320,6 +1519,9 @@ PYBIND11_MODULE(_tinysoundfont, m) {
         .def(py::init<const SoundFont &>(),
             "Clone existing SoundFont. This allows loading a soundfont only once, but using it for multiple independent playbacks.",
             "other"_a)
+        .def_static("from_mmap", &SoundFont::from_mmap,
+            "Load a SoundFont by mapping a .sf2 file into memory. The file is parsed in place and uncompressed samples are read from the mapping while rendering, so loading is fast and the samples only take memory as they are played (shared with other processes mapping the same file). Compressed samples (.sf3, .sfo) are decoded into memory as usual, or with lazy=True each one when a note first plays it (see set_sample_cache and decode_presets).",
+            "filename"_a, "lazy"_a = false)
         .def("reset", &SoundFont::reset,
             "Stop all playing notes immediately and reset all channel parameters")
         .def("get_preset_index", &SoundFont::get_preset_index,
@@ -342,6 +1544,52 @@ PYBIND11_MODULE(_tinysoundfont, m) {
         .def("set_max_voices", &SoundFont::set_max_voices,
             "Set the maximum number of voices to play simultaneously. Depending on the soundfond, one note can cause many new voices to be started, so don't keep this number too low or otherwise sounds may not play.",
             "max_voices"_a)
+        .def("set_realtime", &SoundFont::set_realtime,
+            "Enable or disable real-time mode. Enabling it allocates storage for this many voices (unless set_max_voices limits them) and channels up front, after which notes, channel events and renders never allocate: a note that finds no free voice is dropped and counted by dropped_voice_count, and channels beyond the reserve fail. When a render leaves few voices free, the next queue_event doubles them outside the render. The scratch buffers of renders are reserved for renders of up to this many frames, longer renders grow them before they start.",
+            "enabled"_a, "voices"_a = 256, "channels"_a = 16, "frames"_a = 4096)
+        .def("get_realtime", &SoundFont::get_realtime,
+            "Returns whether real-time mode is enabled")
+        .def("set_voice_stealing", &SoundFont::set_voice_stealing,
+            "Set how a voice is chosen for a new note when all voices allowed by set_max_voices are playing. With Quietest, up to 8 stolen voices may keep fading out on top of the maximum.",
+            "policy"_a)
+        .def("active_voice_count", &SoundFont::active_voice_count,
+            "Returns the number of voices currently playing (including voices in their release phase)")
+        .def("stolen_voice_count", &SoundFont::stolen_voice_count,
+            "Returns the number of voices stolen for new notes since loading")
+        .def("clipped_sample_count", &SoundFont::clipped_sample_count,
+            "Returns the number of int16 and int32 samples clipped by render since loading")
+        .def("sample_memory_bytes", &SoundFont::sample_memory_bytes,
+            "Returns the number of bytes of sample data held in memory, not counting samples read from a file mapping (see from_mmap). With lazy decoding only the samples currently decoded are counted.")
+        .def("set_sample_format", &SoundFont::set_sample_format,
+            "Convert the sample data held in memory to another format. 16-bit formats take half the memory of Float32 and are converted to float while rendering. Int16 gives the same output as Float32 for uncompressed SoundFonts, decoded compressed samples are rounded and clipped to the 16-bit range. Fails while the SoundFont has copies.",
+            "format"_a)
+        .def("set_sample_cache", &SoundFont::set_sample_cache,
+            "Set the maximum bytes of decoded samples kept by a SoundFont loaded with from_mmap(lazy=True). Above it the least recently used samples are freed, but never those of playing notes, nor those decoded by the same decode_presets call (default 256 MB). Copies have caches of their own.",
+            "max_bytes"_a)
+        .def("decode_presets", &SoundFont::decode_presets,
+            "Decode the samples of presets of a SoundFont loaded with from_mmap(lazy=True) now, so their notes do not decode while rendering. In real-time mode notes with samples that are not decoded are dropped.",
+            "preset_indices"_a)
+        .def("sample_cache_stats", &SoundFont::sample_cache_stats,
+            "Returns a dict of sample cache counters since loading: hits and misses of notes, evictions, decodes and bytes of decoded samples held")
+        .def("get_sample_format", &SoundFont::get_sample_format,
+            "Returns the format of the sample data (Int16 for uncompressed SoundFonts loaded with from_mmap)")
+        .def("dropped_voice_count", &SoundFont::dropped_voice_count,
+            "Returns the number of voices of new notes that were not played because no voice could be stolen")
+        .def("set_fixed_point_phase", &SoundFont::set_fixed_point_phase,
+            "Advance sample playback with a 32.32 fixed-point phase instead of a double precision position. This is faster, but pitch is rounded to 1/2^32 of a sample step so output is not bit-identical to the default.",
+            "enabled"_a)
+        .def("set_interpolation", &SoundFont::set_interpolation,
+            "Set how sample data is interpolated between sample points. Cubic and windowed-sinc interpolation reduce the aliasing of pitched notes at a higher CPU cost. Windowed-sinc lowers its cutoff for notes pitched up, in quarter octave steps, so they are band-limited to the output rate.",
+            "interpolation"_a)
+        .def("set_block_size", &SoundFont::set_block_size,
+            "Set the number of samples between updates of envelopes, LFOs, pitch, filter and gain of playing voices (default 64). With gain_ramp the gain is interpolated linearly over each block, so larger blocks can be used without zipper noise.",
+            "block_size"_a, "gain_ramp"_a = true)
+        .def("set_float_filters", &SoundFont::set_float_filters,
+            "Run the low-pass filters of voices in single precision with coefficients from a lookup table. With the specialized render, the filters of several voices are processed together with SIMD instructions. Output is not bit-identical to the default double precision filters.",
+            "enabled"_a)
+        .def("set_render_threads", &SoundFont::set_render_threads,
+            "Render the voices of this SoundFont on up to this many threads of the pool set by set_threads (default 1). Voices are split into chunks that only depend on this number and the number of playing voices, so output does not depend on scheduling, but it is not bit-identical to rendering on one thread.",
+            "threads"_a)
         .def("note_on", py::overload_cast<int, int, float>(&SoundFont::note_on),
             "Start playing a note",
             "index"_a, "key"_a, "velocity"_a)
@@ -357,9 +1605,24 @@ PYBIND11_MODULE(_tinysoundfont, m) {
             "Stop playing a note",
             "bank"_a, "number"_a, "key"_a)
         .def("render", &SoundFont::render,
-            "Render output samples into a buffer",
+            "Render output samples into a buffer: a bytearray of float32 samples, or a 2 dimensional float32, int16 or int32 buffer of size (samples, channels). Integer samples are clipped (int16 like tsf_render_short). With dither, TPDF dither noise is added to int16 samples before rounding.",
             "buffer"_a,
-            "mix"_a = false)
+            "mix"_a = false,
+            "dither"_a = false)
+        .def("render_events", &SoundFont::render_events,
+            "Render audio into a buffer like render, applying MIDI channel events at sample frame offsets inside the buffer. Events are a contiguous int32 buffer of shape (events, 5) or (events * 5,), each with (frame_offset, type, channel, data1, data2) in order of frame_offset (0 to the number of frames, an event at the end takes effect for the next render). Types are MidiMessageType values: NOTE_ON (key, velocity 0-127), NOTE_OFF (key), CONTROL_CHANGE (controller, value), PROGRAM_CHANGE (preset, data2 non-zero for MIDI drums) and PITCH_BEND (value 0-16383), other types are ignored. Selecting a preset that does not exist is not an error.",
+            "buffer"_a, "events"_a, "mix"_a = false)
+        .def("render_stems", &SoundFont::render_stems,
+            "Render each MIDI channel into its own stem in one pass, into a float32 buffer of size (stems, samples, 2) where stem i holds channel i in stereo interleaved, whatever the output mode. Voices of channels without a stem, or started without a channel, keep playing but are not output. Bus gain and pan set with set_stem_bus are applied. With set_render_threads above 1, stems render in parallel and the output stays the same.",
+            "buffer"_a, "mix"_a = false)
+        .def("queue_event", &SoundFont::queue_event,
+            "Queue a MIDI channel event with the values of render_events, to apply right before the sample frame frame counted from the first render (see get_frame_position). Does not wait for a render on another thread. Events are applied in queue order by any render call, events for past frames (like the default -1) as soon as possible. Returns False if the queue is full. The queue has one consumer, the render, and calls from several threads take turns as one producer. Other methods, like note_on, lock the SoundFont and wait for a render on another thread, and that render waits for them.",
+            "type"_a, "channel"_a, "data1"_a, "data2"_a = 0, "frame"_a = -1)
+        .def("get_frame_position", &SoundFont::get_frame_position,
+            "Returns the number of sample frames rendered since loading, the time base of queue_event")
+        .def("set_stem_bus", &SoundFont::set_stem_bus,
+            "Set the gain in dB and the balance from 0.0 (left) to 1.0 (right) of the stem of a channel for render_stems (default 0.0 dB and 0.5 center, which keep both sides unchanged)",
+            "channel"_a, "gain_db"_a = 0.0f, "pan"_a = 0.5f)
         .def("channel_set_preset_index", &SoundFont::channel_set_preset_index,
             "Set preset index for a channel",
             "channel"_a, "index"_a)
@@ -424,4 +1687,36 @@ PYBIND11_MODULE(_tinysoundfont, m) {
             "Get current tuning value set on the channel, in semitones, (0.0 is standard A440 tuning)",
             "channel"_a)
     ;
+    py::class_<Mixer>(m, "Mixer")
+        .def(py::init<>(),
+            "Create a mixer")
+        .def("render", &Mixer::render,
+            "Render several SoundFonts with the same output mode into a buffer, in parallel on the threads set by set_threads. The samples are the same as rendering the SoundFonts one after the other with mix=True after the first.",
+            "soundfonts"_a, "buffer"_a, "mix"_a)
+    ;
+    py::class_<MidiBatchResult>(m, "MidiBatchResult")
+        .def_readonly("index", &MidiBatchResult::index,
+            "Position of the song in the list given to MidiBatch")
+        .def_readonly("audio", &MidiBatchResult::audio,
+            "Rendered audio as a bytearray of 32-bit floats like render_midi, or None if the song failed")
+        .def_readonly("seconds", &MidiBatchResult::seconds,
+            "Time spent loading and rendering the song, in seconds")
+        .def_property_readonly("error", [](const MidiBatchResult& result) -> py::object {
+                if (result.error.empty()) {
+                    return py::none();
+                }
+                return py::str(result.error);
+            },
+            "Why the song failed, or None")
+    ;
+    py::class_<MidiBatch>(m, "MidiBatch")
+        .def(py::init<const SoundFont&, py::list, int, double, int>(),
+            "Start rendering a list of MIDI songs (bytes in Standard MIDI File format or filenames) like render_midi, on threads that each use their own copy of the SoundFont. Iterating returns a MidiBatchResult for each song in the order they finish. Threads of 0 uses the number set by set_threads. Deleting the batch cancels the songs not started yet.",
+            "soundfont"_a, "midis"_a, "samplerate"_a = 44100, "tail_seconds"_a = 1.0, "threads"_a = 0)
+        .def("__len__", &MidiBatch::size)
+        .def("__iter__", [](MidiBatch& batch) -> MidiBatch& { return batch; },
+            py::return_value_policy::reference_internal)
+        .def("__next__", &MidiBatch::next,
+            "Wait for the next finished song, without holding the GIL")
+    ;
 }
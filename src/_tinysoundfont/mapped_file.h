@@ -0,0 +1,106 @@
+//
+// Python bindings for TinySoundFont
+// https://github.com/nwhitehead/tinysoundfont-pybind
+//
+// Copyright (C) 2024 Nathan Whitehead
+//
+// This code is licensed under the MIT license (see LICENSE for details)
+//
+
+// Read-only memory mapping of a whole file, for tsf_load_memory_inplace.
+//
+// Pages are only read from the file when they are first touched, and as clean file backed
+// pages they can be dropped under memory pressure and are shared by every process that maps
+// the same file.
+
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace mapped_file {
+
+class File {
+public:
+    // Throws std::runtime_error if the file cannot be opened or mapped
+    explicit File(const std::string& filename) {
+        std::string error = "Could not map SoundFont file: " + filename;
+#ifdef _WIN32
+        HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error(error);
+        }
+        LARGE_INTEGER fileSize;
+        HANDLE mapping = nullptr;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        }
+        CloseHandle(file);
+        if (!mapping) {
+            throw std::runtime_error(error);
+        }
+        address = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (!address) {
+            throw std::runtime_error(error);
+        }
+        length = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error(error);
+        }
+        struct stat info;
+        void* result = MAP_FAILED;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            result = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (result == MAP_FAILED) {
+            throw std::runtime_error(error);
+        }
+        address = result;
+        length = static_cast<size_t>(info.st_size);
+#endif
+    }
+
+    ~File() {
+#ifdef _WIN32
+        UnmapViewOfFile(address);
+#else
+        munmap(address, length);
+#endif
+    }
+
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+
+    const void* data() const { return address; }
+
+    size_t size() const { return length; }
+
+    // Release callback for tsf_load_memory_inplace, deletes a File
+    static void release(void* file) { delete static_cast<File*>(file); }
+
+private:
+    void* address = nullptr;
+    size_t length = 0;
+};
+
+} // end namespace mapped_file
@@ -0,0 +1,136 @@
+//
+// Python bindings for TinySoundFont
+// https://github.com/nwhitehead/tinysoundfont-pybind
+//
+// Copyright (C) 2024 Nathan Whitehead
+//
+// This code is licensed under the MIT license (see LICENSE for details)
+//
+
+// Checks that renders in real-time mode do not allocate. Must be included before the
+// TinySoundFont implementation.
+//
+// A render of a SoundFont in real-time mode runs inside a Section, and so do notes and channel
+// events, and the tasks a render hands to the thread pool. When the module is built with
+// TSFPY_REALTIME_CHECKS (CMake option TINYSOUNDFONT_REALTIME_CHECKS), TinySoundFont allocates
+// through the functions below, and the scratch buffers of the bindings through Allocator, which
+// abort the process when they are called inside a Section of the same thread. Without it
+// Sections only count their depth.
+
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+namespace realtime {
+
+// Depth of the Sections of this thread
+inline int& depth() {
+    static thread_local int value = 0;
+    return value;
+}
+
+// Marks the current thread as rendering in real-time mode while it lives, if enabled
+class Section {
+public:
+    explicit Section(bool enabled) : enabled(enabled) {
+        if (enabled) {
+            depth()++;
+        }
+    }
+
+    ~Section() {
+        if (enabled) {
+            depth()--;
+        }
+    }
+
+    Section(const Section&) = delete;
+    Section& operator=(const Section&) = delete;
+
+private:
+    bool enabled;
+};
+
+// Whether the current thread is inside a Section, to carry it over to tasks on other threads
+inline bool inside() {
+    return depth() > 0;
+}
+
+inline bool checks_enabled() {
+#ifdef TSFPY_REALTIME_CHECKS
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Abort if the current thread is inside a Section
+inline void check(const char* what) {
+    if (depth() > 0) {
+        std::fprintf(stderr, "tinysoundfont: %s during a render in real-time mode\n", what);
+        std::abort();
+    }
+}
+
+inline void* checked_malloc(size_t size) {
+    check("malloc");
+    return std::malloc(size);
+}
+
+inline void* checked_realloc(void* ptr, size_t size) {
+    check("realloc");
+    return std::realloc(ptr, size);
+}
+
+inline void checked_free(void* ptr) {
+    if (ptr) {
+        check("free");
+    }
+    std::free(ptr);
+}
+
+// Allocator of scratch buffers kept between renders, checked like TinySoundFont in a build with
+// TSFPY_REALTIME_CHECKS. The buffers are reserved before a render enters its Section.
+template<class T>
+struct Allocator {
+    using value_type = T;
+
+    Allocator() = default;
+
+    template<class U>
+    Allocator(const Allocator<U>&) {}
+
+    T* allocate(size_t n) {
+#ifdef TSFPY_REALTIME_CHECKS
+        check("allocate");
+#endif
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* ptr, size_t n) {
+#ifdef TSFPY_REALTIME_CHECKS
+        check("deallocate");
+#endif
+        std::allocator<T>().deallocate(ptr, n);
+    }
+};
+
+template<class T, class U>
+bool operator==(const Allocator<T>&, const Allocator<U>&) { return true; }
+
+template<class T, class U>
+bool operator!=(const Allocator<T>&, const Allocator<U>&) { return false; }
+
+template<class T>
+using vector = std::vector<T, Allocator<T>>;
+
+} // end namespace realtime
+
+#ifdef TSFPY_REALTIME_CHECKS
+#define TSF_MALLOC realtime::checked_malloc
+#define TSF_REALLOC realtime::checked_realloc
+#define TSF_FREE realtime::checked_free
+#endif
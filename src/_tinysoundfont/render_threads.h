@@ -0,0 +1,123 @@
+//
+// Python bindings for TinySoundFont
+// https://github.com/nwhitehead/tinysoundfont-pybind
+//
+// Copyright (C) 2024 Nathan Whitehead
+//
+// This code is licensed under the MIT license (see LICENSE for details)
+//
+
+// Rendering the voices of one TinySoundFont instance on several threads.
+// Must be included after realtime.h, the TinySoundFont implementation, simd.h,
+// voice_render.h, filter_bank.h and thread_pool.h. TinySoundFont calls
+// tsfpy_render_voices (through TSF_RENDER_VOICES) to render all playing voices.
+//
+// With tsf_set_render_threads above 1, the active voice list is cut into
+// contiguous chunks. The first chunk renders into the output buffer, the
+// others into zeroed scratch buffers on the shared thread pool, and the
+// scratch buffers are then added in chunk order. The chunks only depend on
+// the number of render threads and of active voices, so the output does not
+// depend on which thread renders which chunk, or on the size of the pool. It
+// is not bit-identical to rendering on one thread, since voices are summed
+// in a different order.
+
+#pragma once
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <vector>
+
+namespace render_threads {
+
+// Fewer voices per chunk are not worth waking a thread and adding a scratch buffer
+constexpr int MIN_CHUNK_VOICES = 16;
+
+// Chunks per render thread, so threads that finish early take over the remaining chunks
+constexpr int CHUNKS_PER_THREAD = 4;
+
+// Scratch buffers of the rendering thread, kept between calls, or the buffers lent by a Lend
+// of this thread
+inline realtime::vector<float>*& lent() {
+    static thread_local realtime::vector<float>* buffer = nullptr;
+    return buffer;
+}
+
+inline realtime::vector<float>& scratch() {
+    static thread_local realtime::vector<float> buffer;
+    return lent() ? *lent() : buffer;
+}
+
+// Lends buffers of the caller as the scratch buffers of renders on this thread while it lives, so
+// the caller can reserve them up front
+class Lend {
+public:
+    explicit Lend(realtime::vector<float>& buffer) : previous(lent()) { lent() = &buffer; }
+    ~Lend() { lent() = previous; }
+
+    Lend(const Lend&) = delete;
+    Lend& operator=(const Lend&) = delete;
+
+private:
+    realtime::vector<float>* previous;
+};
+
+// Scratch floats a render of samples frames can need with the current render threads
+inline size_t scratch_size(const tsf* f, int samples) {
+    size_t count = static_cast<size_t>(samples) * (f->outputmode == TSF_MONO ? 1 : 2);
+    return (f->renderThreads > 1 ? count * (f->renderThreads * CHUNKS_PER_THREAD - 1) : 0);
+}
+
+inline void render(tsf* f, float* buffer, int samples, int chunks, bool specialized) {
+    const int* voices = f->activeVoices;
+    int voiceNum = f->activeVoiceNum;
+    size_t count = static_cast<size_t>(samples) * (f->outputmode == TSF_MONO ? 1 : 2);
+    realtime::vector<float>& scratchBuffer = scratch();
+    // Exceptions must not leave through the C frames of TinySoundFont, so if the scratch buffers
+    // cannot be allocated (std::bad_alloc) or the shared pool cannot start its threads
+    // (std::system_error), render all voices on this thread
+    std::shared_ptr<thread_pool::Pool> pool;
+    try {
+        if (scratchBuffer.size() < count * (chunks - 1)) {
+            scratchBuffer.resize(count * (chunks - 1));
+        }
+        pool = thread_pool::shared();
+    } catch (const std::exception&) {
+        filter_bank::render_voices(f, voices, voices + voiceNum, buffer, samples, specialized);
+        return;
+    }
+    float* scratchData = scratchBuffer.data();
+    bool inside = realtime::inside();
+    auto task = [&](int chunk) {
+        realtime::Section section(inside);
+        const int* begin = voices + static_cast<long long>(voiceNum) * chunk / chunks;
+        const int* end = voices + static_cast<long long>(voiceNum) * (chunk + 1) / chunks;
+        float* output = buffer;
+        if (chunk) {
+            output = scratchData + count * (chunk - 1);
+            std::fill(output, output + count, 0.0f);
+        }
+        filter_bank::render_voices(f, begin, end, output, samples, specialized);
+    };
+    // A lambda capturing one reference fits in std::function without allocating
+    pool->run(chunks, [&task](int chunk) { task(chunk); });
+    // Adding with a gain of 1 is exact, so the SIMD mix kernel sums in the same order as a plain loop
+    for (int chunk = 1; chunk < chunks; chunk++) {
+        f->renderKernels->mix_mono(buffer, scratchData + count * (chunk - 1), 1.0f, static_cast<int>(count));
+    }
+}
+
+} // end namespace render_threads
+
+static void tsfpy_render_voices(tsf* f, float* buffer, int samples) {
+    bool specialized = voice_render::enabled().load();
+    int chunks = 1;
+    if (f->renderThreads > 1) {
+        chunks = std::min(f->renderThreads * render_threads::CHUNKS_PER_THREAD, f->activeVoiceNum / render_threads::MIN_CHUNK_VOICES);
+    }
+    if (chunks > 1) {
+        render_threads::render(f, buffer, samples, chunks, specialized);
+    } else {
+        filter_bank::render_voices(f, f->activeVoices, f->activeVoices + f->activeVoiceNum, buffer, samples, specialized);
+    }
+}
@@ -0,0 +1,414 @@
+//
+// Python bindings for TinySoundFont
+// https://github.com/nwhitehead/tinysoundfont-pybind
+//
+// Copyright (C) 2024 Nathan Whitehead
+//
+// This code is licensed under the MIT license (see LICENSE for details)
+//
+
+// SIMD versions of the TinySoundFont render kernels with runtime CPU dispatch.
+// Must be included after the TinySoundFont implementation. TinySoundFont calls
+// tsfpy_render_kernels (through TSF_RENDER_KERNELS) when each render starts.
+//
+// Sample positions are still computed sequentially by tsf_voice_render, the
+// kernels here only vectorize interpolation and mixing. They use the same
+// operations in the same order as the scalar kernels so on x86 the output is
+// bit-identical to the scalar path.
+
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define TSFPY_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define TSFPY_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Functions using instruction sets beyond the compiler baseline need target attributes on GCC and Clang
+#if defined(__GNUC__) || defined(__clang__)
+#define TSFPY_TARGET(isa) __attribute__((target(isa)))
+#else
+#define TSFPY_TARGET(isa)
+#endif
+
+namespace simd {
+
+#ifdef TSFPY_SIMD_X86
+
+inline bool cpu_has_sse2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+inline bool cpu_has_avx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    // AVX registers must be enabled by the OS (OSXSAVE and XCR0 bits for XMM and YMM state)
+    if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28)) || (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+TSFPY_TARGET("sse2")
+static void interpolate_sse2(const float* input, const unsigned int* pos, const unsigned int* nextPos, const float* alpha, float* out, int count) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 a = _mm_setr_ps(input[pos[i]], input[pos[i + 1]], input[pos[i + 2]], input[pos[i + 3]]);
+        __m128 b = _mm_setr_ps(input[nextPos[i]], input[nextPos[i + 1]], input[nextPos[i + 2]], input[nextPos[i + 3]]);
+        __m128 t = _mm_loadu_ps(alpha + i);
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(a, _mm_sub_ps(one, t)), _mm_mul_ps(b, t)));
+    }
+    tsf_render_interpolate_scalar(input, pos + i, nextPos + i, alpha + i, out + i, count - i);
+}
+
+TSFPY_TARGET("sse2")
+static void interpolate_short_sse2(const short* input, const unsigned int* pos, const unsigned int* nextPos, const float* alpha, float* out, int count) {
+    const __m128 one = _mm_set1_ps(1.0f), scale = _mm_set1_ps(32767.0f);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 a = _mm_div_ps(_mm_setr_ps(input[pos[i]], input[pos[i + 1]], input[pos[i + 2]], input[pos[i + 3]]), scale);
+        __m128 b = _mm_div_ps(_mm_setr_ps(input[nextPos[i]], input[nextPos[i + 1]], input[nextPos[i + 2]], input[nextPos[i + 3]]), scale);
+        __m128 t = _mm_loadu_ps(alpha + i);
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(a, _mm_sub_ps(one, t)), _mm_mul_ps(b, t)));
+    }
+    tsf_render_interpolate_short_scalar(input, pos + i, nextPos + i, alpha + i, out + i, count - i);
+}
+
+// Half-precision values in the low 16 bits of each element to floats, like tsf_half2float
+TSFPY_TARGET("sse2")
+static inline __m128 half_to_float_sse2(__m128i h) {
+    __m128 magnitude = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x7FFF)), 13));
+    __m128 sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x8000)), 16));
+    return _mm_or_ps(_mm_mul_ps(magnitude, _mm_set1_ps(TSF_HALF_SCALE)), sign);
+}
+
+TSFPY_TARGET("sse2")
+static void interpolate_half_sse2(const unsigned short* input, const unsigned int* pos, const unsigned int* nextPos, const float* alpha, float* out, int count) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 a = half_to_float_sse2(_mm_setr_epi32(input[pos[i]], input[pos[i + 1]], input[pos[i + 2]], input[pos[i + 3]]));
+        __m128 b = half_to_float_sse2(_mm_setr_epi32(input[nextPos[i]], input[nextPos[i + 1]], input[nextPos[i + 2]], input[nextPos[i + 3]]));
+        __m128 t = _mm_loadu_ps(alpha + i);
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(a, _mm_sub_ps(one, t)), _mm_mul_ps(b, t)));
+    }
+    tsf_render_interpolate_half_scalar(input, pos + i, nextPos + i, alpha + i, out + i, count - i);
+}
+
+TSFPY_TARGET("sse2")
+static void mix_mono_sse2(float* out, const float* in, float gain, int count) {
+    const __m128 g = _mm_set1_ps(gain);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), g)));
+    }
+    tsf_render_mix_mono_scalar(out + i, in + i, gain, count - i);
+}
+
+TSFPY_TARGET("sse2")
+static void mix_interleaved_sse2(float* out, const float* in, float gainLeft, float gainRight, int count) {
+    const __m128 gl = _mm_set1_ps(gainLeft), gr = _mm_set1_ps(gainRight);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 v = _mm_loadu_ps(in + i);
+        __m128 l = _mm_mul_ps(v, gl), r = _mm_mul_ps(v, gr);
+        float* o = out + i * 2;
+        _mm_storeu_ps(o, _mm_add_ps(_mm_loadu_ps(o), _mm_unpacklo_ps(l, r)));
+        _mm_storeu_ps(o + 4, _mm_add_ps(_mm_loadu_ps(o + 4), _mm_unpackhi_ps(l, r)));
+    }
+    tsf_render_mix_interleaved_scalar(out + i * 2, in + i, gainLeft, gainRight, count - i);
+}
+
+TSFPY_TARGET("sse2")
+static void mix_unweaved_sse2(float* outL, float* outR, const float* in, float gainLeft, float gainRight, int count) {
+    const __m128 gl = _mm_set1_ps(gainLeft), gr = _mm_set1_ps(gainRight);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 v = _mm_loadu_ps(in + i);
+        _mm_storeu_ps(outL + i, _mm_add_ps(_mm_loadu_ps(outL + i), _mm_mul_ps(v, gl)));
+        _mm_storeu_ps(outR + i, _mm_add_ps(_mm_loadu_ps(outR + i), _mm_mul_ps(v, gr)));
+    }
+    tsf_render_mix_unweaved_scalar(outL + i, outR + i, in + i, gainLeft, gainRight, count - i);
+}
+
+TSFPY_TARGET("avx2")
+static void interpolate_avx2(const float* input, const unsigned int* pos, const unsigned int* nextPos, const float* alpha, float* out, int count) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 a = _mm256_i32gather_ps(input, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pos + i)), 4);
+        __m256 b = _mm256_i32gather_ps(input, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(nextPos + i)), 4);
+        __m256 t = _mm256_loadu_ps(alpha + i);
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(a, _mm256_sub_ps(one, t)), _mm256_mul_ps(b, t)));
+    }
+    tsf_render_interpolate_scalar(input, pos + i, nextPos + i, alpha + i, out + i, count - i);
+}
+
+// Gathers 32 bits ending at each 16-bit sample, the sample is the upper half (input[-1] is always readable)
+TSFPY_TARGET("avx2")
+static inline __m256i gather_16_avx2(const void* input, const unsigned int* pos) {
+    return _mm256_i32gather_epi32(reinterpret_cast<const int*>(static_cast<const short*>(input) - 1), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pos)), 2);
+}
+
+TSFPY_TARGET("avx2")
+static inline __m256 gather_short_avx2(const short* input, const unsigned int* pos) {
+    return _mm256_cvtepi32_ps(_mm256_srai_epi32(gather_16_avx2(input, pos), 16));
+}
+
+// Like tsf_half2float, with the half in the upper 16 bits the sign stays in place and the rest moves down by 3 bits
+TSFPY_TARGET("avx2")
+static inline __m256 gather_half_avx2(const unsigned short* input, const unsigned int* pos) {
+    __m256i v = gather_16_avx2(input, pos);
+    __m256 magnitude = _mm256_castsi256_ps(_mm256_srli_epi32(_mm256_and_si256(v, _mm256_set1_epi32(0x7FFF0000)), 3));
+    __m256 sign = _mm256_castsi256_ps(_mm256_and_si256(v, _mm256_set1_epi32(static_cast<int>(0x80000000u))));
+    return _mm256_or_ps(_mm256_mul_ps(magnitude, _mm256_set1_ps(TSF_HALF_SCALE)), sign);
+}
+
+TSFPY_TARGET("avx2")
+static void interpolate_half_avx2(const unsigned short* input, const unsigned int* pos, const unsigned int* nextPos, const float* alpha, float* out, int count) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 a = gather_half_avx2(input, pos + i);
+        __m256 b = gather_half_avx2(input, nextPos + i);
+        __m256 t = _mm256_loadu_ps(alpha + i);
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(a, _mm256_sub_ps(one, t)), _mm256_mul_ps(b, t)));
+    }
+    tsf_render_interpolate_half_scalar(input, pos + i, nextPos + i, alpha + i, out + i, count - i);
+}
+
+TSFPY_TARGET("avx2")
+static void interpolate_short_avx2(const short* input, const unsigned int* pos, const unsigned int* nextPos, const float* alpha, float* out, int count) {
+    const __m256 one = _mm256_set1_ps(1.0f), scale = _mm256_set1_ps(32767.0f);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 a = _mm256_div_ps(gather_short_avx2(input, pos + i), scale);
+        __m256 b = _mm256_div_ps(gather_short_avx2(input, nextPos + i), scale);
+        __m256 t = _mm256_loadu_ps(alpha + i);
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(a, _mm256_sub_ps(one, t)), _mm256_mul_ps(b, t)));
+    }
+    tsf_render_interpolate_short_scalar(input, pos + i, nextPos + i, alpha + i, out + i, count - i);
+}
+
+TSFPY_TARGET("avx2")
+static void mix_mono_avx2(float* out, const float* in, float gain, int count) {
+    const __m256 g = _mm256_set1_ps(gain);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_mul_ps(_mm256_loadu_ps(in + i), g)));
+    }
+    tsf_render_mix_mono_scalar(out + i, in + i, gain, count - i);
+}
+
+TSFPY_TARGET("avx2")
+static void mix_interleaved_avx2(float* out, const float* in, float gainLeft, float gainRight, int count) {
+    const __m256 gl = _mm256_set1_ps(gainLeft), gr = _mm256_set1_ps(gainRight);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 v = _mm256_loadu_ps(in + i);
+        __m256 l = _mm256_mul_ps(v, gl), r = _mm256_mul_ps(v, gr);
+        // Unpack works within 128-bit lanes, so lo = L0 R0 L1 R1 | L4 R4 L5 R5 and hi = L2 R2 L3 R3 | L6 R6 L7 R7
+        __m256 lo = _mm256_unpacklo_ps(l, r), hi = _mm256_unpackhi_ps(l, r);
+        float* o = out + i * 2;
+        _mm256_storeu_ps(o, _mm256_add_ps(_mm256_loadu_ps(o), _mm256_permute2f128_ps(lo, hi, 0x20)));
+        _mm256_storeu_ps(o + 8, _mm256_add_ps(_mm256_loadu_ps(o + 8), _mm256_permute2f128_ps(lo, hi, 0x31)));
+    }
+    tsf_render_mix_interleaved_scalar(out + i * 2, in + i, gainLeft, gainRight, count - i);
+}
+
+TSFPY_TARGET("avx2")
+static void mix_unweaved_avx2(float* outL, float* outR, const float* in, float gainLeft, float gainRight, int count) {
+    const __m256 gl = _mm256_set1_ps(gainLeft), gr = _mm256_set1_ps(gainRight);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 v = _mm256_loadu_ps(in + i);
+        _mm256_storeu_ps(outL + i, _mm256_add_ps(_mm256_loadu_ps(outL + i), _mm256_mul_ps(v, gl)));
+        _mm256_storeu_ps(outR + i, _mm256_add_ps(_mm256_loadu_ps(outR + i), _mm256_mul_ps(v, gr)));
+    }
+    tsf_render_mix_unweaved_scalar(outL + i, outR + i, in + i, gainLeft, gainRight, count - i);
+}
+
+#endif // TSFPY_SIMD_X86
+
+#ifdef TSFPY_SIMD_NEON
+
+static void interpolate_neon(const float* input, const unsigned int* pos, const unsigned int* nextPos, const float* alpha, float* out, int count) {
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const float av[4] = { input[pos[i]], input[pos[i + 1]], input[pos[i + 2]], input[pos[i + 3]] };
+        const float bv[4] = { input[nextPos[i]], input[nextPos[i + 1]], input[nextPos[i + 2]], input[nextPos[i + 3]] };
+        float32x4_t t = vld1q_f32(alpha + i);
+        vst1q_f32(out + i, vaddq_f32(vmulq_f32(vld1q_f32(av), vsubq_f32(one, t)), vmulq_f32(vld1q_f32(bv), t)));
+    }
+    tsf_render_interpolate_scalar(input, pos + i, nextPos + i, alpha + i, out + i, count - i);
+}
+
+static void interpolate_short_neon(const short* input, const unsigned int* pos, const unsigned int* nextPos, const float* alpha, float* out, int count) {
+    const float32x4_t one = vdupq_n_f32(1.0f), scale = vdupq_n_f32(32767.0f);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const float av[4] = { input[pos[i]], input[pos[i + 1]], input[pos[i + 2]], input[pos[i + 3]] };
+        const float bv[4] = { input[nextPos[i]], input[nextPos[i + 1]], input[nextPos[i + 2]], input[nextPos[i + 3]] };
+        float32x4_t t = vld1q_f32(alpha + i);
+        float32x4_t a = vdivq_f32(vld1q_f32(av), scale), b = vdivq_f32(vld1q_f32(bv), scale);
+        vst1q_f32(out + i, vaddq_f32(vmulq_f32(a, vsubq_f32(one, t)), vmulq_f32(b, t)));
+    }
+    tsf_render_interpolate_short_scalar(input, pos + i, nextPos + i, alpha + i, out + i, count - i);
+}
+
+static void interpolate_half_neon(const unsigned short* input, const unsigned int* pos, const unsigned int* nextPos, const float* alpha, float* out, int count) {
+    const float32x4_t one = vdupq_n_f32(1.0f), scale = vdupq_n_f32(TSF_HALF_SCALE);
+    const uint32x4_t magnitudeMask = vdupq_n_u32(0x7FFF), signMask = vdupq_n_u32(0x8000);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const uint32_t av[4] = { input[pos[i]], input[pos[i + 1]], input[pos[i + 2]], input[pos[i + 3]] };
+        const uint32_t bv[4] = { input[nextPos[i]], input[nextPos[i + 1]], input[nextPos[i + 2]], input[nextPos[i + 3]] };
+        uint32x4_t ha = vld1q_u32(av), hb = vld1q_u32(bv);
+        float32x4_t a = vmulq_f32(vreinterpretq_f32_u32(vshlq_n_u32(vandq_u32(ha, magnitudeMask), 13)), scale);
+        float32x4_t b = vmulq_f32(vreinterpretq_f32_u32(vshlq_n_u32(vandq_u32(hb, magnitudeMask), 13)), scale);
+        a = vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(a), vshlq_n_u32(vandq_u32(ha, signMask), 16)));
+        b = vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(b), vshlq_n_u32(vandq_u32(hb, signMask), 16)));
+        float32x4_t t = vld1q_f32(alpha + i);
+        vst1q_f32(out + i, vaddq_f32(vmulq_f32(a, vsubq_f32(one, t)), vmulq_f32(b, t)));
+    }
+    tsf_render_interpolate_half_scalar(input, pos + i, nextPos + i, alpha + i, out + i, count - i);
+}
+
+static void mix_mono_neon(float* out, const float* in, float gain, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        vst1q_f32(out + i, vaddq_f32(vld1q_f32(out + i), vmulq_n_f32(vld1q_f32(in + i), gain)));
+    }
+    tsf_render_mix_mono_scalar(out + i, in + i, gain, count - i);
+}
+
+static void mix_interleaved_neon(float* out, const float* in, float gainLeft, float gainRight, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t v = vld1q_f32(in + i);
+        float32x4x2_t o = vld2q_f32(out + i * 2);
+        o.val[0] = vaddq_f32(o.val[0], vmulq_n_f32(v, gainLeft));
+        o.val[1] = vaddq_f32(o.val[1], vmulq_n_f32(v, gainRight));
+        vst2q_f32(out + i * 2, o);
+    }
+    tsf_render_mix_interleaved_scalar(out + i * 2, in + i, gainLeft, gainRight, count - i);
+}
+
+static void mix_unweaved_neon(float* outL, float* outR, const float* in, float gainLeft, float gainRight, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t v = vld1q_f32(in + i);
+        vst1q_f32(outL + i, vaddq_f32(vld1q_f32(outL + i), vmulq_n_f32(v, gainLeft)));
+        vst1q_f32(outR + i, vaddq_f32(vld1q_f32(outR + i), vmulq_n_f32(v, gainRight)));
+    }
+    tsf_render_mix_unweaved_scalar(outL + i, outR + i, in + i, gainLeft, gainRight, count - i);
+}
+
+#endif // TSFPY_SIMD_NEON
+
+struct Level {
+    const char* name;
+    bool (*supported)();
+    tsf_render_kernels kernels;
+};
+
+inline bool always_supported() { return true; }
+
+// All kernel sets in order of preference (best last)
+inline const std::vector<Level>& all_levels() {
+    static const std::vector<Level> levels = {
+        { "scalar", &always_supported, *tsf_get_default_render_kernels() },
+#ifdef TSFPY_SIMD_X86
+        { "sse2", &cpu_has_sse2, { &interpolate_sse2, &mix_mono_sse2, &mix_interleaved_sse2, &mix_unweaved_sse2, &interpolate_short_sse2, &interpolate_half_sse2 } },
+        { "avx2", &cpu_has_avx2, { &interpolate_avx2, &mix_mono_avx2, &mix_interleaved_avx2, &mix_unweaved_avx2, &interpolate_short_avx2, &interpolate_half_avx2 } },
+#endif
+#ifdef TSFPY_SIMD_NEON
+        { "neon", &always_supported, { &interpolate_neon, &mix_mono_neon, &mix_interleaved_neon, &mix_unweaved_neon, &interpolate_short_neon, &interpolate_half_neon } },
+#endif
+    };
+    return levels;
+}
+
+// Index in all_levels of the kernel set used by renders. The kernel sets never change, so
+// set_level can switch between them while other threads render, and each render loads the
+// index once through tsfpy_render_kernels.
+inline std::atomic<int>& level_index() {
+    static std::atomic<int> index(0);
+    return index;
+}
+
+inline const Level& current() {
+    return all_levels()[level_index().load()];
+}
+
+inline std::string current_level() {
+    return current().name;
+}
+
+// Names of all kernel sets supported by the running CPU
+inline std::vector<std::string> supported_levels() {
+    std::vector<std::string> result;
+    for (const Level& level : all_levels()) {
+        if (level.supported()) {
+            result.push_back(level.name);
+        }
+    }
+    return result;
+}
+
+// Switch all rendering to the named kernel set, returns false if it is unknown or unsupported
+inline bool set_level(const std::string& name) {
+    const std::vector<Level>& levels = all_levels();
+    for (size_t i = 0; i < levels.size(); i++) {
+        if (name == levels[i].name && levels[i].supported()) {
+            level_index().store(static_cast<int>(i));
+            return true;
+        }
+    }
+    return false;
+}
+
+// Select the default kernel set for the running CPU
+// AVX2 is opt-in: the gathers and 256-bit mixing measured slower than SSE2 for
+// typical voice block sizes, so the default stops at SSE2 on x86
+inline void select_best() {
+    for (const char* name : {"neon", "sse2"}) {
+        if (set_level(name)) {
+            return;
+        }
+    }
+    set_level("scalar");
+}
+
+} // end namespace simd
+
+static const struct tsf_render_kernels* tsfpy_render_kernels(void) {
+    return &simd::current().kernels;
+}
@@ -3704,7 +3704,11 @@ static int start_decoder(vorb *f)
    }
    #endif
 
-   crc32_init(); // always init it, to avoid multithread race conditions
+   // LOCAL PATCH (tinysoundfont-pybind), upstream has:
+   //    crc32_init(); // always init it, to avoid multithread race conditions
+   // Rewriting the table while other threads decode is itself a race. The module builds the
+   // table once when it is imported, so streams opened on several threads only read it.
+   if (!crc_table[1]) crc32_init();
 
    if (get8_packet(f) != VORBIS_packet_setup)       return error(f, VORBIS_invalid_setup);
    for (i=0; i < 6; ++i) header[i] = get8_packet(f);
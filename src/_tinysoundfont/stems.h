@@ -0,0 +1,149 @@
+//
+// Python bindings for TinySoundFont
+// https://github.com/nwhitehead/tinysoundfont-pybind
+//
+// Copyright (C) 2024 Nathan Whitehead
+//
+// This code is licensed under the MIT license (see LICENSE for details)
+//
+
+// Rendering each MIDI channel into its own stereo stem in one pass over the voices.
+// Must be included after the TinySoundFont implementation, filter_bank.h,
+// thread_pool.h and render_threads.h.
+//
+// The active voices are sorted by channel with a counting sort, so the voices of each
+// stem keep their order in the active voice list, and each stem is rendered like a
+// normal stereo interleaved render of only its voices. The gain and pan of a stem bus
+// are folded into the pan factors of its voices for the duration of the render, so
+// they cost nothing per sample. Stems are independent, so with tsf_set_render_threads
+// above 1 they are rendered in parallel and the output is still bit-identical.
+
+#pragma once
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <vector>
+
+namespace stems {
+
+// Gains of the left and right side of a stem bus
+struct Bus {
+    float left = 1.0f;
+    float right = 1.0f;
+};
+
+// Bus with a gain in dB and a balance from 0.0 (left) to 1.0 (right), at 0.5 both sides keep the gain
+inline Bus make_bus(float gain_db, float pan) {
+    // 0 dB stays exactly 1, also with the approximations of TSF_FASTMATH
+    float gain = (gain_db == 0.0f ? 1.0f : tsf_decibelsToGain(gain_db));
+    pan = std::min(1.0f, std::max(0.0f, pan));
+    Bus bus;
+    bus.left = gain * std::min(1.0f, 2.0f * (1.0f - pan));
+    bus.right = gain * std::min(1.0f, 2.0f * pan);
+    return bus;
+}
+
+// Buffers of a render, kept between calls
+struct Scratch {
+    realtime::vector<int> order, starts, next;
+    realtime::vector<Bus> pans;
+    realtime::vector<float> discard;
+};
+
+// Reserve the buffers for renders of up to samples frames into stemCount stems with voiceNum voices
+inline void reserve(Scratch& scratch, int voiceNum, int stemCount, int samples) {
+    scratch.order.reserve(voiceNum);
+    scratch.pans.reserve(voiceNum);
+    scratch.starts.reserve(stemCount + 2);
+    scratch.next.reserve(stemCount + 1);
+    scratch.discard.reserve(static_cast<size_t>(samples) * 2);
+}
+
+// Render samples frames into stemCount stereo interleaved stems of buffer, which follow each
+// other every stemFrames frames. Voices of a channel without a stem, or started without a
+// channel, keep playing but are not written anywhere.
+inline void render(tsf* f, float* buffer, int stemCount, int stemFrames, int samples, bool mix, const std::vector<Bus>& buses, Scratch& scratch) {
+    size_t count = static_cast<size_t>(samples) * 2, stride = static_cast<size_t>(stemFrames) * 2;
+    if (!mix) {
+        for (int s = 0; s < stemCount; s++) {
+            std::fill(buffer + stride * s, buffer + stride * s + count, 0.0f);
+        }
+    }
+    f->renderKernels = TSF_RENDER_KERNELS();
+    bool specialized = voice_render::enabled().load();
+    const int* voices = f->activeVoices;
+    int voiceNum = f->activeVoiceNum;
+    auto stem_of = [&](const struct tsf_voice* v) {
+        return (v->playingChannel >= 0 && v->playingChannel < stemCount ? v->playingChannel : stemCount);
+    };
+    // Range of the voices of stem s is order[starts[s]] to order[starts[s + 1]], the last range has the voices without a stem
+    scratch.starts.assign(stemCount + 2, 0);
+    for (int i = 0; i < voiceNum; i++) {
+        scratch.starts[stem_of(&f->voices[voices[i]]) + 1]++;
+    }
+    for (int s = 0; s <= stemCount; s++) {
+        scratch.starts[s + 1] += scratch.starts[s];
+    }
+    scratch.next.assign(scratch.starts.begin(), scratch.starts.end() - 1);
+    scratch.order.resize(voiceNum);
+    scratch.pans.resize(voiceNum);
+    float* discard = nullptr;
+    if (scratch.starts[stemCount + 1] != scratch.starts[stemCount]) {
+        scratch.discard.assign(count, 0.0f);
+        discard = scratch.discard.data();
+    }
+    // Nothing may throw while the pan factors of the voices are changed, so the shared pool is
+    // taken first, and if it cannot start its threads (std::system_error) the stems are rendered
+    // on this thread
+    std::shared_ptr<thread_pool::Pool> pool;
+    if (f->renderThreads > 1 && voiceNum >= render_threads::MIN_CHUNK_VOICES) {
+        try {
+            pool = thread_pool::shared();
+        } catch (const std::exception&) {
+        }
+    }
+    for (int i = 0; i < voiceNum; i++) {
+        struct tsf_voice* v = &f->voices[voices[i]];
+        int s = stem_of(v);
+        scratch.order[scratch.next[s]++] = voices[i];
+        scratch.pans[i].left = v->panFactorLeft;
+        scratch.pans[i].right = v->panFactorRight;
+        if (s < static_cast<int>(buses.size())) {
+            v->panFactorLeft *= buses[s].left;
+            v->panFactorRight *= buses[s].right;
+        }
+    }
+    // Stems are always stereo, whatever the output mode
+    enum TSFOutputMode outputmode = f->outputmode;
+    f->outputmode = TSF_STEREO_INTERLEAVED;
+    const int* order = scratch.order.data();
+    const int* starts = scratch.starts.data();
+    auto render_stem = [&](int s) {
+        if (starts[s] == starts[s + 1]) return;
+        float* output = (s < stemCount ? buffer + stride * s : discard);
+        filter_bank::render_voices(f, order + starts[s], order + starts[s + 1], output, samples, specialized);
+    };
+    if (pool) {
+        bool inside = realtime::inside();
+        // A lambda capturing one reference fits in std::function without allocating
+        pool->run(stemCount + 1, [&render_stem, inside](int s) {
+            realtime::Section section(inside);
+            render_stem(s);
+        });
+    } else {
+        for (int s = 0; s <= stemCount; s++) {
+            render_stem(s);
+        }
+    }
+    f->outputmode = outputmode;
+    for (int i = 0; i < voiceNum; i++) {
+        struct tsf_voice* v = &f->voices[voices[i]];
+        v->panFactorLeft = scratch.pans[i].left;
+        v->panFactorRight = scratch.pans[i].right;
+    }
+    tsf_active_voices_compact(f);
+    f->stealHeapValid = TSF_FALSE;
+}
+
+} // end namespace stems
@@ -0,0 +1,166 @@
+//
+// Python bindings for TinySoundFont
+// https://github.com/nwhitehead/tinysoundfont-pybind
+//
+// Copyright (C) 2024 Nathan Whitehead
+//
+// This code is licensed under the MIT license (see LICENSE for details)
+//
+
+// Persistent worker threads for rendering work that can be split into independent
+// tasks. The workers wait on a condition variable between runs, so a run costs a
+// wakeup instead of creating threads. Tasks never call into Python.
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace thread_pool {
+
+// Whether the current thread is a worker or is calling tasks of a run
+inline bool& inside_task() {
+    static thread_local bool value = false;
+    return value;
+}
+
+class Pool {
+public:
+    // Throws std::system_error if a thread cannot be started, after stopping the ones that were
+    explicit Pool(int workers) {
+        try {
+            threads.reserve(workers);
+            for (int i = 0; i < workers; i++) {
+                threads.emplace_back([this]() { work(); });
+            }
+        } catch (...) {
+            stop();
+            throw;
+        }
+    }
+
+    ~Pool() {
+        stop();
+    }
+
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+
+    int workers() const { return static_cast<int>(threads.size()); }
+
+    // Call task(i) for every i from 0 to count - 1, on the workers and the calling thread,
+    // and return when all calls have returned. Runs from several threads take turns, and a
+    // run started from inside a task calls its tasks in order on the worker itself.
+    void run(int count, const std::function<void(int)>& task) {
+        if (count <= 1 || threads.empty() || inside_task()) {
+            for (int i = 0; i < count; i++) {
+                task(i);
+            }
+            return;
+        }
+        std::lock_guard<std::mutex> turn(runMutex);
+        std::unique_lock<std::mutex> guard(mutex);
+        current = &task;
+        total = count;
+        next = 0;
+        finished = 0;
+        generation++;
+        wake.notify_all();
+        inside_task() = true;
+        execute(guard);
+        inside_task() = false;
+        done.wait(guard, [this]() { return finished == total; });
+        current = nullptr;
+    }
+
+private:
+    void stop() {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // Call tasks of the current run until none are left, the mutex is held between tasks
+    void execute(std::unique_lock<std::mutex>& guard) {
+        while (current && next < total) {
+            const std::function<void(int)>& task = *current;
+            int index = next++;
+            guard.unlock();
+            task(index);
+            guard.lock();
+            if (++finished == total) {
+                done.notify_one();
+            }
+        }
+    }
+
+    void work() {
+        inside_task() = true;
+        std::unique_lock<std::mutex> guard(mutex);
+        unsigned seen = generation;
+        for (;;) {
+            wake.wait(guard, [&]() { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            execute(guard);
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex runMutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int)>* current = nullptr;
+    int total = 0;
+    int next = 0;
+    int finished = 0;
+    unsigned generation = 0;
+    bool stopping = false;
+};
+
+// Lock protecting the shared pool
+inline std::mutex& shared_mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+// Pool shared by all rendering, by default with one thread per CPU (counting the calling thread).
+// It is never destroyed, so idle workers are not joined while the process exits.
+inline std::shared_ptr<Pool>& shared_pool() {
+    static std::shared_ptr<Pool>* pool = new std::shared_ptr<Pool>(
+        std::make_shared<Pool>(std::max(1u, std::thread::hardware_concurrency()) - 1));
+    return *pool;
+}
+
+// Returns the shared pool, a run in progress keeps using its pool if it is replaced
+inline std::shared_ptr<Pool> shared() {
+    std::lock_guard<std::mutex> guard(shared_mutex());
+    return shared_pool();
+}
+
+// Number of threads rendering in parallel, including the calling thread
+inline int threads() {
+    return shared()->workers() + 1;
+}
+
+// Replace the shared pool with one that renders on this many threads (including the calling thread)
+inline void set_threads(int threads) {
+    std::shared_ptr<Pool> pool = std::make_shared<Pool>(threads - 1);
+    std::lock_guard<std::mutex> guard(shared_mutex());
+    shared_pool().swap(pool);
+}
+
+} // namespace thread_pool
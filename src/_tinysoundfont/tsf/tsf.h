@@ -11,8 +11,9 @@
 
    [OPTIONAL] #define TSF_NO_STDIO to remove stdio dependency
    [OPTIONAL] #define TSF_MALLOC, TSF_REALLOC, and TSF_FREE to avoid stdlib.h
-   [OPTIONAL] #define TSF_MEMCPY, TSF_MEMSET to avoid string.h
-   [OPTIONAL] #define TSF_POW, TSF_POWF, TSF_EXPF, TSF_LOG, TSF_TAN, TSF_LOG10, TSF_SQRT to avoid math.h
+   [OPTIONAL] #define TSF_MEMCPY, TSF_MEMSET, TSF_MEMMOVE to avoid string.h
+   [OPTIONAL] #define TSF_POW, TSF_POWF, TSF_EXPF, TSF_LOG, TSF_TAN, TSF_LOG10, TSF_SQRT, TSF_SIN, TSF_COS to avoid math.h
+   [OPTIONAL] #define TSF_FASTMATH to use table based approximations for pitch, frequency and gain conversions
 
    NOT YET IMPLEMENTED
      - Support for ChorusEffectsSend and ReverbEffectsSend generators
@@ -73,6 +74,19 @@ TSFDEF tsf* tsf_load_filename(const char* filename);
 // Load a SoundFont from a block of memory
 TSFDEF tsf* tsf_load_memory(const void* buffer, int size);
 
+// Load a SoundFont from a block of memory (i.e. a memory mapped file) without copying it.
+// Uncompressed 16-bit samples are read straight from the buffer while rendering, compressed
+// samples are decoded into memory as with tsf_load_memory.
+//   release: if not NULL, called with release_data when the result and all its copies are
+//   closed, the buffer must stay valid until then (not called if loading fails)
+TSFDEF tsf* tsf_load_memory_inplace(const void* buffer, int size, void (*release)(void* data), void* release_data);
+
+// Load a SoundFont like tsf_load_memory_inplace, but leave Ogg Vorbis compressed samples (.sf3 and
+// .sfo) in the buffer. Each sample is decoded into a cache of the tsf instance when a note first
+// plays it, or by tsf_decode_presets (copies have caches of their own, see tsf_set_sample_cache).
+// SoundFonts without compressed samples load like with tsf_load_memory_inplace.
+TSFDEF tsf* tsf_load_memory_inplace_lazy(const void* buffer, int size, void (*release)(void* data), void* release_data);
+
 // Stream structure for the generic loading
 struct tsf_stream
 {
@@ -101,6 +115,12 @@ TSFDEF void tsf_close(tsf* f);
 // Stop all playing notes immediately and reset all channel parameters
 TSFDEF void tsf_reset(tsf* f);
 
+// Return an instance made by tsf_copy to the state it had right after the copy, where voicePlayIndex
+// is the voice play index it had then. The next playback renders exactly as with a new copy.
+// Voices and channel storage are kept, and the reference count shared with the original is not
+// changed, so unlike tsf_copy and tsf_close this needs no locking across the linked instances.
+TSFDEF void tsf_restart(tsf* f, unsigned int voicePlayIndex);
+
 // Returns the preset index from a bank and preset number, or -1 if it does not exist in the loaded SoundFont
 TSFDEF int tsf_get_presetindex(const tsf* f, int bank, int preset_number);
 
@@ -124,6 +144,36 @@ enum TSFOutputMode
 	TSF_MONO
 };
 
+enum TSFInterpolation
+{
+	// 2-point linear interpolation (default)
+	TSF_INTERP_LINEAR,
+	// 4-point cubic (Catmull-Rom) interpolation
+	TSF_INTERP_CUBIC,
+	// 8-tap windowed-sinc interpolation, band-limited to the output rate for notes pitched up
+	TSF_INTERP_SINC8,
+	// 16-tap windowed-sinc interpolation, band-limited to the output rate for notes pitched up
+	TSF_INTERP_SINC16
+};
+
+enum TSFSampleFormat
+{
+	// 32-bit float (default)
+	TSF_SAMPLES_FLOAT,
+	// 16-bit integer, converted back to exactly the same values for 16-bit SoundFont samples
+	TSF_SAMPLES_SHORT,
+	// 16-bit half-precision float, 11 significant bits
+	TSF_SAMPLES_HALF
+};
+
+enum TSFVoiceStealing
+{
+	// Cut off the voice furthest into its release, or drop the new voice if none is releasing (default)
+	TSF_STEAL_RELEASE,
+	// Fade out the voice with the lowest estimated amplitude, sustaining or releasing
+	TSF_STEAL_QUIETEST
+};
+
 // Thread safety:
 //
 // 1. Rendering / voices:
@@ -132,13 +182,9 @@ enum TSFOutputMode
 // run on a different thread than where the playback tsf_note* functions
 // are called. In which case some sort of concurrency control like a
 // mutex needs to be used so they are not called at the same time.
-// Alternatively, you can pre-allocate a maximum number of voices that can
-// play simultaneously by calling tsf_set_max_voices after loading.
-// That way memory re-allocation will not happen during tsf_note_on and
-// TSF should become mostly thread safe.
-// There is a theoretical chance that ending notes would negatively influence
-// a voice that is rendering at the time but it is hard to say.
-// Also be aware, this has not been tested much.
+// This is required even with a maximum number of voices pre-allocated by
+// calling tsf_set_max_voices after loading, because tsf_note_on and the
+// tsf_render* functions both update the list of active voices.
 //
 // 2. Channels:
 //
@@ -146,6 +192,14 @@ enum TSFOutputMode
 // if no channel with that number was previously used. Make sure to
 // create all channels at the beginning as required if you call tsf_render*
 // from a different thread.
+//
+// 3. Allocation:
+//
+// tsf_note_on allocates more voices when all are playing (unless a maximum
+// is set with tsf_set_max_voices) and the channel functions allocate new
+// channels. Storage grows geometrically and tsf_reset keeps the channels for
+// reuse. To call these from a real-time thread, preallocate with tsf_reserve
+// and enable tsf_set_realtime so they never allocate.
 
 // Setup the parameters for the voice render methods
 //   outputmode: if mono or stereo and how stereo channel data is ordered
@@ -164,6 +218,104 @@ TSFDEF void tsf_set_volume(tsf* f, float global_gain);
 //   (tsf_set_max_voices returns 0 if allocation failed, otherwise 1)
 TSFDEF int tsf_set_max_voices(tsf* f, int max_voices);
 
+// Set how a voice is chosen for a new note when all voices allowed by tsf_set_max_voices are playing
+//   policy: TSF_STEAL_RELEASE (default) or TSF_STEAL_QUIETEST. With TSF_STEAL_QUIETEST the
+//   candidates are kept in a heap by estimated amplitude that is rebuilt at most once per render
+//   call, and stolen voices fade out quickly in TSF_STEAL_FADEVOICES voices reserved for that.
+TSFDEF void tsf_set_voice_stealing(tsf* f, enum TSFVoiceStealing policy);
+
+// Set how the playback position in the sample data is advanced
+//   flag_fixedpoint: if 0 use a double precision position (default), otherwise
+//   use a 32.32 fixed-point phase with an integer increment per effect block.
+//   The fixed-point phase is faster and exact for samples of up to 2^32 frames,
+//   but the pitch is rounded to 1/2^32 of a sample step so output is not
+//   bit-identical to the default mode. Playing voices are converted in place.
+TSFDEF void tsf_set_fixedpoint_phase(tsf* f, int flag_fixedpoint);
+
+// Set how sample data is interpolated between sample points
+//   interpolation: linear (default), cubic or windowed-sinc using precomputed tables
+//   The windowed-sinc cutoff is lowered for voices pitched up, in quarter octave steps.
+//   The tables are shared by all tsf instances and built by the first call that
+//   selects a non-linear mode, so do that before rendering on multiple threads.
+TSFDEF void tsf_set_interpolation(tsf* f, enum TSFInterpolation interpolation);
+
+// Set how often envelopes, LFOs, pitch, filter and gain of playing voices are updated
+//   block_size: number of samples per update (default TSF_RENDER_EFFECTSAMPLEBLOCK)
+//   flag_gain_ramp: if 0 the gain steps at each update (default), otherwise it is
+//   interpolated linearly over the block so large blocks do not cause zipper noise
+TSFDEF void tsf_set_effect_block(tsf* f, int block_size, int flag_gain_ramp);
+
+// Set the precision of the per voice low-pass filters
+//   flag_float: if 0 filter in double precision (default), otherwise in single precision
+//   with the coefficients of modulated filters taken from a lookup table instead of tan().
+//   This allows filtering multiple voices at once (see TSF_RENDER_VOICES), but output is
+//   not bit-identical to the default. The table is shared by all tsf instances and built
+//   by the first call that enables it, so do that before rendering on multiple threads.
+TSFDEF void tsf_set_float_filters(tsf* f, int flag_float);
+
+// Set how many threads may render the voices of this instance at once
+//   threads: 1 to render on the calling thread (default). TinySoundFont itself has no threads,
+//   this is only a setting for a replacement of TSF_RENDER_VOICES that splits the voices.
+TSFDEF void tsf_set_render_threads(tsf* f, int threads);
+
+// Preallocate storage, so notes and channel functions do not need to allocate memory
+//   voices: number of voices to allocate if no maximum is set with tsf_set_max_voices
+//   (with a maximum, the voices and the voice stealing candidates are allocated for it)
+//   channels: number of channels to allocate storage for (channels are still created on use)
+//   (tsf_reserve returns 0 if allocation failed, otherwise 1)
+TSFDEF int tsf_reserve(tsf* f, int voices, int channels);
+
+// Voice storage allocated apart from a tsf instance. To add voices to an instance that another
+// thread may be rendering, allocate the storage without holding its lock, then only take the lock
+// for tsf_swap_voices, which never allocates.
+struct tsf_voice_storage { struct tsf_voice* voices; int* activeVoices; int voiceNum; };
+
+// Allocate storage for this many voices (returns 0 if allocation failed, otherwise 1)
+TSFDEF int tsf_voice_storage_alloc(struct tsf_voice_storage* storage, int voices);
+
+// Free storage allocated by tsf_voice_storage_alloc or returned by tsf_swap_voices
+TSFDEF void tsf_voice_storage_free(struct tsf_voice_storage* storage);
+
+// If storage holds more voices than f and no maximum is set with tsf_set_max_voices, move the
+// voices of f into it and return the previous storage of f in storage (returns 1 if swapped)
+TSFDEF int tsf_swap_voices(tsf* f, struct tsf_voice_storage* storage);
+
+// Set whether tsf_note_on and the channel functions may allocate memory
+//   flag_realtime: if 0 they allocate as needed (default), otherwise they never allocate.
+//   Then notes that need more voices than allocated are dropped (counted by
+//   tsf_dropped_voice_count), and functions for channels beyond the storage allocated by
+//   tsf_reserve return 0. Notes of lazily loaded SoundFonts that need a sample which is not
+//   decoded yet are dropped as well (see tsf_decode_presets).
+TSFDEF void tsf_set_realtime(tsf* f, int flag_realtime);
+
+// Convert the sample data of a tsf instance to another storage format
+// 16-bit formats take half the memory of floats and are converted while rendering.
+//   format: TSF_SAMPLES_FLOAT (default), TSF_SAMPLES_SHORT or TSF_SAMPLES_HALF
+//   (returns 0 if out of memory or if the sample data is shared with copies or decoded lazily, otherwise 1)
+TSFDEF int tsf_set_sample_format(tsf* f, enum TSFSampleFormat format);
+
+// Returns the storage format of the sample data
+TSFDEF enum TSFSampleFormat tsf_get_sample_format(tsf* f);
+
+// Set the maximum size of the decoded samples kept by a tsf instance of tsf_load_memory_inplace_lazy
+//   max_bytes: when a decode goes above it the least recently used samples are freed, but never
+//   those of playing voices, nor those decoded by the same tsf_decode_presets call
+//   (default TSF_SAMPLE_CACHE_DEFAULT)
+TSFDEF void tsf_set_sample_cache(tsf* f, unsigned long long max_bytes);
+
+// Decode the samples of presets into the cache now, so notes using them do not decode while playing
+//   (returns 0 if a sample could not be decoded, otherwise 1)
+TSFDEF int tsf_decode_presets(tsf* f, const int* preset_indices, int count);
+
+// Statistics of the sample cache of a lazily loaded tsf instance (since loading or copying)
+//   hits: notes of regions that found their sample decoded
+//   misses: notes of regions that had to decode their sample (or were dropped in real-time mode)
+//   evictions: samples freed to stay below the maximum size
+//   decodes: samples decoded, including those of tsf_decode_presets
+//   bytes: size of the decoded samples currently kept
+struct tsf_sample_cache_stats { unsigned int hits, misses, evictions, decodes; unsigned long long bytes; };
+TSFDEF void tsf_get_sample_cache_stats(const tsf* f, struct tsf_sample_cache_stats* stats);
+
 // Start playing a note
 //   preset_index: preset index >= 0 and < tsf_get_presetcount()
 //   key: note value between 0 and 127 (60 being middle C)
@@ -186,6 +338,11 @@ TSFDEF void tsf_note_off_all(tsf* f);
 // Returns the number of active voices
 TSFDEF int tsf_active_voice_count(tsf* f);
 
+// Returns the number of voices stolen for new notes, and the number of voices of new notes
+// that were not played because no voice could be stolen (since loading or copying)
+TSFDEF int tsf_stolen_voice_count(tsf* f);
+TSFDEF int tsf_dropped_voice_count(tsf* f);
+
 // Render output samples into a buffer
 // You can either render as signed 16-bit values (tsf_render_short) or
 // as 32-bit float values (tsf_render_float)
@@ -195,6 +352,33 @@ TSFDEF int tsf_active_voice_count(tsf* f);
 TSFDEF void tsf_render_short(tsf* f, short* buffer, int samples, int flag_mixing CPP_DEFAULT0);
 TSFDEF void tsf_render_float(tsf* f, float* buffer, int samples, int flag_mixing CPP_DEFAULT0);
 
+// Inner loops of the voice rendering which can be replaced by optimized (i.e. SIMD) versions
+// Each function processes 'count' sample frames of a single voice.
+//   interpolate: out[i] = input[pos[i]] * (1 - alpha[i]) + input[nextPos[i]] * alpha[i]
+//   interpolate_short: same for 16-bit samples, each converted with (float)input[x] / 32767.0f
+//   interpolate_half: same for half-precision samples
+//   (the last two are optional, if NULL the scalar versions are used; input[-1] can always be read)
+//   mix_mono: out[i] += in[i] * gain
+//   mix_interleaved: out[i*2] += in[i] * gainLeft, out[i*2+1] += in[i] * gainRight
+//   mix_unweaved: outL[i] += in[i] * gainLeft, outR[i] += in[i] * gainRight
+struct tsf_render_kernels
+{
+	void (*interpolate)(const float* input, const unsigned int* pos, const unsigned int* nextPos, const float* alpha, float* out, int count);
+	void (*mix_mono)(float* out, const float* in, float gain, int count);
+	void (*mix_interleaved)(float* out, const float* in, float gainLeft, float gainRight, int count);
+	void (*mix_unweaved)(float* outL, float* outR, const float* in, float gainLeft, float gainRight, int count);
+	void (*interpolate_short)(const short* input, const unsigned int* pos, const unsigned int* nextPos, const float* alpha, float* out, int count);
+	void (*interpolate_half)(const unsigned short* input, const unsigned int* pos, const unsigned int* nextPos, const float* alpha, float* out, int count);
+};
+
+// Set the render kernels used by all tsf instances (NULL restores the default scalar kernels)
+// Each render loads them once when it starts (see TSF_RENDER_KERNELS). This is not
+// thread-safe, do not call it while any tsf_render* function is running.
+TSFDEF void tsf_set_render_kernels(const struct tsf_render_kernels* kernels);
+
+// Returns the default scalar render kernels
+TSFDEF const struct tsf_render_kernels* tsf_get_default_render_kernels(void);
+
 // Higher level channel based functions, set up channel parameters
 //   channel: channel number
 //   preset_index: preset index >= 0 and < tsf_get_presetcount()
@@ -257,6 +441,9 @@ TSFDEF float tsf_channel_get_tuning(tsf* f, int channel);
 // The lower this block size is the more accurate the effects are.
 // Increasing the value significantly lowers the CPU usage of the voice rendering.
 // If LFO affects the low-pass filter it can be hearable even as low as 8.
+// This is the default, it can be changed per instance with tsf_set_effect_block.
+// It is also the size of the buffers on the stack that hold sample positions and
+// values, larger blocks are processed in multiple parts.
 #ifndef TSF_RENDER_EFFECTSAMPLEBLOCK
 #define TSF_RENDER_EFFECTSAMPLEBLOCK 64
 #endif
@@ -269,6 +456,78 @@ TSFDEF float tsf_channel_get_tuning(tsf* f, int channel);
 #define TSF_RENDER_SHORTBUFFERBLOCK 512
 #endif
 
+// Default maximum size in bytes of the decoded samples of a tsf_load_memory_inplace_lazy instance
+#ifndef TSF_SAMPLE_CACHE_DEFAULT
+#define TSF_SAMPLE_CACHE_DEFAULT (256ULL << 20)
+#endif
+
+// Maximum number of samples in each part that compressed sample data is cut into when decoding
+// it at load time. Every part of an Ogg stream opens the stream and seeks to its start.
+#ifndef TSF_DECODE_PART
+#define TSF_DECODE_PART 1048576
+#endif
+
+// The function used to decode the parts of compressed sample data at load time. Define this to
+// the name of a function with the same signature as tsf_decode_samples to replace it (i.e. to
+// decode the parts on multiple threads). It must be defined after including the implementation.
+#ifndef TSF_DECODE_SAMPLES
+#define TSF_DECODE_SAMPLES tsf_decode_samples
+#endif
+
+// The function used to render a single playing voice. Define this to the name of a function
+// with the same signature as tsf_voice_render to replace it (i.e. with specialized versions).
+// It is declared by TinySoundFont and must be defined after including the implementation.
+#ifndef TSF_VOICE_RENDER
+#define TSF_VOICE_RENDER tsf_voice_render
+#endif
+
+// Number of fractional positions between two sample points in the interpolation tables
+// of the cubic and windowed-sinc modes (the nearest table entry is used).
+#ifndef TSF_INTERP_PHASES
+#define TSF_INTERP_PHASES 1024
+#endif
+
+// The function used to render all playing voices of a tsf instance into a buffer. Define this
+// to the name of a function with the same signature as tsf_render_voices to replace it (i.e.
+// to process multiple voices at once). It must be defined after including the implementation.
+#ifndef TSF_RENDER_VOICES
+#define TSF_RENDER_VOICES tsf_render_voices
+#endif
+
+// The function returning the render kernels of a render, called once when each render starts.
+// Define this to the name of a function with the same signature as tsf_render_kernels_get to
+// replace it (i.e. to switch the kernels while other threads render). It is declared by
+// TinySoundFont and must be defined after including the implementation.
+#ifndef TSF_RENDER_KERNELS
+#define TSF_RENDER_KERNELS tsf_render_kernels_get
+#endif
+
+// Number of entries in the lookup table for the low-pass filter cutoff with tsf_set_float_filters.
+#ifndef TSF_LOWPASS_TABLESIZE
+#define TSF_LOWPASS_TABLESIZE 2048
+#endif
+
+// Number of entries in the lookup tables for the conversions with TSF_FASTMATH.
+#ifndef TSF_FASTMATH_TABLESIZE
+#define TSF_FASTMATH_TABLESIZE 256
+#endif
+
+// Number of buckets of the voice index by channel and key (power of 2). The default gives every
+// key of the 16 MIDI channels a list of its own.
+#ifndef TSF_VOICE_INDEXSIZE
+#define TSF_VOICE_INDEXSIZE 2048
+#endif
+
+// Number of buckets of the voice index by exclusive class (power of 2).
+#ifndef TSF_VOICE_GROUPSIZE
+#define TSF_VOICE_GROUPSIZE 256
+#endif
+
+// Number of extra voices allocated by tsf_set_max_voices for the fade out of stolen voices.
+#ifndef TSF_STEAL_FADEVOICES
+#define TSF_STEAL_FADEVOICES 8
+#endif
+
 // Grace release time for quick voice off (avoid clicking noise)
 #define TSF_FASTRELEASETIME 0.01f
 
@@ -279,13 +538,14 @@ TSFDEF float tsf_channel_get_tuning(tsf* f, int channel);
 #  define TSF_REALLOC realloc
 #endif
 
-#if !defined(TSF_MEMCPY) || !defined(TSF_MEMSET)
+#if !defined(TSF_MEMCPY) || !defined(TSF_MEMSET) || !defined(TSF_MEMMOVE)
 #  include <string.h>
 #  define TSF_MEMCPY  memcpy
 #  define TSF_MEMSET  memset
+#  define TSF_MEMMOVE memmove
 #endif
 
-#if !defined(TSF_POW) || !defined(TSF_POWF) || !defined(TSF_EXPF) || !defined(TSF_LOG) || !defined(TSF_TAN) || !defined(TSF_LOG10) || !defined(TSF_SQRT)
+#if !defined(TSF_POW) || !defined(TSF_POWF) || !defined(TSF_EXPF) || !defined(TSF_LOG) || !defined(TSF_TAN) || !defined(TSF_LOG10) || !defined(TSF_SQRT) || !defined(TSF_SIN) || !defined(TSF_COS)
 #  include <math.h>
 #  if !defined(__cplusplus) && !defined(NAN) && !defined(powf) && !defined(expf) && !defined(sqrtf)
 #    define powf (float)pow // deal with old math.h
@@ -299,6 +559,8 @@ TSFDEF float tsf_channel_get_tuning(tsf* f, int channel);
 #  define TSF_TAN     tan
 #  define TSF_LOG10   log10
 #  define TSF_SQRTF   sqrtf
+#  define TSF_SIN     sin
+#  define TSF_COS     cos
 #endif
 
 #ifndef TSF_NO_STDIO
@@ -321,6 +583,8 @@ typedef unsigned char tsf_u8;
 typedef unsigned short tsf_u16;
 typedef signed short tsf_s16;
 typedef unsigned int tsf_u32;
+typedef unsigned long long tsf_u64;
+typedef signed long long tsf_s64;
 typedef char tsf_char20[20];
 
 #define TSF_FourCCEquals(value1, value2) (value1[0] == value2[0] && value1[1] == value2[1] && value1[2] == value2[2] && value1[3] == value2[3])
@@ -329,17 +593,46 @@ struct tsf
 {
 	struct tsf_preset* presets;
 	float* fontSamples;
+	const short* fontSamplesShort; // used instead of fontSamples for samples read in place or TSF_SAMPLES_SHORT
+	const tsf_u16* fontSamplesHalf; // used instead of fontSamples for TSF_SAMPLES_HALF
+	void* fontSampleStorage; // allocation of fontSamplesShort or fontSamplesHalf, one element before them
+	unsigned int fontSampleCount;
+	const struct tsf_lazy_sample* lazySamples; // samples of tsf_load_memory_inplace_lazy (one per shdr), used instead of fontSamples
+	struct tsf_cached_sample* cachedSamples; // decoded lazySamples of this instance
+	int lazySampleNum;
+	unsigned long long sampleCacheMax;
+	struct tsf_sample_cache_stats sampleCacheStats;
+	void (*fontRelease)(void* data);
+	void* fontReleaseData;
 	struct tsf_voice* voices;
+	int* activeVoices;
+	int* voiceIndex;
 	struct tsf_channels* channels;
+	struct tsf_channels* spareChannels; // storage kept by tsf_reset or tsf_reserve while channels is null
 
 	int presetNum;
 	int voiceNum;
+	int activeVoiceNum;
 	int maxVoiceNum;
 	unsigned int voicePlayIndex;
 
+	enum TSFVoiceStealing voiceStealing;
+	struct tsf_steal_candidate* stealHeap;
+	int stealHeapNum, stealHeapMax;
+	TSF_BOOL stealHeapValid;
+	int stolenVoiceCount, droppedVoiceCount;
+
 	enum TSFOutputMode outputmode;
 	float outSampleRate;
 	float globalGainDB;
+	int fixedPointPhase;
+	enum TSFInterpolation interpolation;
+	int effectSampleBlock;
+	TSF_BOOL gainRamp;
+	TSF_BOOL floatFilters;
+	int renderThreads;
+	const struct tsf_render_kernels* renderKernels; // kernels of the running render
+	TSF_BOOL realtime;
 	int* refCount;
 };
 
@@ -436,6 +729,7 @@ struct tsf_region
 	int freqModLFO, modLfoToPitch;
 	float delayVibLFO;
 	int freqVibLFO, vibLfoToPitch;
+	int sampleIndex;
 };
 
 struct tsf_preset
@@ -452,8 +746,10 @@ struct tsf_voice
 	struct tsf_region* region;
 	double pitchInputTimecents, pitchOutputFactor;
 	double sourceSamplePosition;
+	tsf_u64 sourceSamplePhase;
 	float  noteGainDB, panFactorLeft, panFactorRight;
 	unsigned int playIndex, loopStart, loopEnd;
+	int keyPrev, keyNext, groupPrev, groupNext;
 	struct tsf_voice_envelope ampenv, modenv;
 	struct tsf_voice_lowpass lowpass;
 	struct tsf_voice_lfo modlfo, viblfo;
@@ -468,15 +764,87 @@ struct tsf_channel
 struct tsf_channels
 {
 	void (*setupVoice)(tsf* f, struct tsf_voice* voice);
-	int channelNum, activeChannel;
+	int channelNum, channelMax, activeChannel;
 	struct tsf_channel channels[1];
 };
 
+#ifdef TSF_FASTMATH
+// Approximations of 2^x and log2(x) with linearly interpolated tables, built by tsf_fastmath_setup.
+// With 256 entries the conversions are within 0.003 cents for pitch and frequency and within
+// 0.0001 dB for gain.
+static double tsf_fastmath_exp2_table[TSF_FASTMATH_TABLESIZE + 1];
+static float tsf_fastmath_exp2f_table[TSF_FASTMATH_TABLESIZE + 1], tsf_fastmath_log2f_table[TSF_FASTMATH_TABLESIZE + 1];
+static TSF_BOOL tsf_fastmath_ready;
+
+static void tsf_fastmath_setup(void)
+{
+	int i;
+	if (tsf_fastmath_ready) return;
+	for (i = 0; i <= TSF_FASTMATH_TABLESIZE; i++)
+	{
+		tsf_fastmath_exp2_table[i] = TSF_POW(2.0, (double)i / TSF_FASTMATH_TABLESIZE);
+		tsf_fastmath_exp2f_table[i] = (float)tsf_fastmath_exp2_table[i];
+		tsf_fastmath_log2f_table[i] = (float)(TSF_LOG10(1.0 + (double)i / TSF_FASTMATH_TABLESIZE) / TSF_LOG10(2.0));
+	}
+	tsf_fastmath_ready = TSF_TRUE;
+}
+
+static double tsf_fastmath_exp2(double x)
+{
+	union { double d; tsf_u64 i; } scale;
+	double t;
+	int e, i;
+	if (x < -1022.0) return 0.0;
+	if (x > 1023.0) x = 1023.0;
+	e = (int)x;
+	if (x < e) e--;
+	t = (x - e) * TSF_FASTMATH_TABLESIZE;
+	i = (int)t;
+	scale.i = (tsf_u64)(e + 1023) << 52;
+	return scale.d * (tsf_fastmath_exp2_table[i] + (tsf_fastmath_exp2_table[i + 1] - tsf_fastmath_exp2_table[i]) * (t - i));
+}
+
+static float tsf_fastmath_exp2f(float x)
+{
+	union { float f; tsf_u32 i; } scale;
+	float t;
+	int e, i;
+	if (x < -126.0f) return 0.0f;
+	if (x > 127.0f) x = 127.0f;
+	e = (int)x;
+	if (x < e) e--;
+	t = (x - e) * TSF_FASTMATH_TABLESIZE;
+	i = (int)t;
+	scale.i = (tsf_u32)(e + 127) << 23;
+	return scale.f * (tsf_fastmath_exp2f_table[i] + (tsf_fastmath_exp2f_table[i + 1] - tsf_fastmath_exp2f_table[i]) * (t - i));
+}
+
+// Only for normalized positive numbers
+static float tsf_fastmath_log2f(float x)
+{
+	union { float f; tsf_u32 i; } bits;
+	tsf_u32 mantissa;
+	float t;
+	int i;
+	bits.f = x;
+	mantissa = bits.i & 0x7FFFFF;
+	t = (float)mantissa * ((float)TSF_FASTMATH_TABLESIZE / 8388608.0f);
+	i = (int)t;
+	return (float)((int)(bits.i >> 23) - 127) + tsf_fastmath_log2f_table[i] + (tsf_fastmath_log2f_table[i + 1] - tsf_fastmath_log2f_table[i]) * (t - i);
+}
+
+static double tsf_timecents2Secsd(double timecents) { return tsf_fastmath_exp2(timecents / 1200.0); }
+static float tsf_timecents2Secsf(float timecents) { return tsf_fastmath_exp2f(timecents / 1200.0f); }
+static float tsf_cents2Hertz(float cents) { return 8.176f * tsf_fastmath_exp2f(cents / 1200.0f); }
+static float tsf_decibelsToGain(float db) { return (db > -100.f ? tsf_fastmath_exp2f(db * 0.166096404f) : 0); } // log2(10) / 20
+static float tsf_gainToDecibels(float gain) { return (gain <= .00001f ? -100.f : 6.02059991f * tsf_fastmath_log2f(gain)); } // 20 * log10(2)
+#else
 static double tsf_timecents2Secsd(double timecents) { return TSF_POW(2.0, timecents / 1200.0); }
 static float tsf_timecents2Secsf(float timecents) { return TSF_POWF(2.0f, timecents / 1200.0f); }
 static float tsf_cents2Hertz(float cents) { return 8.176f * TSF_POWF(2.0f, cents / 1200.0f); }
 static float tsf_decibelsToGain(float db) { return (db > -100.f ? TSF_POWF(10.0f, db * 0.05f) : 0); }
 static float tsf_gainToDecibels(float gain) { return (gain <= .00001f ? -100.f : (float)(20.0 * TSF_LOG10(gain))); }
+#endif
 
 static TSF_BOOL tsf_riffchunk_read(struct tsf_riffchunk* parent, struct tsf_riffchunk* chunk, struct tsf_stream* stream)
 {
@@ -820,6 +1188,7 @@ static int tsf_load_presets(tsf* res, struct tsf_hydra *hydra, unsigned int font
 
 								// Fixup sample positions
 								pshdr = &hydra->shdrs[pigen->genAmount.wordAmount];
+								zoneRegion.sampleIndex = pigen->genAmount.wordAmount;
 								zoneRegion.offset += pshdr->start;
 								zoneRegion.end += pshdr->end;
 								zoneRegion.loop_start += pshdr->startLoop;
@@ -863,31 +1232,29 @@ static int tsf_load_presets(tsf* res, struct tsf_hydra *hydra, unsigned int font
 }
 
 #ifdef STB_VORBIS_INCLUDE_STB_VORBIS_H
+#if !defined(STB_VORBIS_NO_PULLDATA_API) && !defined(STB_VORBIS_NO_FROMMEMORY)
+// With the pull API the length of each Ogg stream is read up front and streams are decoded from any
+// position, so samples are decoded straight into their final place (in parts, or lazily)
+#define TSF_OGG_PULL
+#endif
+
+#ifndef TSF_OGG_PULL
 static int tsf_decode_ogg(const tsf_u8 *pSmpl, const tsf_u8 *pSmplEnd, float** pRes, tsf_u32* pResNum, tsf_u32* pResMax, tsf_u32 resInitial)
 {
 	float *res = *pRes, *oldres; tsf_u32 resNum = *pResNum; tsf_u32 resMax = *pResMax; stb_vorbis *v;
 
-	// Use whatever stb_vorbis API that is available (either pull or push)
-	#if !defined(STB_VORBIS_NO_PULLDATA_API) && !defined(STB_VORBIS_NO_FROMMEMORY)
-	v = stb_vorbis_open_memory(pSmpl, (int)(pSmplEnd - pSmpl), TSF_NULL, TSF_NULL);
-	#else
+	// Without the pull API, decode the stream frame by frame with the push API
 	{ int use, err; v = stb_vorbis_open_pushdata(pSmpl, (int)(pSmplEnd - pSmpl), &use, &err, TSF_NULL); pSmpl += use; }
-	#endif
 	if (v == TSF_NULL) return 0;
 
 	for (;;)
 	{
 		float** outputs; int n_samples;
 
-		// Decode one frame of vorbis samples with whatever stb_vorbis API that is available
-		#if !defined(STB_VORBIS_NO_PULLDATA_API) && !defined(STB_VORBIS_NO_FROMMEMORY)
-		n_samples = stb_vorbis_get_frame_float(v, TSF_NULL, &outputs);
-		if (!n_samples) break;
-		#else
+		// Decode one frame of vorbis samples
 		if (pSmpl >= pSmplEnd) break;
 		{ int use = stb_vorbis_decode_frame_pushdata(v, pSmpl, (int)(pSmplEnd - pSmpl), TSF_NULL, &outputs, &n_samples); pSmpl += use; }
 		if (!n_samples) continue;
-		#endif
 
 		// Expand our output buffer if necessary then copy over the decoded frame samples
 		resNum += n_samples;
@@ -963,28 +1330,337 @@ static int tsf_decode_sf3_samples(const void* rawBuffer, float** pFloatBuffer, u
 
 	// Trim the sample buffer down then return success (unless out of memory)
 	if (!(*pFloatBuffer = (float*)TSF_REALLOC(res, resNum * sizeof(float)))) *pFloatBuffer = res;
-	*pFloatBuffer = res;
 	*pSmplCount = resNum;
-	return (res ? 1 : 0);
+	return (*pFloatBuffer ? 1 : 0);
+}
+
+// Decode custom .sfo 'smpo' format where all samples are in a single ogg stream
+static int tsf_decode_sfo_samples(const void* rawBuffer, float** pFloatBuffer, unsigned int* pSmplCount)
+{
+	tsf_u32 resNum = 0, resMax = 0; float* oldres;
+	if (!tsf_decode_ogg((const tsf_u8*)rawBuffer, (const tsf_u8*)rawBuffer + *pSmplCount, pFloatBuffer, &resNum, &resMax, 65536)) return 0;
+	if (!(*pFloatBuffer = (float*)TSF_REALLOC((oldres = *pFloatBuffer), resNum * sizeof(float)))) *pFloatBuffer = oldres;
+	*pSmplCount = resNum;
+	return (*pFloatBuffer ? 1 : 0);
+}
+#endif
+
+static int tsf_has_compressed_samples(const struct tsf_hydra *hydra)
+{
+	int i;
+	for (i = 0; i != hydra->shdrNum; i++)
+		if (hydra->shdrs[i].sampleType & 0x30) return 1;
+	return 0;
+}
+#endif
+
+// Sample points decoded around the range played by the regions of a lazy sample, for the interpolation taps
+#define TSF_LAZY_PADDING 8
+
+// A sample of tsf_load_memory_inplace_lazy, decoded into the sample indices start to start + size.
+// Indices of the sample data go up to end, the ones above are zero for reads past the sample data.
+// Loading without lazy decoding uses the same struct for the parts it decodes (end is unused).
+struct tsf_lazy_sample
+{
+	const void* source; // Ogg stream or 16-bit samples, in the buffer of the SoundFont
+	unsigned int sourceSize, sourceStart, sourceCount; // bytes of an Ogg stream, sample index and number of samples of the source
+	unsigned int start, end, size;
+	TSF_BOOL isOgg;
+};
+
+struct tsf_cached_sample { float* buffer; unsigned int lastUse; };
+
+#ifdef TSF_OGG_PULL
+static tsf_u32 tsf_ogg_length(const tsf_u8* data, tsf_u32 size)
+{
+	tsf_u32 res;
+	stb_vorbis* v = stb_vorbis_open_memory(data, (int)size, TSF_NULL, TSF_NULL);
+	if (v == TSF_NULL) return 0;
+	res = stb_vorbis_stream_length_in_samples(v);
+	stb_vorbis_close(v);
+	return res;
+}
+
+// Lay out the samples of the sample data without decoding them,
+// the number of samples of each Ogg stream is read from its last page.
+static int tsf_layout_samples(const void* rawBuffer, TSF_BOOL isSfo, unsigned int* pSmplCount, struct tsf_hydra *hydra, struct tsf_lazy_sample** pSamples)
+{
+	const tsf_u8* smplBuffer = (const tsf_u8*)rawBuffer;
+	tsf_u32 smplLength = *pSmplCount, resNum = 0;
+	int i, shdrLast = hydra->shdrNum - 1, is_sf3 = 0;
+	struct tsf_lazy_sample* samples = (struct tsf_lazy_sample*)TSF_MALLOC(hydra->shdrNum * sizeof(struct tsf_lazy_sample));
+	if (!samples) return 0;
+	TSF_MEMSET(samples, 0, hydra->shdrNum * sizeof(struct tsf_lazy_sample));
+	*pSamples = samples;
+	if (isSfo)
+	{
+		// All samples are in a single stream, each one decodes the part of the stream it plays
+		resNum = tsf_ogg_length(smplBuffer, smplLength);
+		for (i = 0; i <= shdrLast; i++)
+		{
+			samples[i].source = smplBuffer;
+			samples[i].sourceSize = smplLength;
+			samples[i].sourceCount = resNum;
+			samples[i].isOgg = TSF_TRUE;
+		}
+		*pSmplCount = resNum;
+		return (resNum ? 1 : 0);
+	}
+	for (i = 0; i <= shdrLast; i++)
+	{
+		struct tsf_hydra_shdr *shdr = &hydra->shdrs[i];
+		if (shdr->sampleType & 0x30) // compression flags (sometimes Vorbis flag)
+		{
+			const tsf_u8 *pSmpl = smplBuffer + shdr->start, *pSmplEnd = smplBuffer + shdr->end;
+			tsf_u32 length = 0;
+			if (shdr->end > smplLength || pSmpl + 4 > pSmplEnd || !TSF_FourCCEquals(pSmpl, "OggS") || !(length = tsf_ogg_length(pSmpl, (tsf_u32)(pSmplEnd - pSmpl))))
+			{
+				shdr->start = shdr->end = shdr->startLoop = shdr->endLoop = 0;
+				continue;
+			}
+			samples[i].source = pSmpl;
+			samples[i].sourceSize = (unsigned int)(pSmplEnd - pSmpl);
+			samples[i].sourceStart = resNum;
+			samples[i].sourceCount = length;
+			samples[i].isOgg = TSF_TRUE;
+
+			// Fix up sample indices in shdr
+			shdr->start = resNum;
+			shdr->startLoop += resNum;
+			shdr->endLoop += resNum;
+			resNum += length;
+			shdr->end = resNum;
+			is_sf3 = 1;
+		}
+		else // raw PCM sample
+		{
+			const short *in = (const short*)smplBuffer + resNum, *inEnd;
+			if (is_sf3) // Fix up sample indices in shdr
+			{
+				tsf_u32 fix_offset = resNum - shdr->start;
+				in -= fix_offset;
+				shdr->start = resNum;
+				shdr->end += fix_offset;
+				shdr->startLoop += fix_offset;
+				shdr->endLoop += fix_offset;
+			}
+			inEnd = in + ((shdr->end >= shdr->endLoop ? shdr->end : shdr->endLoop) - resNum);
+			if (i == shdrLast || (const tsf_u8*)inEnd > (smplBuffer + smplLength)) inEnd = (const short*)(smplBuffer + smplLength);
+			if (inEnd <= in) continue;
+			samples[i].source = in;
+			samples[i].sourceStart = resNum;
+			samples[i].sourceCount = (unsigned int)(inEnd - in);
+			resNum += (tsf_u32)(inEnd - in);
+		}
+	}
+	*pSmplCount = resNum;
+	return 1;
+}
+#endif
+
+// Set the range of each lazy sample to the sample indices played by its regions, with padding
+static void tsf_lazy_ranges(const tsf* f, struct tsf_lazy_sample* samples)
+{
+	const struct tsf_preset *preset, *presetEnd;
+	const struct tsf_region *region, *regionEnd;
+	struct tsf_lazy_sample *s, *sEnd;
+	tsf_u32 count = f->fontSampleCount;
+	for (s = samples, sEnd = s + f->lazySampleNum; s != sEnd; s++) { s->start = count; s->end = 0; }
+	for (preset = f->presets, presetEnd = preset + f->presetNum; preset != presetEnd; preset++)
+	{
+		for (region = preset->regions, regionEnd = region + preset->regionNum; region != regionEnd; region++)
+		{
+			tsf_u32 lo = (region->offset < region->loop_start ? region->offset : region->loop_start);
+			tsf_u32 hi = (region->end > region->loop_end ? region->end : region->loop_end) + 1;
+			s = &samples[region->sampleIndex];
+			if (lo > count) lo = count;
+			if (hi > count + 1) hi = count + 1;
+			if (lo < s->start) s->start = lo;
+			if (hi > s->end) s->end = hi;
+		}
+	}
+	for (s = samples; s != sEnd; s++)
+	{
+		if (s->start >= s->end) { s->start = s->end = s->size = 0; continue; }
+		s->start = (s->start > TSF_LAZY_PADDING ? s->start - TSF_LAZY_PADDING : 0);
+		s->size = s->end + TSF_LAZY_PADDING - s->start;
+		if (s->end > count) s->end = count;
+	}
+}
+
+// Decode the sample indices start to start + size of s into out, with zeros where it has no source
+// (returns 0 if the Ogg stream could not be opened)
+static int tsf_decode_window(const struct tsf_lazy_sample* s, float* out)
+{
+	tsf_u32 first = (s->start > s->sourceStart ? s->start : s->sourceStart), last = s->start + s->size, done = 0;
+	if (last > s->sourceStart + s->sourceCount) last = s->sourceStart + s->sourceCount;
+	if (first >= last) first = s->start;
+	else if (!s->isOgg)
+	{
+		// Convert the samples from short to float
+		const short* in = (const short*)s->source + (first - s->sourceStart);
+		float *pOut = out + (first - s->start), *pOutEnd = pOut + (last - first);
+		while (pOut != pOutEnd) *(pOut++) = (float)(*(in++) / 32767.0);
+		done = last - first;
+	}
+	#ifdef TSF_OGG_PULL
+	else
+	{
+		float* pOut = out + (first - s->start);
+		int n;
+		stb_vorbis* v = stb_vorbis_open_memory((const unsigned char*)s->source, (int)s->sourceSize, TSF_NULL, TSF_NULL);
+		if (v == TSF_NULL || (first != s->sourceStart && !stb_vorbis_seek(v, first - s->sourceStart)))
+		{
+			if (v) stb_vorbis_close(v);
+			return 0;
+		}
+		n = stb_vorbis_get_samples_float(v, 1, &pOut, (int)(last - first));
+		stb_vorbis_close(v);
+		if (n > 0) done = (tsf_u32)n;
+	}
+	#endif
+
+	// Zero what is before the source and after the samples decoded
+	TSF_MEMSET(out, 0, (first - s->start) * sizeof(float));
+	TSF_MEMSET(out + (first - s->start) + done, 0, (s->size - (first - s->start) - done) * sizeof(float));
+	return 1;
+}
+
+// Decode a lazy sample into a new buffer
+static float* tsf_lazy_decode(const struct tsf_lazy_sample* s)
+{
+	float* res;
+	if (!s->size) return TSF_NULL;
+	res = (float*)TSF_MALLOC(s->size * sizeof(float));
+	if (res && !tsf_decode_window(s, res)) { TSF_FREE(res); res = TSF_NULL; }
+	return res;
+}
+
+#ifdef TSF_OGG_PULL
+static int TSF_DECODE_SAMPLES(const struct tsf_lazy_sample* parts, int count, float* output);
+
+// Decode parts of the sample data, each one into output at its sample index start
+static int tsf_decode_samples(const struct tsf_lazy_sample* parts, int count, float* output)
+{
+	int i;
+	for (i = 0; i != count; i++)
+		if (!tsf_decode_window(&parts[i], output + parts[i].start)) return 0;
+	return 1;
+}
+
+// Decode whole sources into a new buffer of count samples. They are cut into independent parts of
+// at most TSF_DECODE_PART samples (Ogg parts seek to their start), decoded with TSF_DECODE_SAMPLES.
+static float* tsf_decode_sources(const struct tsf_lazy_sample* sources, int sourceNum, tsf_u32 count)
+{
+	struct tsf_lazy_sample *parts, *part;
+	float* res;
+	tsf_u32 pos;
+	int i, partNum = 0;
+	for (i = 0; i != sourceNum; i++)
+		partNum += (int)((sources[i].sourceCount + (TSF_DECODE_PART - 1)) / TSF_DECODE_PART);
+	if (!partNum) return TSF_NULL;
+	res = (float*)TSF_MALLOC(count * sizeof(float));
+	parts = (struct tsf_lazy_sample*)TSF_MALLOC(partNum * sizeof(struct tsf_lazy_sample));
+	if (res && parts)
+	{
+		for (part = parts, i = 0; i != sourceNum; i++)
+		{
+			for (pos = 0; pos < sources[i].sourceCount; pos += TSF_DECODE_PART, part++)
+			{
+				*part = sources[i];
+				part->start = sources[i].sourceStart + pos;
+				part->size = (sources[i].sourceCount - pos < TSF_DECODE_PART ? sources[i].sourceCount - pos : TSF_DECODE_PART);
+			}
+		}
+		if (!TSF_DECODE_SAMPLES(parts, partNum, res)) { TSF_FREE(res); res = TSF_NULL; }
+	}
+	else { TSF_FREE(res); res = TSF_NULL; }
+	TSF_FREE(parts);
+	return res;
+}
+
+// Decode the samples of an .sf3 into a buffer allocated once at its final size
+static int tsf_decode_sf3_samples(const void* rawBuffer, float** pFloatBuffer, unsigned int* pSmplCount, struct tsf_hydra *hydra)
+{
+	struct tsf_lazy_sample* sources = TSF_NULL;
+	*pFloatBuffer = TSF_NULL;
+	if (tsf_layout_samples(rawBuffer, TSF_FALSE, pSmplCount, hydra, &sources))
+		*pFloatBuffer = tsf_decode_sources(sources, hydra->shdrNum, *pSmplCount);
+	TSF_FREE(sources);
+	return (*pFloatBuffer ? 1 : 0);
+}
+
+// Decode custom .sfo 'smpo' format where all samples are in a single ogg stream
+static int tsf_decode_sfo_samples(const void* rawBuffer, float** pFloatBuffer, unsigned int* pSmplCount)
+{
+	struct tsf_lazy_sample source;
+	TSF_MEMSET(&source, 0, sizeof(source));
+	source.source = rawBuffer;
+	source.sourceSize = *pSmplCount;
+	source.sourceCount = *pSmplCount = tsf_ogg_length((const tsf_u8*)rawBuffer, *pSmplCount);
+	source.isOgg = TSF_TRUE;
+	*pFloatBuffer = tsf_decode_sources(&source, 1, *pSmplCount);
+	return (*pFloatBuffer ? 1 : 0);
 }
 #endif
 
+static struct tsf_cached_sample* tsf_sample_cache_create(int count)
+{
+	struct tsf_cached_sample* res = (struct tsf_cached_sample*)TSF_MALLOC(count * sizeof(struct tsf_cached_sample));
+	if (res) TSF_MEMSET(res, 0, count * sizeof(struct tsf_cached_sample));
+	return res;
+}
+
+// Free the least recently used samples until the cache is below its maximum size,
+// samples of playing voices and samples used at tick are kept
+static void tsf_sample_cache_trim(tsf* f, unsigned int tick)
+{
+	struct tsf_cached_sample* c = f->cachedSamples;
+	int *a, *aEnd, i, oldest;
+	if (f->sampleCacheStats.bytes <= f->sampleCacheMax) return;
+	for (a = f->activeVoices, aEnd = a + f->activeVoiceNum; a != aEnd; a++)
+		if (f->voices[*a].playingPreset != -1) c[f->voices[*a].region->sampleIndex].lastUse = tick;
+	while (f->sampleCacheStats.bytes > f->sampleCacheMax)
+	{
+		for (oldest = -1, i = 0; i != f->lazySampleNum; i++)
+			if (c[i].buffer && c[i].lastUse != tick && (oldest == -1 || tick - c[i].lastUse > tick - c[oldest].lastUse)) oldest = i;
+		if (oldest == -1) return;
+		TSF_FREE(c[oldest].buffer);
+		c[oldest].buffer = TSF_NULL;
+		f->sampleCacheStats.bytes -= f->lazySamples[oldest].size * sizeof(float);
+		f->sampleCacheStats.evictions++;
+	}
+}
+
+// Make sure a lazy sample is decoded and mark it as used at tick
+// Notes count as hits or misses and in real-time mode they cannot decode (it allocates memory).
+static int tsf_sample_cache_get(tsf* f, int index, unsigned int tick, TSF_BOOL isNote)
+{
+	struct tsf_cached_sample* c = &f->cachedSamples[index];
+	if (c->buffer)
+	{
+		if (isNote) f->sampleCacheStats.hits++;
+		c->lastUse = tick;
+		return 1;
+	}
+	if (isNote) f->sampleCacheStats.misses++;
+	if ((isNote && f->realtime) || !(c->buffer = tsf_lazy_decode(&f->lazySamples[index]))) return 0;
+	c->lastUse = tick;
+	f->sampleCacheStats.decodes++;
+	f->sampleCacheStats.bytes += f->lazySamples[index].size * sizeof(float);
+	tsf_sample_cache_trim(f, tick);
+	return 1;
+}
+
 static int tsf_load_samples(void** pRawBuffer, float** pFloatBuffer, unsigned int* pSmplCount, struct tsf_riffchunk *chunkSmpl, struct tsf_stream* stream)
 {
 	#ifdef STB_VORBIS_INCLUDE_STB_VORBIS_H
-	// With OGG Vorbis support we cannot pre-allocate the memory for tsf_decode_sf3_samples
-	tsf_u32 resNum, resMax; float* oldres;
+	// With OGG Vorbis support the samples are decoded after reading the raw sample data
 	*pSmplCount = chunkSmpl->size;
 	*pRawBuffer = (void*)TSF_MALLOC(*pSmplCount);
 	if (!*pRawBuffer || !stream->read(stream->data, *pRawBuffer, chunkSmpl->size)) return 0;
 	if (chunkSmpl->id[3] != 'o') return 1;
-
-	// Decode custom .sfo 'smpo' format where all samples are in a single ogg stream
-	resNum = resMax = 0;
-	if (!tsf_decode_ogg((tsf_u8*)*pRawBuffer, (tsf_u8*)*pRawBuffer + chunkSmpl->size, pFloatBuffer, &resNum, &resMax, 65536)) return 0;
-	if (!(*pFloatBuffer = (float*)TSF_REALLOC((oldres = *pFloatBuffer), resNum * sizeof(float)))) *pFloatBuffer = oldres;
-	*pSmplCount = resNum;
-	return (*pFloatBuffer ? 1 : 0);
+	return tsf_decode_sfo_samples(*pRawBuffer, pFloatBuffer, pSmplCount);
 	#else
 	// Inline convert the samples from short to float
 	float *res, *out; const short *in;
@@ -1152,6 +1828,60 @@ static float tsf_voice_lowpass_process(struct tsf_voice_lowpass* e, double In)
 	double Out = In * e->a0 + e->z1; e->z1 = In * e->a1 + e->z2 - e->b1 * Out; e->z2 = In * e->a0 - e->b2 * Out; return (float)Out;
 }
 
+// tan(pi * Fc) for Fc from 0 to 0.5 in TSF_LOWPASS_TABLESIZE steps
+static float tsf_lowpass_tan_table[TSF_LOWPASS_TABLESIZE + 1];
+static TSF_BOOL tsf_lowpass_tan_table_ready;
+
+static void tsf_lowpass_setup_table(void)
+{
+	int i;
+	if (tsf_lowpass_tan_table_ready) return;
+	for (i = 0; i < TSF_LOWPASS_TABLESIZE; i++) tsf_lowpass_tan_table[i] = (float)TSF_TAN(TSF_PI * 0.5 * i / TSF_LOWPASS_TABLESIZE);
+	tsf_lowpass_tan_table[TSF_LOWPASS_TABLESIZE] = tsf_lowpass_tan_table[TSF_LOWPASS_TABLESIZE - 1] * 2.0f; // tan(pi/2) is infinite, never used by active filters
+	tsf_lowpass_tan_table_ready = TSF_TRUE;
+}
+
+// Single precision version of the low-pass filter state and coefficients
+struct tsf_voice_lowpassf { float a0, a1, b1, b2, z1, z2; };
+
+static void tsf_voice_lowpassf_load(struct tsf_voice_lowpassf* e, const struct tsf_voice_lowpass* d)
+{
+	e->a0 = (float)d->a0; e->a1 = (float)d->a1; e->b1 = (float)d->b1; e->b2 = (float)d->b2; e->z1 = (float)d->z1; e->z2 = (float)d->z2;
+}
+
+static void tsf_voice_lowpassf_store(const struct tsf_voice_lowpassf* e, struct tsf_voice_lowpass* d)
+{
+	d->z1 = e->z1; d->z2 = e->z2;
+}
+
+static void tsf_voice_lowpassf_setup(struct tsf_voice_lowpassf* e, float QInv, float Fc)
+{
+	// Same filter as tsf_voice_lowpass_setup with tan() linearly interpolated from the table
+	float x = Fc * (2.0f * TSF_LOWPASS_TABLESIZE), K, KK, norm;
+	int i = (int)x;
+	K = tsf_lowpass_tan_table[i] + (tsf_lowpass_tan_table[i + 1] - tsf_lowpass_tan_table[i]) * (x - i);
+	KK = K * K;
+	norm = 1.0f / (1.0f + K * QInv + KK);
+	e->a0 = KK * norm;
+	e->a1 = 2.0f * e->a0;
+	e->b1 = 2.0f * (KK - 1.0f) * norm;
+	e->b2 = (1.0f - K * QInv + KK) * norm;
+}
+
+static void tsf_voice_lowpassf_process(struct tsf_voice_lowpassf* e, float* values, int count)
+{
+	float a0 = e->a0, a1 = e->a1, b1 = e->b1, b2 = e->b2, z1 = e->z1, z2 = e->z2;
+	int i;
+	for (i = 0; i != count; i++)
+	{
+		float In = values[i], Out = In * a0 + z1;
+		z1 = In * a1 + z2 - b1 * Out;
+		z2 = In * a0 - b2 * Out;
+		values[i] = Out;
+	}
+	e->z1 = z1; e->z2 = z2;
+}
+
 static void tsf_voice_lfo_setup(struct tsf_voice_lfo* e, float delay, int freqCents, float outSampleRate)
 {
 	e->samplesUntil = (int)(delay * outSampleRate);
@@ -1169,41 +1899,177 @@ static void tsf_voice_lfo_process(struct tsf_voice_lfo* e, int blockSamples)
 
 static void tsf_voice_kill(struct tsf_voice* v)
 {
+	// Stays in the active voice list until the next tsf_active_voices_compact
 	v->playingPreset = -1;
 }
 
-static void tsf_voice_end(tsf* f, struct tsf_voice* v)
+// Voices in the active voice list are also linked into f->voiceIndex, a hash table of doubly
+// linked lists by channel and key (first TSF_VOICE_INDEXSIZE heads), and for voices with an
+// exclusive class by class (next TSF_VOICE_GROUPSIZE heads). Links are voice indices, -1 ends a list.
+static int* tsf_voice_index_key(tsf* f, int channel, int key)
 {
-	// if maxVoiceNum is set, assume that voice rendering and note queuing are on separate threads
-	// so to minimize the chance that voice rendering would advance the segment at the same time
-	// we just do it twice here and hope that it sticks
-	int repeats = (f->maxVoiceNum ? 2 : 1);
-	while (repeats--)
-	{
-		tsf_voice_envelope_nextsegment(&v->ampenv, TSF_SEGMENT_SUSTAIN, f->outSampleRate);
-		tsf_voice_envelope_nextsegment(&v->modenv, TSF_SEGMENT_SUSTAIN, f->outSampleRate);
-		if (v->region->loop_mode == TSF_LOOPMODE_SUSTAIN)
-		{
-			// Continue playing, but stop looping.
-			v->loopEnd = v->loopStart;
-		}
-	}
+	return &f->voiceIndex[(unsigned int)(channel * 128 + key) & (TSF_VOICE_INDEXSIZE - 1)];
 }
 
-static void tsf_voice_endquick(tsf* f, struct tsf_voice* v)
+static int* tsf_voice_index_group(tsf* f, unsigned int group)
 {
-	// if maxVoiceNum is set, assume that voice rendering and note queuing are on separate threads
-	// so to minimize the chance that voice rendering would advance the segment at the same time
-	// we just do it twice here and hope that it sticks
-	int repeats = (f->maxVoiceNum ? 2 : 1);
-	while (repeats--)
-	{
-		v->ampenv.parameters.release = 0.0f; tsf_voice_envelope_nextsegment(&v->ampenv, TSF_SEGMENT_SUSTAIN, f->outSampleRate);
-		v->modenv.parameters.release = 0.0f; tsf_voice_envelope_nextsegment(&v->modenv, TSF_SEGMENT_SUSTAIN, f->outSampleRate);
-	}
+	return &f->voiceIndex[TSF_VOICE_INDEXSIZE + (group & (TSF_VOICE_GROUPSIZE - 1))];
 }
 
-static void tsf_voice_calcpitchratio(struct tsf_voice* v, float pitchShift, float outSampleRate)
+static void tsf_voice_index_add(tsf* f, struct tsf_voice* v)
+{
+	int i = (int)(v - f->voices), *head = tsf_voice_index_key(f, v->playingChannel, v->playingKey);
+	v->keyPrev = -1;
+	v->keyNext = *head;
+	if (*head != -1) f->voices[*head].keyPrev = i;
+	*head = i;
+	if (!v->region->group) return;
+	head = tsf_voice_index_group(f, v->region->group);
+	v->groupPrev = -1;
+	v->groupNext = *head;
+	if (*head != -1) f->voices[*head].groupPrev = i;
+	*head = i;
+}
+
+static void tsf_voice_index_remove(tsf* f, struct tsf_voice* v)
+{
+	if (v->keyPrev != -1) f->voices[v->keyPrev].keyNext = v->keyNext;
+	else *tsf_voice_index_key(f, v->playingChannel, v->playingKey) = v->keyNext;
+	if (v->keyNext != -1) f->voices[v->keyNext].keyPrev = v->keyPrev;
+	if (!v->region->group) return;
+	if (v->groupPrev != -1) f->voices[v->groupPrev].groupNext = v->groupNext;
+	else *tsf_voice_index_group(f, v->region->group) = v->groupNext;
+	if (v->groupNext != -1) f->voices[v->groupNext].groupPrev = v->groupPrev;
+}
+
+// The indices of voices that may be playing are kept in f->activeVoices, sorted ascending so
+// voices are rendered in the same order as when scanning all voices. Voices that have been killed
+// are skipped until they are removed by this function.
+static void tsf_active_voices_compact(tsf* f)
+{
+	int *a = f->activeVoices, *aEnd = a + f->activeVoiceNum, *aOut = a;
+	for (; a != aEnd; a++)
+	{
+		if (f->voices[*a].playingPreset != -1) *aOut++ = *a;
+		else tsf_voice_index_remove(f, &f->voices[*a]);
+	}
+	f->activeVoiceNum = (int)(aOut - f->activeVoices);
+}
+
+// Returns the free voice with the lowest index from first to end (exclusive) and adds it to the
+// active voice list, or null if all of these voices are playing
+static struct tsf_voice* tsf_voice_activate(tsf* f, int first, int end)
+{
+	int i = first, n, *a = f->activeVoices;
+	tsf_active_voices_compact(f);
+	for (n = 0; n != f->activeVoiceNum && a[n] < first; n++) {}
+	for (; n != f->activeVoiceNum && a[n] == i; n++, i++) {}
+	if (i >= end) return TSF_NULL;
+	TSF_MEMMOVE(a + n + 1, a + n, (f->activeVoiceNum - n) * sizeof(int));
+	a[n] = i;
+	f->activeVoiceNum++;
+	return &f->voices[i];
+}
+
+// Voices that can be stolen with TSF_STEAL_QUIETEST, in a binary min-heap by level
+struct tsf_steal_candidate { float level; int voice; unsigned int playIndex; };
+
+static void tsf_steal_heap_down(struct tsf_steal_candidate* heap, int heapNum, int i)
+{
+	for (;;)
+	{
+		struct tsf_steal_candidate tmp;
+		int child = 2 * i + 1;
+		if (child >= heapNum) return;
+		if (child + 1 < heapNum && heap[child + 1].level < heap[child].level) child++;
+		if (heap[i].level <= heap[child].level) return;
+		tmp = heap[i]; heap[i] = heap[child]; heap[child] = tmp;
+		i = child;
+	}
+}
+
+static TSF_BOOL tsf_steal_heap_build(tsf* f, unsigned int excludePlayIndex)
+{
+	int i, *a, *aEnd;
+	if (f->stealHeapMax < f->maxVoiceNum)
+	{
+		struct tsf_steal_candidate* newHeap;
+		if (f->realtime) return TSF_FALSE;
+		newHeap = (struct tsf_steal_candidate*)TSF_REALLOC(f->stealHeap, f->maxVoiceNum * sizeof(struct tsf_steal_candidate));
+		if (!newHeap) return TSF_FALSE;
+		f->stealHeap = newHeap;
+		f->stealHeapMax = f->maxVoiceNum;
+	}
+	f->stealHeapNum = 0;
+	for (a = f->activeVoices, aEnd = a + f->activeVoiceNum; a != aEnd && *a < f->maxVoiceNum; a++)
+	{
+		struct tsf_voice* v = &f->voices[*a];
+		struct tsf_steal_candidate* c = &f->stealHeap[f->stealHeapNum];
+		if (v->playingPreset == -1 || v->playIndex == excludePlayIndex) continue;
+		// Estimated amplitude, voices that have not reached their peak yet count with their full gain
+		c->level = (v->ampenv.segment < TSF_SEGMENT_DECAY ? 1.0f : v->ampenv.level) * tsf_decibelsToGain(v->noteGainDB);
+		c->voice = *a;
+		c->playIndex = v->playIndex;
+		f->stealHeapNum++;
+	}
+	for (i = f->stealHeapNum / 2 - 1; i >= 0; i--) tsf_steal_heap_down(f->stealHeap, f->stealHeapNum, i);
+	f->stealHeapValid = TSF_TRUE;
+	return TSF_TRUE;
+}
+
+// Returns the playing voice with the lowest estimated amplitude, or null if there is none
+// that can be stolen. Voices started after the heap was built are only candidates after a
+// rebuild, which happens after rendering or when the heap runs out.
+static struct tsf_voice* tsf_voice_steal_quietest(tsf* f, unsigned int playIndex)
+{
+	int rebuilds = (f->stealHeapValid ? 2 : 1);
+	if (!f->stealHeapValid && !tsf_steal_heap_build(f, playIndex)) return TSF_NULL;
+	for (;;)
+	{
+		while (f->stealHeapNum)
+		{
+			struct tsf_steal_candidate c = f->stealHeap[0];
+			struct tsf_voice* v = &f->voices[c.voice];
+			f->stealHeap[0] = f->stealHeap[--f->stealHeapNum];
+			tsf_steal_heap_down(f->stealHeap, f->stealHeapNum, 0);
+			if (v->playingPreset != -1 && v->playIndex == c.playIndex) return v;
+		}
+		if (!--rebuilds || !tsf_steal_heap_build(f, playIndex)) return TSF_NULL;
+	}
+}
+
+static void tsf_voice_end(tsf* f, struct tsf_voice* v)
+{
+	// if maxVoiceNum is set, assume that voice rendering and note queuing are on separate threads
+	// so to minimize the chance that voice rendering would advance the segment at the same time
+	// we just do it twice here and hope that it sticks
+	int repeats = (f->maxVoiceNum ? 2 : 1);
+	while (repeats--)
+	{
+		tsf_voice_envelope_nextsegment(&v->ampenv, TSF_SEGMENT_SUSTAIN, f->outSampleRate);
+		tsf_voice_envelope_nextsegment(&v->modenv, TSF_SEGMENT_SUSTAIN, f->outSampleRate);
+		if (v->region->loop_mode == TSF_LOOPMODE_SUSTAIN)
+		{
+			// Continue playing, but stop looping.
+			v->loopEnd = v->loopStart;
+		}
+	}
+}
+
+static void tsf_voice_endquick(tsf* f, struct tsf_voice* v)
+{
+	// if maxVoiceNum is set, assume that voice rendering and note queuing are on separate threads
+	// so to minimize the chance that voice rendering would advance the segment at the same time
+	// we just do it twice here and hope that it sticks
+	int repeats = (f->maxVoiceNum ? 2 : 1);
+	while (repeats--)
+	{
+		v->ampenv.parameters.release = 0.0f; tsf_voice_envelope_nextsegment(&v->ampenv, TSF_SEGMENT_SUSTAIN, f->outSampleRate);
+		v->modenv.parameters.release = 0.0f; tsf_voice_envelope_nextsegment(&v->modenv, TSF_SEGMENT_SUSTAIN, f->outSampleRate);
+	}
+}
+
+static void tsf_voice_calcpitchratio(struct tsf_voice* v, float pitchShift, float outSampleRate)
 {
 	double note = v->playingKey + v->region->transpose + v->region->tune / 100.0;
 	double adjustedPitch = v->region->pitch_keycenter + (note - v->region->pitch_keycenter) * (v->region->pitch_keytrack / 100.0);
@@ -1212,12 +2078,291 @@ static void tsf_voice_calcpitchratio(struct tsf_voice* v, float pitchShift, floa
 	v->pitchOutputFactor = v->region->sample_rate / (tsf_timecents2Secsd(v->region->pitch_keycenter * 100.0) * outSampleRate);
 }
 
+static void tsf_render_interpolate_scalar(const float* input, const unsigned int* pos, const unsigned int* nextPos, const float* alpha, float* out, int count)
+{
+	int i;
+	for (i = 0; i != count; i++) out[i] = (input[pos[i]] * (1.0f - alpha[i]) + input[nextPos[i]] * alpha[i]);
+}
+
+// Same value as the conversion of 16-bit samples at load time, (float)(x / 32767.0)
+#define TSF_SHORT2FLOAT(x) ((float)(x) / 32767.0f)
+
+static void tsf_render_interpolate_short_scalar(const short* input, const unsigned int* pos, const unsigned int* nextPos, const float* alpha, float* out, int count)
+{
+	int i;
+	for (i = 0; i != count; i++) out[i] = (TSF_SHORT2FLOAT(input[pos[i]]) * (1.0f - alpha[i]) + TSF_SHORT2FLOAT(input[nextPos[i]]) * alpha[i]);
+}
+
+// Half-precision conversions, rounding to nearest even. Half values become floats with the exponent
+// moved by a shift and an exact multiplication by 2^112, which also handles subnormals (there is no
+// infinity or NaN in sample data).
+static tsf_u16 tsf_float2half(float value)
+{
+	union { float f; tsf_u32 i; } bits, denorm;
+	tsf_u32 sign;
+	bits.f = value;
+	sign = (bits.i >> 16) & 0x8000;
+	bits.i &= 0x7FFFFFFF;
+	if (bits.i >= 0x47800000) return (tsf_u16)(sign | 0x7BFF); // clamp to the largest half
+	if (bits.i < 0x38800000)
+	{
+		// Subnormal, the addition aligns the mantissa and rounds it
+		denorm.i = 126 << 23;
+		bits.f += denorm.f;
+		return (tsf_u16)(sign | (bits.i - denorm.i));
+	}
+	bits.i += ((tsf_u32)(15 - 127) << 23) + 0xFFF + ((bits.i >> 13) & 1);
+	return (tsf_u16)(sign | (bits.i >> 13));
+}
+
+#define TSF_HALF_SCALE 5.192296858534828e+33f // 2^112
+
+static float tsf_half2float(tsf_u16 value)
+{
+	union { float f; tsf_u32 i; } bits;
+	bits.i = (tsf_u32)(value & 0x7FFF) << 13;
+	bits.f *= TSF_HALF_SCALE;
+	bits.i |= (tsf_u32)(value & 0x8000) << 16;
+	return bits.f;
+}
+
+static void tsf_render_interpolate_half_scalar(const tsf_u16* input, const unsigned int* pos, const unsigned int* nextPos, const float* alpha, float* out, int count)
+{
+	int i;
+	for (i = 0; i != count; i++) out[i] = (tsf_half2float(input[pos[i]]) * (1.0f - alpha[i]) + tsf_half2float(input[nextPos[i]]) * alpha[i]);
+}
+
+static void tsf_render_mix_mono_scalar(float* out, const float* in, float gain, int count)
+{
+	int i;
+	for (i = 0; i != count; i++) out[i] += in[i] * gain;
+}
+
+static void tsf_render_mix_interleaved_scalar(float* out, const float* in, float gainLeft, float gainRight, int count)
+{
+	int i;
+	for (i = 0; i != count; i++) { *out++ += in[i] * gainLeft; *out++ += in[i] * gainRight; }
+}
+
+static void tsf_render_mix_unweaved_scalar(float* outL, float* outR, const float* in, float gainLeft, float gainRight, int count)
+{
+	int i;
+	for (i = 0; i != count; i++) { outL[i] += in[i] * gainLeft; outR[i] += in[i] * gainRight; }
+}
+
+static const struct tsf_render_kernels tsf_render_kernels_scalar =
+{
+	&tsf_render_interpolate_scalar, &tsf_render_mix_mono_scalar, &tsf_render_mix_interleaved_scalar, &tsf_render_mix_unweaved_scalar,
+	&tsf_render_interpolate_short_scalar, &tsf_render_interpolate_half_scalar
+};
+
+static struct tsf_render_kernels tsf_render_kernels_active =
+{
+	&tsf_render_interpolate_scalar, &tsf_render_mix_mono_scalar, &tsf_render_mix_interleaved_scalar, &tsf_render_mix_unweaved_scalar,
+	&tsf_render_interpolate_short_scalar, &tsf_render_interpolate_half_scalar
+};
+
+// Interpolation coefficients for TSF_INTERP_PHASES + 1 fractional positions, the taps of each
+// position are stored together, starting at the sample point (taps / 2 - 1) before the position.
+// The windowed-sinc tables have a band for every quarter octave of pitch ratio up to 3 octaves,
+// with the cutoff divided by the ratio of the band so pitched up samples do not alias.
+#define TSF_INTERP_SINC_BANDS 13
+static float tsf_interp_cubic_table[(TSF_INTERP_PHASES + 1) * 4];
+static float tsf_interp_sinc8_table[TSF_INTERP_SINC_BANDS][(TSF_INTERP_PHASES + 1) * 8];
+static float tsf_interp_sinc16_table[TSF_INTERP_SINC_BANDS][(TSF_INTERP_PHASES + 1) * 16];
+static double tsf_interp_sinc_ratios[TSF_INTERP_SINC_BANDS];
+static TSF_BOOL tsf_interp_tables_ready;
+
+static void tsf_interp_sinc_setup(float* table, int taps, double cutoff)
+{
+	int phase, k;
+	for (phase = 0; phase <= TSF_INTERP_PHASES; phase++)
+	{
+		float* coeffs = table + phase * taps;
+		double alpha = (double)phase / TSF_INTERP_PHASES, sum = 0;
+		for (k = 0; k != taps; k++)
+		{
+			// Distance from the tap to the position, Blackman window over the taps
+			double x = k - (taps / 2 - 1) - alpha, w = 0.42 + 0.5 * TSF_COS(2.0 * TSF_PI * x / taps) + 0.08 * TSF_COS(4.0 * TSF_PI * x / taps);
+			double sinc = (x == 0 ? 1.0 : TSF_SIN(TSF_PI * cutoff * x) / (TSF_PI * cutoff * x));
+			coeffs[k] = (float)(sinc * w);
+			sum += coeffs[k];
+		}
+		// Normalize for unity gain at DC
+		for (k = 0; k != taps; k++) coeffs[k] = (float)(coeffs[k] / sum);
+	}
+}
+
+static void tsf_interp_setup_tables(void)
+{
+	int phase, band;
+	if (tsf_interp_tables_ready) return;
+	for (phase = 0; phase <= TSF_INTERP_PHASES; phase++)
+	{
+		float t = (float)phase / TSF_INTERP_PHASES, t2 = t * t, t3 = t2 * t, *coeffs = tsf_interp_cubic_table + phase * 4;
+		coeffs[0] = -0.5f * t3 + t2 - 0.5f * t;
+		coeffs[1] = 1.5f * t3 - 2.5f * t2 + 1.0f;
+		coeffs[2] = -1.5f * t3 + 2.0f * t2 + 0.5f * t;
+		coeffs[3] = 0.5f * t3 - 0.5f * t2;
+	}
+	for (band = 0; band != TSF_INTERP_SINC_BANDS; band++)
+	{
+		double ratio = TSF_POW(2.0, band / 4.0);
+		tsf_interp_sinc_ratios[band] = ratio;
+		tsf_interp_sinc_setup(tsf_interp_sinc8_table[band], 8, 0.9 / ratio);
+		tsf_interp_sinc_setup(tsf_interp_sinc16_table[band], 16, 0.95 / ratio);
+	}
+	tsf_interp_tables_ready = TSF_TRUE;
+}
+
+// Band of the windowed-sinc tables for a pitch ratio, the highest one at or below it
+// (with a margin for the rounding of ratios of whole semitones)
+static int tsf_interp_sinc_band(double pitchRatio)
+{
+	int band = 0;
+	while (band != TSF_INTERP_SINC_BANDS - 1 && pitchRatio * 1.0001 >= tsf_interp_sinc_ratios[band + 1]) band++;
+	return band;
+}
+
+// Sample data indexed by sample index in one of the storage formats, readable from index start to end - 1
+struct tsf_samples { const float* data; const short* dataShort; const tsf_u16* dataHalf; tsf_s64 start, end; };
+
+static void tsf_font_samples(const tsf* f, struct tsf_samples* s)
+{
+	s->data = f->fontSamples;
+	s->dataShort = f->fontSamplesShort;
+	s->dataHalf = f->fontSamplesHalf;
+	s->start = 0;
+	s->end = f->fontSampleCount;
+}
+
+// The sample data of a voice, with tsf_load_memory_inplace_lazy only the decoded range of its sample
+static void tsf_voice_samples(const tsf* f, const struct tsf_voice* v, struct tsf_samples* s)
+{
+	const struct tsf_lazy_sample* lazy;
+	if (!f->lazySamples) { tsf_font_samples(f, s); return; }
+	lazy = &f->lazySamples[v->region->sampleIndex];
+	s->data = f->cachedSamples[v->region->sampleIndex].buffer - lazy->start;
+	s->dataShort = TSF_NULL;
+	s->dataHalf = TSF_NULL;
+	s->start = lazy->start;
+	s->end = lazy->end;
+}
+
+// Sample value at index i in the storage format of the sample data
+static float tsf_sample_value(const struct tsf_samples* s, tsf_s64 i)
+{
+	if (s->dataShort) return TSF_SHORT2FLOAT(s->dataShort[i]);
+	if (s->dataHalf) return tsf_half2float(s->dataHalf[i]);
+	return s->data[i];
+}
+
+// Interpolate with the taps around each position, wrapping around the loop and clamping to the sample data
+static void tsf_interpolate_taps(const struct tsf_samples* s, const float* table, int taps,
+		tsf_s64 loopStart, tsf_s64 loopEnd, TSF_BOOL isLooping, const unsigned int* pos, const float* alpha, float* out, int count)
+{
+	tsf_s64 inputStart = s->start, inputEnd = s->end;
+	int i, k;
+	for (i = 0; i != count; i++)
+	{
+		const float* coeffs = table + (int)(alpha[i] * TSF_INTERP_PHASES + 0.5f) * taps;
+		tsf_s64 first = (tsf_s64)pos[i] - (taps / 2 - 1), last = first + taps - 1;
+		float sum = 0;
+		if (first >= inputStart && last < inputEnd && (!isLooping || last <= loopEnd))
+		{
+			if (s->dataShort)
+			{
+				const short* in = s->dataShort + first;
+				for (k = 0; k != taps; k++) sum += TSF_SHORT2FLOAT(in[k]) * coeffs[k];
+			}
+			else if (s->dataHalf)
+			{
+				const tsf_u16* in = s->dataHalf + first;
+				for (k = 0; k != taps; k++) sum += tsf_half2float(in[k]) * coeffs[k];
+			}
+			else
+			{
+				const float* in = s->data + first;
+				for (k = 0; k != taps; k++) sum += in[k] * coeffs[k];
+			}
+		}
+		else
+		{
+			for (k = 0; k != taps; k++)
+			{
+				tsf_s64 idx = first + k;
+				if (isLooping) while (idx > loopEnd) idx -= (loopEnd - loopStart + 1);
+				sum += tsf_sample_value(s, idx < inputStart ? inputStart : (idx >= inputEnd ? inputEnd - 1 : idx)) * coeffs[k];
+			}
+		}
+		out[i] = sum;
+	}
+}
+
+// Sample values of a voice at the given positions with the interpolation mode of the tsf instance,
+// pitchRatio is the number of sample points per output sample
+static void tsf_voice_interpolate(const tsf* f, const struct tsf_voice* v, const struct tsf_render_kernels* kernels,
+		double pitchRatio, const unsigned int* pos, const unsigned int* nextPos, const float* alpha, float* out, int count)
+{
+	struct tsf_samples s;
+	const float* table;
+	int taps;
+	tsf_voice_samples(f, v, &s);
+	switch (f->interpolation)
+	{
+		case TSF_INTERP_CUBIC:  table = tsf_interp_cubic_table;  taps = 4;  break;
+		case TSF_INTERP_SINC8:  table = tsf_interp_sinc8_table[tsf_interp_sinc_band(pitchRatio)];  taps = 8;  break;
+		case TSF_INTERP_SINC16: table = tsf_interp_sinc16_table[tsf_interp_sinc_band(pitchRatio)]; taps = 16; break;
+		default:
+			if (s.dataShort) (kernels->interpolate_short ? kernels->interpolate_short : &tsf_render_interpolate_short_scalar)(s.dataShort, pos, nextPos, alpha, out, count);
+			else if (s.dataHalf) (kernels->interpolate_half ? kernels->interpolate_half : &tsf_render_interpolate_half_scalar)(s.dataHalf, pos, nextPos, alpha, out, count);
+			else kernels->interpolate(s.data, pos, nextPos, alpha, out, count);
+			return;
+	}
+	tsf_interpolate_taps(&s, table, taps, v->loopStart, v->loopEnd, (v->loopStart < v->loopEnd), pos, alpha, out, count);
+}
+
+// Mix sample values of a voice into the output and advance the output pointers
+// With gain ramping the values are scaled in place by gain + gainStep * i before mixing.
+static void tsf_voice_mix(enum TSFOutputMode outputmode, const struct tsf_render_kernels* kernels, float** outL, float** outR,
+		float* values, int count, float gain, float gainStep, float panFactorLeft, float panFactorRight, TSF_BOOL gainRamp)
+{
+	if (gainRamp)
+	{
+		int i;
+		for (i = 0; i != count; i++) values[i] *= gain + gainStep * i;
+		gain = 1.0f;
+	}
+	switch (outputmode)
+	{
+		case TSF_STEREO_INTERLEAVED:
+			kernels->mix_interleaved(*outL, values, gain * panFactorLeft, gain * panFactorRight, count);
+			*outL += count * 2;
+			break;
+
+		case TSF_STEREO_UNWEAVED:
+			kernels->mix_unweaved(*outL, *outR, values, gain * panFactorLeft, gain * panFactorRight, count);
+			*outL += count;
+			*outR += count;
+			break;
+
+		case TSF_MONO:
+			kernels->mix_mono(*outL, values, gain, count);
+			*outL += count;
+			break;
+	}
+}
+
 static void tsf_voice_render(tsf* f, struct tsf_voice* v, float* outputBuffer, int numSamples)
 {
 	struct tsf_region* region = v->region;
-	float* input = f->fontSamples;
 	float* outL = outputBuffer;
 	float* outR = (f->outputmode == TSF_STEREO_UNWEAVED ? outL + numSamples : TSF_NULL);
+	const struct tsf_render_kernels* kernels = f->renderKernels;
+
+	// Sample positions and values of the current block, processed by the render kernels.
+	unsigned int blockPos[TSF_RENDER_EFFECTSAMPLEBLOCK], blockNextPos[TSF_RENDER_EFFECTSAMPLEBLOCK];
+	float blockAlpha[TSF_RENDER_EFFECTSAMPLEBLOCK], blockVal[TSF_RENDER_EFFECTSAMPLEBLOCK];
 
 	// Cache some values, to give them at least some chance of ending up in registers.
 	TSF_BOOL updateModEnv = (region->modEnvToPitch || region->modEnvToFilterFc);
@@ -1227,7 +2372,13 @@ static void tsf_voice_render(tsf* f, struct tsf_voice* v, float* outputBuffer, i
 	unsigned int tmpLoopStart = v->loopStart, tmpLoopEnd = v->loopEnd;
 	double tmpSampleEndDbl = (double)region->end, tmpLoopEndDbl = (double)tmpLoopEnd + 1.0;
 	double tmpSourceSamplePosition = v->sourceSamplePosition;
+	TSF_BOOL fixedPointPhase = (TSF_BOOL)f->fixedPointPhase, sampleEnded, gainRamp = f->gainRamp;
+	int effectSampleBlock = f->effectSampleBlock;
+	tsf_u64 tmpSampleEndPhase = (tsf_u64)region->end << 32, tmpLoopEndPhase = ((tsf_u64)tmpLoopEnd + 1) << 32;
+	tsf_u64 tmpLoopLengthPhase = ((tsf_u64)(tmpLoopEnd - tmpLoopStart) + 1) << 32, tmpSourceSamplePhase = v->sourceSamplePhase;
 	struct tsf_voice_lowpass tmpLowpass = v->lowpass;
+	struct tsf_voice_lowpassf tmpLowpassF;
+	TSF_BOOL floatFilters = f->floatFilters;
 
 	TSF_BOOL dynamicLowpass = (region->modLfoToFilterFc || region->modEnvToFilterFc);
 	float tmpSampleRate = f->outSampleRate, tmpInitialFilterFc, tmpModLfoToFilterFc, tmpModEnvToFilterFc;
@@ -1248,10 +2399,12 @@ static void tsf_voice_render(tsf* f, struct tsf_voice* v, float* outputBuffer, i
 	if (dynamicGain) tmpModLfoToVolume = (float)region->modLfoToVolume * 0.1f;
 	else noteGain = tsf_decibelsToGain(v->noteGainDB), tmpModLfoToVolume = 0;
 
+	if (floatFilters) tsf_voice_lowpassf_load(&tmpLowpassF, &tmpLowpass);
+
 	while (numSamples)
 	{
-		float gainMono, gainLeft, gainRight;
-		int blockSamples = (numSamples > TSF_RENDER_EFFECTSAMPLEBLOCK ? TSF_RENDER_EFFECTSAMPLEBLOCK : numSamples);
+		float gainMono, gainStep = 0;
+		int i, blockCount, chunkSamples, blockSamples = (numSamples > effectSampleBlock ? effectSampleBlock : numSamples);
 		numSamples -= blockSamples;
 
 		if (dynamicLowpass)
@@ -1259,7 +2412,11 @@ static void tsf_voice_render(tsf* f, struct tsf_voice* v, float* outputBuffer, i
 			float fres = tmpInitialFilterFc + v->modlfo.level * tmpModLfoToFilterFc + v->modenv.level * tmpModEnvToFilterFc;
 			float lowpassFc = (fres <= 13500 ? tsf_cents2Hertz(fres) / tmpSampleRate : 1.0f);
 			tmpLowpass.active = (lowpassFc < 0.499f);
-			if (tmpLowpass.active) tsf_voice_lowpass_setup(&tmpLowpass, lowpassFc);
+			if (tmpLowpass.active)
+			{
+				if (floatFilters) tsf_voice_lowpassf_setup(&tmpLowpassF, (float)tmpLowpass.QInv, lowpassFc);
+				else tsf_voice_lowpass_setup(&tmpLowpass, lowpassFc);
+			}
 		}
 
 		if (dynamicPitchRatio)
@@ -1278,71 +2435,63 @@ static void tsf_voice_render(tsf* f, struct tsf_voice* v, float* outputBuffer, i
 		if (updateModLFO) tsf_voice_lfo_process(&v->modlfo, blockSamples);
 		if (updateVibLFO) tsf_voice_lfo_process(&v->viblfo, blockSamples);
 
-		switch (f->outputmode)
-		{
-			case TSF_STEREO_INTERLEAVED:
-				gainLeft = gainMono * v->panFactorLeft, gainRight = gainMono * v->panFactorRight;
-				while (blockSamples-- && tmpSourceSamplePosition < tmpSampleEndDbl)
-				{
-					unsigned int pos = (unsigned int)tmpSourceSamplePosition, nextPos = (pos >= tmpLoopEnd && isLooping ? tmpLoopStart : pos + 1);
-
-					// Simple linear interpolation.
-					float alpha = (float)(tmpSourceSamplePosition - pos), val = (input[pos] * (1.0f - alpha) + input[nextPos] * alpha);
+		// Ramp to the gain at the start of the next block.
+		if (gainRamp)
+			gainStep = ((dynamicGain ? tsf_decibelsToGain(v->noteGainDB + (v->modlfo.level * tmpModLfoToVolume)) : noteGain) * v->ampenv.level - gainMono) / blockSamples;
 
-					// Low-pass filter.
-					if (tmpLowpass.active) val = tsf_voice_lowpass_process(&tmpLowpass, val);
+		// Process the block in chunks that fit the sample position and value buffers.
+		for (sampleEnded = TSF_FALSE; blockSamples && !sampleEnded; blockSamples -= chunkSamples)
+		{
+			chunkSamples = (blockSamples > TSF_RENDER_EFFECTSAMPLEBLOCK ? TSF_RENDER_EFFECTSAMPLEBLOCK : blockSamples);
 
-					*outL++ += val * gainLeft;
-					*outL++ += val * gainRight;
+			// Sample positions of this chunk (stops early when reaching the end of the sample).
+			if (fixedPointPhase)
+			{
+				// Integer phase with 32 fractional bits, the top 24 of which are used for alpha.
+				tsf_u64 phaseIncrement = (tsf_u64)(pitchRatio * 4294967296.0 + 0.5);
+				for (blockCount = 0; blockCount != chunkSamples && tmpSourceSamplePhase < tmpSampleEndPhase; blockCount++)
+				{
+					unsigned int pos = (unsigned int)(tmpSourceSamplePhase >> 32);
+					blockPos[blockCount] = pos;
+					blockNextPos[blockCount] = (pos >= tmpLoopEnd && isLooping ? tmpLoopStart : pos + 1);
+					blockAlpha[blockCount] = (float)((tsf_u32)tmpSourceSamplePhase >> 8) * (1.0f / 16777216.0f);
 
 					// Next sample.
-					tmpSourceSamplePosition += pitchRatio;
-					if (tmpSourceSamplePosition >= tmpLoopEndDbl && isLooping) tmpSourceSamplePosition -= (tmpLoopEnd - tmpLoopStart + 1.0);
+					tmpSourceSamplePhase += phaseIncrement;
+					if (tmpSourceSamplePhase >= tmpLoopEndPhase && isLooping) tmpSourceSamplePhase -= tmpLoopLengthPhase;
 				}
-				break;
-
-			case TSF_STEREO_UNWEAVED:
-				gainLeft = gainMono * v->panFactorLeft, gainRight = gainMono * v->panFactorRight;
-				while (blockSamples-- && tmpSourceSamplePosition < tmpSampleEndDbl)
+				sampleEnded = (tmpSourceSamplePhase >= tmpSampleEndPhase);
+			}
+			else
+			{
+				for (blockCount = 0; blockCount != chunkSamples && tmpSourceSamplePosition < tmpSampleEndDbl; blockCount++)
 				{
-					unsigned int pos = (unsigned int)tmpSourceSamplePosition, nextPos = (pos >= tmpLoopEnd && isLooping ? tmpLoopStart : pos + 1);
-
-					// Simple linear interpolation.
-					float alpha = (float)(tmpSourceSamplePosition - pos), val = (input[pos] * (1.0f - alpha) + input[nextPos] * alpha);
-
-					// Low-pass filter.
-					if (tmpLowpass.active) val = tsf_voice_lowpass_process(&tmpLowpass, val);
-
-					*outL++ += val * gainLeft;
-					*outR++ += val * gainRight;
+					unsigned int pos = (unsigned int)tmpSourceSamplePosition;
+					blockPos[blockCount] = pos;
+					blockNextPos[blockCount] = (pos >= tmpLoopEnd && isLooping ? tmpLoopStart : pos + 1);
+					blockAlpha[blockCount] = (float)(tmpSourceSamplePosition - pos);
 
 					// Next sample.
 					tmpSourceSamplePosition += pitchRatio;
 					if (tmpSourceSamplePosition >= tmpLoopEndDbl && isLooping) tmpSourceSamplePosition -= (tmpLoopEnd - tmpLoopStart + 1.0);
 				}
-				break;
-
-			case TSF_MONO:
-				while (blockSamples-- && tmpSourceSamplePosition < tmpSampleEndDbl)
-				{
-					unsigned int pos = (unsigned int)tmpSourceSamplePosition, nextPos = (pos >= tmpLoopEnd && isLooping ? tmpLoopStart : pos + 1);
-
-					// Simple linear interpolation.
-					float alpha = (float)(tmpSourceSamplePosition - pos), val = (input[pos] * (1.0f - alpha) + input[nextPos] * alpha);
+				sampleEnded = (tmpSourceSamplePosition >= tmpSampleEndDbl);
+			}
 
-					// Low-pass filter.
-					if (tmpLowpass.active) val = tsf_voice_lowpass_process(&tmpLowpass, val);
+			// Interpolate sample values (linear by default).
+			tsf_voice_interpolate(f, v, kernels, pitchRatio, blockPos, blockNextPos, blockAlpha, blockVal, blockCount);
 
-					*outL++ += val * gainMono;
+			// Low-pass filter.
+			if (tmpLowpass.active && floatFilters)
+				tsf_voice_lowpassf_process(&tmpLowpassF, blockVal, blockCount);
+			else if (tmpLowpass.active)
+				for (i = 0; i != blockCount; i++) blockVal[i] = tsf_voice_lowpass_process(&tmpLowpass, blockVal[i]);
 
-					// Next sample.
-					tmpSourceSamplePosition += pitchRatio;
-					if (tmpSourceSamplePosition >= tmpLoopEndDbl && isLooping) tmpSourceSamplePosition -= (tmpLoopEnd - tmpLoopStart + 1.0);
-				}
-				break;
+			tsf_voice_mix(f->outputmode, kernels, &outL, &outR, blockVal, blockCount, gainMono, gainStep, v->panFactorLeft, v->panFactorRight, gainRamp);
+			if (gainRamp) gainMono += gainStep * blockCount;
 		}
 
-		if (tmpSourceSamplePosition >= tmpSampleEndDbl || v->ampenv.segment == TSF_SEGMENT_DONE)
+		if (sampleEnded || v->ampenv.segment == TSF_SEGMENT_DONE)
 		{
 			tsf_voice_kill(v);
 			return;
@@ -1350,10 +2499,14 @@ static void tsf_voice_render(tsf* f, struct tsf_voice* v, float* outputBuffer, i
 	}
 
 	v->sourceSamplePosition = tmpSourceSamplePosition;
+	v->sourceSamplePhase = tmpSourceSamplePhase;
+	if (floatFilters) tsf_voice_lowpassf_store(&tmpLowpassF, &tmpLowpass);
 	if (tmpLowpass.active || dynamicLowpass) v->lowpass = tmpLowpass;
 }
 
-TSFDEF tsf* tsf_load(struct tsf_stream* stream)
+// With inplace (the memory stream of stream), the sample data is used or decoded without copying it,
+// and with lazy compressed samples are left in it to be decoded by tsf_sample_cache_get
+static tsf* tsf_load_stream(struct tsf_stream* stream, struct tsf_stream_memory* inplace, TSF_BOOL lazy)
 {
 	tsf* res = TSF_NULL;
 	struct tsf_riffchunk chunkHead;
@@ -1361,8 +2514,16 @@ TSFDEF tsf* tsf_load(struct tsf_stream* stream)
 	struct tsf_hydra hydra;
 	void* rawBuffer = TSF_NULL;
 	float* floatBuffer = TSF_NULL;
+	const char* inplaceBuffer = TSF_NULL;
+	const short* shortBuffer = TSF_NULL;
+	struct tsf_lazy_sample* lazySamples = TSF_NULL;
+	TSF_BOOL inplaceOgg = TSF_FALSE;
 	tsf_u32 smplCount = 0;
 
+	#ifdef TSF_FASTMATH
+	tsf_fastmath_setup();
+	#endif
+
 	if (!tsf_riffchunk_read(TSF_NULL, &chunkHead, stream) || !TSF_FourCCEquals(chunkHead.id, "sfbk"))
 	{
 		//if (e) *e = TSF_INVALID_NOSF2HEADER;
@@ -1407,9 +2568,17 @@ TSFDEF tsf* tsf_load(struct tsf_stream* stream)
 						#ifdef STB_VORBIS_INCLUDE_STB_VORBIS_H
 						|| TSF_FourCCEquals(chunk.id, "smpo")
 						#endif
-					) && !rawBuffer && !floatBuffer && chunk.size >= sizeof(short))
+					) && !rawBuffer && !floatBuffer && !inplaceBuffer && chunk.size >= sizeof(short))
 				{
-					if (!tsf_load_samples(&rawBuffer, &floatBuffer, &smplCount, &chunk, stream)) goto out_of_memory;
+					// 16-bit samples can only be read in place if they are aligned
+					if (inplace && !((size_t)(inplace->buffer + inplace->pos) & 1) && inplace->pos + chunk.size <= inplace->total)
+					{
+						inplaceBuffer = inplace->buffer + inplace->pos;
+						inplaceOgg = (chunk.id[3] == 'o');
+						smplCount = chunk.size;
+						stream->skip(stream->data, chunk.size);
+					}
+					else if (!tsf_load_samples(&rawBuffer, &floatBuffer, &smplCount, &chunk, stream)) goto out_of_memory;
 				}
 				else stream->skip(stream->data, chunk.size);
 			}
@@ -1420,21 +2589,58 @@ TSFDEF tsf* tsf_load(struct tsf_stream* stream)
 	{
 		//if (e) *e = TSF_INVALID_INCOMPLETE;
 	}
-	else if (!rawBuffer && !floatBuffer)
+	else if (!rawBuffer && !floatBuffer && !inplaceBuffer)
 	{
 		//if (e) *e = TSF_INVALID_NOSAMPLEDATA;
 	}
 	else
 	{
+		if (inplaceBuffer)
+		{
+			#ifdef STB_VORBIS_INCLUDE_STB_VORBIS_H
+			#ifdef TSF_OGG_PULL
+			if (lazy && (inplaceOgg || tsf_has_compressed_samples(&hydra)))
+			{
+				if (!tsf_layout_samples(inplaceBuffer, inplaceOgg, &smplCount, &hydra, &lazySamples)) goto out_of_memory;
+			}
+			else
+			#endif
+			if (inplaceOgg)
+			{
+				if (!tsf_decode_sfo_samples(inplaceBuffer, &floatBuffer, &smplCount)) goto out_of_memory;
+			}
+			else if (tsf_has_compressed_samples(&hydra))
+			{
+				if (!tsf_decode_sf3_samples(inplaceBuffer, &floatBuffer, &smplCount, &hydra)) goto out_of_memory;
+			}
+			else
+			#endif
+			{
+				shortBuffer = (const short*)inplaceBuffer;
+				smplCount /= (tsf_u32)sizeof(short);
+			}
+		}
 		#ifdef STB_VORBIS_INCLUDE_STB_VORBIS_H
-		if (!floatBuffer && !tsf_decode_sf3_samples(rawBuffer, &floatBuffer, &smplCount, &hydra)) goto out_of_memory;
+		else if (!floatBuffer && !tsf_decode_sf3_samples(rawBuffer, &floatBuffer, &smplCount, &hydra)) goto out_of_memory;
 		#endif
 		res = (tsf*)TSF_MALLOC(sizeof(tsf));
 		if (res) TSF_MEMSET(res, 0, sizeof(tsf));
 		if (!res || !tsf_load_presets(res, &hydra, smplCount)) goto out_of_memory;
 		res->outSampleRate = 44100.0f;
+		res->effectSampleBlock = TSF_RENDER_EFFECTSAMPLEBLOCK;
 		res->fontSamples = floatBuffer;
+		res->fontSamplesShort = shortBuffer;
+		res->fontSampleCount = smplCount;
+		res->sampleCacheMax = TSF_SAMPLE_CACHE_DEFAULT;
 		floatBuffer = TSF_NULL; // don't free below
+		if (lazySamples)
+		{
+			res->lazySampleNum = hydra.shdrNum;
+			tsf_lazy_ranges(res, lazySamples);
+			if (!(res->cachedSamples = tsf_sample_cache_create(res->lazySampleNum))) goto out_of_memory;
+			res->lazySamples = lazySamples;
+			lazySamples = TSF_NULL;
+		}
 	}
 	if (0)
 	{
@@ -1447,9 +2653,42 @@ TSFDEF tsf* tsf_load(struct tsf_stream* stream)
 	TSF_FREE(hydra.pgens); TSF_FREE(hydra.insts); TSF_FREE(hydra.ibags);
 	TSF_FREE(hydra.imods); TSF_FREE(hydra.igens); TSF_FREE(hydra.shdrs);
 	TSF_FREE(rawBuffer);   TSF_FREE(floatBuffer);
+	TSF_FREE(lazySamples);
 	return res;
 }
 
+TSFDEF tsf* tsf_load(struct tsf_stream* stream)
+{
+	return tsf_load_stream(stream, TSF_NULL, TSF_FALSE);
+}
+
+static tsf* tsf_load_inplace(const void* buffer, int size, void (*release)(void* data), void* release_data, TSF_BOOL lazy)
+{
+	tsf* res;
+	struct tsf_stream stream = { TSF_NULL, (int(*)(void*,void*,unsigned int))&tsf_stream_memory_read, (int(*)(void*,unsigned int))&tsf_stream_memory_skip };
+	struct tsf_stream_memory f = { 0, 0, 0 };
+	f.buffer = (const char*)buffer;
+	f.total = size;
+	stream.data = &f;
+	res = tsf_load_stream(&stream, &f, lazy);
+	if (res)
+	{
+		res->fontRelease = release;
+		res->fontReleaseData = release_data;
+	}
+	return res;
+}
+
+TSFDEF tsf* tsf_load_memory_inplace(const void* buffer, int size, void (*release)(void* data), void* release_data)
+{
+	return tsf_load_inplace(buffer, size, release, release_data, TSF_FALSE);
+}
+
+TSFDEF tsf* tsf_load_memory_inplace_lazy(const void* buffer, int size, void (*release)(void* data), void* release_data)
+{
+	return tsf_load_inplace(buffer, size, release, release_data, TSF_TRUE);
+}
+
 TSFDEF tsf* tsf_copy(tsf* f)
 {
 	tsf* res;
@@ -1464,9 +2703,24 @@ TSFDEF tsf* tsf_copy(tsf* f)
 	if (!res) return TSF_NULL;
 	TSF_MEMCPY(res, f, sizeof(tsf));
 	res->voices = TSF_NULL;
+	res->activeVoices = TSF_NULL;
+	res->voiceIndex = TSF_NULL;
+	res->stealHeap = TSF_NULL;
+	res->stealHeapNum = res->stealHeapMax = 0;
+	res->stealHeapValid = TSF_FALSE;
+	res->stolenVoiceCount = res->droppedVoiceCount = 0;
 	res->voiceNum = 0;
+	res->activeVoiceNum = 0;
 	res->channels = TSF_NULL;
+	res->spareChannels = TSF_NULL;
+	res->realtime = TSF_FALSE;
+	res->cachedSamples = TSF_NULL;
+	TSF_MEMSET(&res->sampleCacheStats, 0, sizeof(res->sampleCacheStats));
 	(*res->refCount)++;
+	// Decoded samples are not shared, so copies never change what another one renders
+	if (res->lazySamples && !(res->cachedSamples = tsf_sample_cache_create(res->lazySampleNum))) { tsf_close(res); return TSF_NULL; }
+	// The copy gets its own voices up to the same maximum, otherwise it could never play a note
+	if (res->maxVoiceNum && !tsf_set_max_voices(res, res->maxVoiceNum)) { tsf_close(res); return TSF_NULL; }
 	return res;
 }
 
@@ -1479,20 +2733,129 @@ TSFDEF void tsf_close(tsf* f)
 		for (; preset != presetEnd; preset++) TSF_FREE(preset->regions);
 		TSF_FREE(f->presets);
 		TSF_FREE(f->fontSamples);
+		TSF_FREE(f->fontSampleStorage);
+		TSF_FREE((void*)f->lazySamples);
+		if (f->fontRelease) f->fontRelease(f->fontReleaseData);
 		TSF_FREE(f->refCount);
 	}
+	if (f->cachedSamples)
+	{
+		int i;
+		for (i = 0; i != f->lazySampleNum; i++) TSF_FREE(f->cachedSamples[i].buffer);
+		TSF_FREE(f->cachedSamples);
+	}
 	TSF_FREE(f->channels);
+	TSF_FREE(f->spareChannels);
 	TSF_FREE(f->voices);
+	TSF_FREE(f->activeVoices);
+	TSF_FREE(f->voiceIndex);
+	TSF_FREE(f->stealHeap);
 	TSF_FREE(f);
 }
 
+TSFDEF int tsf_set_sample_format(tsf* f, enum TSFSampleFormat format)
+{
+	unsigned int i, count = f->fontSampleCount;
+	struct tsf_samples s;
+	if (format == tsf_get_sample_format(f)) return 1;
+	if ((f->refCount && *f->refCount > 1) || f->lazySamples) return 0;
+	tsf_font_samples(f, &s);
+	if (format == TSF_SAMPLES_FLOAT)
+	{
+		float* samples = (float*)TSF_MALLOC(count * sizeof(float));
+		if (!samples) return 0;
+		for (i = 0; i != count; i++) samples[i] = tsf_sample_value(&s, i);
+		f->fontSamples = samples;
+		f->fontSamplesShort = TSF_NULL;
+		f->fontSamplesHalf = TSF_NULL;
+	}
+	else
+	{
+		// One more element at the start, so kernels can read input[-1]
+		tsf_u16* storage = (tsf_u16*)TSF_MALLOC((count + 1) * sizeof(tsf_u16));
+		if (!storage) return 0;
+		storage[0] = 0;
+		for (i = 0; i != count; i++)
+		{
+			float value = tsf_sample_value(&s, i);
+			if (format == TSF_SAMPLES_HALF) storage[i + 1] = tsf_float2half(value);
+			else
+			{
+				// Rounded, so 16-bit SoundFont samples converted to float at load time get their original value
+				double x = value * 32767.0;
+				x = (x > 32767.0 ? 32767.0 : (x < -32768.0 ? -32768.0 : x));
+				storage[i + 1] = (tsf_u16)(short)(x < 0 ? x - 0.5 : x + 0.5);
+			}
+		}
+		f->fontSamplesShort = (format == TSF_SAMPLES_SHORT ? (const short*)(storage + 1) : TSF_NULL);
+		f->fontSamplesHalf = (format == TSF_SAMPLES_HALF ? storage + 1 : TSF_NULL);
+		TSF_FREE(f->fontSamples);
+		f->fontSamples = TSF_NULL;
+		TSF_FREE(f->fontSampleStorage);
+		f->fontSampleStorage = storage;
+		return 1;
+	}
+	TSF_FREE(f->fontSampleStorage);
+	f->fontSampleStorage = TSF_NULL;
+	return 1;
+}
+
+TSFDEF enum TSFSampleFormat tsf_get_sample_format(tsf* f)
+{
+	return (f->fontSamplesShort ? TSF_SAMPLES_SHORT : (f->fontSamplesHalf ? TSF_SAMPLES_HALF : TSF_SAMPLES_FLOAT));
+}
+
+TSFDEF void tsf_set_sample_cache(tsf* f, unsigned long long max_bytes)
+{
+	f->sampleCacheMax = max_bytes;
+	if (f->lazySamples) tsf_sample_cache_trim(f, f->voicePlayIndex++);
+}
+
+TSFDEF int tsf_decode_presets(tsf* f, const int* preset_indices, int count)
+{
+	const struct tsf_region *region, *regionEnd;
+	unsigned int tick = f->voicePlayIndex++;
+	int i, res = 1;
+	if (!f->lazySamples) return 1;
+	for (i = 0; i != count; i++)
+	{
+		if (preset_indices[i] < 0 || preset_indices[i] >= f->presetNum) continue;
+		region = f->presets[preset_indices[i]].regions;
+		for (regionEnd = region + f->presets[preset_indices[i]].regionNum; region != regionEnd; region++)
+			if (!tsf_sample_cache_get(f, region->sampleIndex, tick, TSF_FALSE)) res = 0;
+	}
+	return res;
+}
+
+TSFDEF void tsf_get_sample_cache_stats(const tsf* f, struct tsf_sample_cache_stats* stats)
+{
+	*stats = f->sampleCacheStats;
+}
+
 TSFDEF void tsf_reset(tsf* f)
 {
-	struct tsf_voice *v = f->voices, *vEnd = v + f->voiceNum;
-	for (; v != vEnd; v++)
-		if (v->playingPreset != -1 && (v->ampenv.segment < TSF_SEGMENT_RELEASE || v->ampenv.parameters.release))
+	struct tsf_voice *v; int *a, *aEnd;
+	for (a = f->activeVoices, aEnd = a + f->activeVoiceNum; a != aEnd; a++)
+		if ((v = &f->voices[*a])->playingPreset != -1 && (v->ampenv.segment < TSF_SEGMENT_RELEASE || v->ampenv.parameters.release))
 			tsf_voice_endquick(f, v);
-	if (f->channels) { TSF_FREE(f->channels); f->channels = TSF_NULL; }
+	// Keep the channel storage for later channel functions (spareChannels is null while channels is set)
+	if (f->channels) { f->spareChannels = f->channels; f->channels = TSF_NULL; }
+}
+
+TSFDEF void tsf_restart(tsf* f, unsigned int voicePlayIndex)
+{
+	// Voices are taken from the lowest free index and kept in index order, so freeing them all
+	// without a release gives the same voice order as a new copy
+	int i;
+	for (i = 0; i != f->voiceNum; i++) f->voices[i].playingPreset = -1;
+	f->activeVoiceNum = 0;
+	f->voicePlayIndex = voicePlayIndex;
+	TSF_FREE(f->voiceIndex);
+	f->voiceIndex = TSF_NULL;
+	f->stealHeapNum = 0;
+	f->stealHeapValid = TSF_FALSE;
+	f->stolenVoiceCount = f->droppedVoiceCount = 0;
+	if (f->channels) { TSF_FREE(f->spareChannels); f->spareChannels = f->channels; f->channels = TSF_NULL; }
 }
 
 TSFDEF int tsf_get_presetindex(const tsf* f, int bank, int preset_number)
@@ -1532,19 +2895,167 @@ TSFDEF void tsf_set_volume(tsf* f, float global_volume)
 	f->globalGainDB = (global_volume == 1.0f ? 0 : -tsf_gainToDecibels(1.0f / global_volume));
 }
 
-TSFDEF int tsf_set_max_voices(tsf* f, int max_voices)
+static int tsf_voices_resize(tsf* f, int newVoiceNum)
 {
 	int i = f->voiceNum;
-	int newVoiceNum = (f->voiceNum > max_voices ? f->voiceNum : max_voices);
-	struct tsf_voice *newVoices = (struct tsf_voice*)TSF_REALLOC(f->voices, newVoiceNum * sizeof(struct tsf_voice));
+	struct tsf_voice *newVoices;
+	int *newActiveVoices = (int*)TSF_REALLOC(f->activeVoices, newVoiceNum * sizeof(int));
+	if (!newActiveVoices) return 0;
+	f->activeVoices = newActiveVoices;
+	newVoices = (struct tsf_voice*)TSF_REALLOC(f->voices, newVoiceNum * sizeof(struct tsf_voice));
 	if (!newVoices) return 0;
 	f->voices = newVoices;
-	f->voiceNum = f->maxVoiceNum = newVoiceNum;
-	for (; i < max_voices; i++)
+	f->voiceNum = newVoiceNum;
+	for (; i < newVoiceNum; i++)
 		f->voices[i].playingPreset = -1;
 	return 1;
 }
 
+TSFDEF int tsf_set_max_voices(tsf* f, int max_voices)
+{
+	// The voices after the first maxVoiceNum are reserved for the fade out of stolen voices.
+	// Without a maximum yet, it cannot be lower than the voices in the active list.
+	int i, usedVoiceNum = f->maxVoiceNum, newMaxVoiceNum;
+	if (!usedVoiceNum)
+		for (i = 0; i != f->activeVoiceNum; i++)
+			if (f->activeVoices[i] >= usedVoiceNum) usedVoiceNum = f->activeVoices[i] + 1;
+	newMaxVoiceNum = (usedVoiceNum > max_voices ? usedVoiceNum : max_voices);
+	if (!tsf_voices_resize(f, newMaxVoiceNum + TSF_STEAL_FADEVOICES)) return 0;
+	f->maxVoiceNum = newMaxVoiceNum;
+	f->stealHeapValid = TSF_FALSE;
+	return 1;
+}
+
+TSFDEF void tsf_set_voice_stealing(tsf* f, enum TSFVoiceStealing policy)
+{
+	f->voiceStealing = policy;
+}
+
+TSFDEF void tsf_set_fixedpoint_phase(tsf* f, int flag_fixedpoint)
+{
+	struct tsf_voice *v; int *a, *aEnd;
+	if (!flag_fixedpoint == !f->fixedPointPhase) return;
+	for (a = f->activeVoices, aEnd = a + f->activeVoiceNum; a != aEnd; a++)
+	{
+		v = &f->voices[*a];
+		if (v->playingPreset == -1) continue;
+		if (flag_fixedpoint) v->sourceSamplePhase = (tsf_u64)(v->sourceSamplePosition * 4294967296.0);
+		else v->sourceSamplePosition = (double)(v->sourceSamplePhase >> 32) + (double)(tsf_u32)v->sourceSamplePhase / 4294967296.0;
+	}
+	f->fixedPointPhase = (flag_fixedpoint != 0);
+}
+
+TSFDEF void tsf_set_interpolation(tsf* f, enum TSFInterpolation interpolation)
+{
+	if (interpolation != TSF_INTERP_LINEAR) tsf_interp_setup_tables();
+	f->interpolation = interpolation;
+}
+
+TSFDEF void tsf_set_effect_block(tsf* f, int block_size, int flag_gain_ramp)
+{
+	f->effectSampleBlock = (block_size >= 1 ? block_size : TSF_RENDER_EFFECTSAMPLEBLOCK);
+	f->gainRamp = (flag_gain_ramp != 0);
+}
+
+TSFDEF void tsf_set_float_filters(tsf* f, int flag_float)
+{
+	if (flag_float) tsf_lowpass_setup_table();
+	f->floatFilters = (flag_float != 0);
+}
+
+TSFDEF void tsf_set_render_threads(tsf* f, int threads)
+{
+	f->renderThreads = (threads > 1 ? threads : 1);
+}
+
+static int tsf_voice_index_init(tsf* f)
+{
+	int i;
+	if (f->voiceIndex) return 1;
+	f->voiceIndex = (int*)TSF_MALLOC((TSF_VOICE_INDEXSIZE + TSF_VOICE_GROUPSIZE) * sizeof(int));
+	if (!f->voiceIndex) return 0;
+	for (i = 0; i != TSF_VOICE_INDEXSIZE + TSF_VOICE_GROUPSIZE; i++) f->voiceIndex[i] = -1;
+	return 1;
+}
+
+static void tsf_channel_setup_voice(tsf* f, struct tsf_voice* v);
+
+// Grow channel storage to hold at least channelMax channels, storage can be null
+static int tsf_channels_reserve(struct tsf_channels** channels, int channelMax)
+{
+	struct tsf_channels* res;
+	if (*channels && (*channels)->channelMax >= channelMax) return 1;
+	res = (struct tsf_channels*)TSF_REALLOC(*channels, sizeof(struct tsf_channels) + sizeof(struct tsf_channel) * (channelMax - 1));
+	if (!res) return 0;
+	if (!*channels)
+	{
+		res->setupVoice = &tsf_channel_setup_voice;
+		res->channelNum = 0;
+		res->activeChannel = 0;
+	}
+	res->channelMax = channelMax;
+	*channels = res;
+	return 1;
+}
+
+TSFDEF int tsf_reserve(tsf* f, int voices, int channels)
+{
+	if (!tsf_voice_index_init(f)) return 0;
+	if (!f->maxVoiceNum && voices > f->voiceNum && !tsf_voices_resize(f, voices)) return 0;
+	if (f->stealHeapMax < f->maxVoiceNum)
+	{
+		struct tsf_steal_candidate* newHeap = (struct tsf_steal_candidate*)TSF_REALLOC(f->stealHeap, f->maxVoiceNum * sizeof(struct tsf_steal_candidate));
+		if (!newHeap) return 0;
+		f->stealHeap = newHeap;
+		f->stealHeapMax = f->maxVoiceNum;
+	}
+	if (channels > 0 && !tsf_channels_reserve(f->channels ? &f->channels : &f->spareChannels, channels)) return 0;
+	return 1;
+}
+
+TSFDEF int tsf_voice_storage_alloc(struct tsf_voice_storage* storage, int voices)
+{
+	storage->voices = (struct tsf_voice*)TSF_MALLOC(voices * sizeof(struct tsf_voice));
+	storage->activeVoices = (int*)TSF_MALLOC(voices * sizeof(int));
+	storage->voiceNum = voices;
+	if (storage->voices && storage->activeVoices) return 1;
+	tsf_voice_storage_free(storage);
+	return 0;
+}
+
+TSFDEF void tsf_voice_storage_free(struct tsf_voice_storage* storage)
+{
+	TSF_FREE(storage->voices);
+	TSF_FREE(storage->activeVoices);
+	storage->voices = TSF_NULL;
+	storage->activeVoices = TSF_NULL;
+	storage->voiceNum = 0;
+}
+
+TSFDEF int tsf_swap_voices(tsf* f, struct tsf_voice_storage* storage)
+{
+	struct tsf_voice_storage old;
+	int i;
+	if (f->maxVoiceNum || storage->voiceNum <= f->voiceNum) return 0;
+	// Same contents as tsf_voices_resize leaves, voices are referenced by index only
+	if (f->voiceNum) TSF_MEMCPY(storage->voices, f->voices, f->voiceNum * sizeof(struct tsf_voice));
+	if (f->activeVoiceNum) TSF_MEMCPY(storage->activeVoices, f->activeVoices, f->activeVoiceNum * sizeof(int));
+	for (i = f->voiceNum; i != storage->voiceNum; i++) storage->voices[i].playingPreset = -1;
+	old.voices = f->voices;
+	old.activeVoices = f->activeVoices;
+	old.voiceNum = f->voiceNum;
+	f->voices = storage->voices;
+	f->activeVoices = storage->activeVoices;
+	f->voiceNum = storage->voiceNum;
+	*storage = old;
+	return 1;
+}
+
+TSFDEF void tsf_set_realtime(tsf* f, int flag_realtime)
+{
+	f->realtime = (flag_realtime != 0);
+}
+
 TSFDEF int tsf_note_on(tsf* f, int preset_index, int key, float vel)
 {
 	short midiVelocity = (short)(vel * 127);
@@ -1554,30 +3065,54 @@ TSFDEF int tsf_note_on(tsf* f, int preset_index, int key, float vel)
 	if (preset_index < 0 || preset_index >= f->presetNum) return 1;
 	if (vel <= 0.0f) { tsf_note_off(f, preset_index, key); return 1; }
 
+	if (!f->voiceIndex && (f->realtime || !tsf_voice_index_init(f))) return 0;
+
 	// Play all matching regions.
 	voicePlayIndex = f->voicePlayIndex++;
 	for (region = f->presets[preset_index].regions, regionEnd = region + f->presets[preset_index].regionNum; region != regionEnd; region++)
 	{
-		struct tsf_voice *voice, *v, *vEnd; TSF_BOOL doLoop; float lowpassFilterQDB, lowpassFc;
+		struct tsf_voice *voice, *v, *fade; int i, *a, *aEnd; TSF_BOOL doLoop; float lowpassFilterQDB, lowpassFc;
 		if (key < region->lokey || key > region->hikey || midiVelocity < region->lovel || midiVelocity > region->hivel) continue;
 
-		voice = TSF_NULL, v = f->voices, vEnd = v + f->voiceNum;
+		// A region without its decoded sample is dropped before it takes a voice
+		if (f->lazySamples && !tsf_sample_cache_get(f, region->sampleIndex, voicePlayIndex, TSF_TRUE))
+		{
+			f->droppedVoiceCount++;
+			continue;
+		}
+
 		if (region->group)
 		{
-			for (; v != vEnd; v++)
-				if (v->playingPreset == preset_index && v->region->group == region->group) tsf_voice_endquick(f, v);
-				else if (v->playingPreset == -1 && !voice) voice = v;
+			for (i = *tsf_voice_index_group(f, region->group); i != -1; i = v->groupNext)
+				if ((v = &f->voices[i])->playingPreset == preset_index && v->region->group == region->group) tsf_voice_endquick(f, v);
 		}
-		else for (; v != vEnd; v++) if (v->playingPreset == -1) { voice = v; break; }
+		voice = tsf_voice_activate(f, 0, (f->maxVoiceNum ? f->maxVoiceNum : f->voiceNum));
 
 		if (!voice)
 		{
-			if (f->maxVoiceNum)
+			if (f->maxVoiceNum && f->voiceStealing == TSF_STEAL_QUIETEST)
+			{
+				voice = tsf_voice_steal_quietest(f, voicePlayIndex);
+				if (!voice) { f->droppedVoiceCount++; continue; }
+				// Fade out a copy of the stolen voice in a reserved voice, or cut it off if none is free
+				fade = tsf_voice_activate(f, f->maxVoiceNum, f->voiceNum);
+				if (fade)
+				{
+					*fade = *voice;
+					tsf_voice_index_add(f, fade);
+					tsf_voice_endquick(f, fade);
+				}
+				tsf_voice_index_remove(f, voice);
+				f->stolenVoiceCount++;
+			}
+			else if (f->maxVoiceNum)
 			{
 				// Voices have been pre-allocated and limited to a maximum, try to kill a voice off in its release envelope
+				// (all voices up to the maximum are in the active list, in the same order as in f->voices)
 				int bestKillReleaseSamplePos = -999999999;
-				for (v = f->voices; v != vEnd; v++)
+				for (a = f->activeVoices, aEnd = a + f->activeVoiceNum; a != aEnd && *a < f->maxVoiceNum; a++)
 				{
+					v = &f->voices[*a];
 					if (v->ampenv.segment == TSF_SEGMENT_RELEASE)
 					{
 						// We're looking for the voice furthest into its release
@@ -1590,19 +3125,26 @@ TSFDEF int tsf_note_on(tsf* f, int preset_index, int key, float vel)
 					}
 				}
 				if (!voice)
+				{
+					f->droppedVoiceCount++;
 					continue;
+				}
 				tsf_voice_kill(voice);
+				tsf_voice_index_remove(f, voice);
+				f->stolenVoiceCount++;
+			}
+			else if (f->realtime)
+			{
+				// Voices cannot be allocated now, tsf_reserve should have allocated enough
+				f->droppedVoiceCount++;
+				continue;
 			}
 			else
 			{
-				// Allocate more voices so we don't need to kill one off.
-				struct tsf_voice* newVoices;
-				f->voiceNum += 4;
-				newVoices = (struct tsf_voice*)TSF_REALLOC(f->voices, f->voiceNum * sizeof(struct tsf_voice));
-				if (!newVoices) return 0;
-				f->voices = newVoices;
-				voice = &f->voices[f->voiceNum - 4];
-				voice[1].playingPreset = voice[2].playingPreset = voice[3].playingPreset = -1;
+				// Allocate more voices so we don't need to kill one off, doubling so that growth is geometric.
+				int oldVoiceNum = f->voiceNum;
+				if (!tsf_voices_resize(f, oldVoiceNum >= 4 ? oldVoiceNum * 2 : 4)) return 0;
+				voice = tsf_voice_activate(f, oldVoiceNum, f->voiceNum);
 			}
 		}
 
@@ -1618,14 +3160,17 @@ TSFDEF int tsf_note_on(tsf* f, int preset_index, int key, float vel)
 		}
 		else
 		{
+			voice->playingChannel = -1;
 			tsf_voice_calcpitchratio(voice, 0, f->outSampleRate);
 			// The SFZ spec is silent about the pan curve, but a 3dB pan law seems common. This sqrt() curve matches what Dimension LE does; Alchemy Free seems closer to sin(adjustedPan * pi/2).
 			voice->panFactorLeft  = TSF_SQRTF(0.5f - region->pan);
 			voice->panFactorRight = TSF_SQRTF(0.5f + region->pan);
 		}
+		tsf_voice_index_add(f, voice);
 
 		// Offset/end.
 		voice->sourceSamplePosition = region->offset;
+		voice->sourceSamplePhase = (tsf_u64)region->offset << 32;
 
 		// Loop.
 		doLoop = (region->loop_mode != TSF_LOOPMODE_NONE && region->loop_start < region->loop_end);
@@ -1660,19 +3205,22 @@ TSFDEF int tsf_bank_note_on(tsf* f, int bank, int preset_number, int key, float
 
 TSFDEF void tsf_note_off(tsf* f, int preset_index, int key)
 {
-	struct tsf_voice *v = f->voices, *vEnd = v + f->voiceNum, *vMatchFirst = TSF_NULL, *vMatchLast = TSF_NULL;
-	for (; v != vEnd; v++)
+	struct tsf_voice *v, *vMatchFirst = TSF_NULL;
+	int *a, *aEnd, *aMatchFirst = TSF_NULL, *aMatchLast = TSF_NULL;
+	for (a = f->activeVoices, aEnd = a + f->activeVoiceNum; a != aEnd; a++)
 	{
 		//Find the first and last entry in the voices list with matching preset, key and look up the smallest play index
+		v = &f->voices[*a];
 		if (v->playingPreset != preset_index || v->playingKey != key || v->ampenv.segment >= TSF_SEGMENT_RELEASE) continue;
-		else if (!vMatchFirst || v->playIndex < vMatchFirst->playIndex) vMatchFirst = vMatchLast = v;
-		else if (v->playIndex == vMatchFirst->playIndex) vMatchLast = v;
+		else if (!vMatchFirst || v->playIndex < vMatchFirst->playIndex) vMatchFirst = v, aMatchFirst = aMatchLast = a;
+		else if (v->playIndex == vMatchFirst->playIndex) aMatchLast = a;
 	}
 	if (!vMatchFirst) return;
-	for (v = vMatchFirst; v <= vMatchLast; v++)
+	for (a = aMatchFirst; a <= aMatchLast; a++)
 	{
 		//Stop all voices with matching preset, key and the smallest play index which was enumerated above
-		if (v != vMatchFirst && v != vMatchLast &&
+		v = &f->voices[*a];
+		if (a != aMatchFirst && a != aMatchLast &&
 			(v->playIndex != vMatchFirst->playIndex || v->playingPreset != preset_index || v->playingKey != key || v->ampenv.segment >= TSF_SEGMENT_RELEASE)) continue;
 		tsf_voice_end(f, v);
 	}
@@ -1688,17 +3236,26 @@ TSFDEF int tsf_bank_note_off(tsf* f, int bank, int preset_number, int key)
 
 TSFDEF void tsf_note_off_all(tsf* f)
 {
-	struct tsf_voice *v = f->voices, *vEnd = v + f->voiceNum;
-	for (; v != vEnd; v++) if (v->playingPreset != -1 && v->ampenv.segment < TSF_SEGMENT_RELEASE)
-		tsf_voice_end(f, v);
+	struct tsf_voice *v; int *a, *aEnd;
+	for (a = f->activeVoices, aEnd = a + f->activeVoiceNum; a != aEnd; a++)
+		if ((v = &f->voices[*a])->playingPreset != -1 && v->ampenv.segment < TSF_SEGMENT_RELEASE)
+			tsf_voice_end(f, v);
 }
 
 TSFDEF int tsf_active_voice_count(tsf* f)
 {
-	int count = 0;
-	struct tsf_voice *v = f->voices, *vEnd = v + f->voiceNum;
-	for (; v != vEnd; v++) if (v->playingPreset != -1) count++;
-	return count;
+	tsf_active_voices_compact(f);
+	return f->activeVoiceNum;
+}
+
+TSFDEF int tsf_stolen_voice_count(tsf* f)
+{
+	return f->stolenVoiceCount;
+}
+
+TSFDEF int tsf_dropped_voice_count(tsf* f)
+{
+	return f->droppedVoiceCount;
 }
 
 TSFDEF void tsf_render_short(tsf* f, short* buffer, int samples, int flag_mixing)
@@ -1729,13 +3286,40 @@ TSFDEF void tsf_render_short(tsf* f, short* buffer, int samples, int flag_mixing
 	}
 }
 
+static void TSF_VOICE_RENDER(tsf* f, struct tsf_voice* v, float* outputBuffer, int numSamples);
+static void TSF_RENDER_VOICES(tsf* f, float* buffer, int samples);
+static const struct tsf_render_kernels* TSF_RENDER_KERNELS(void);
+
+static const struct tsf_render_kernels* tsf_render_kernels_get(void)
+{
+	return &tsf_render_kernels_active;
+}
+
+static void tsf_render_voices(tsf* f, float* buffer, int samples)
+{
+	struct tsf_voice* v; int *a, *aEnd;
+	for (a = f->activeVoices, aEnd = a + f->activeVoiceNum; a != aEnd; a++)
+		if ((v = &f->voices[*a])->playingPreset != -1)
+			TSF_VOICE_RENDER(f, v, buffer, samples);
+}
+
 TSFDEF void tsf_render_float(tsf* f, float* buffer, int samples, int flag_mixing)
 {
-	struct tsf_voice *v = f->voices, *vEnd = v + f->voiceNum;
 	if (!flag_mixing) TSF_MEMSET(buffer, 0, (f->outputmode == TSF_MONO ? 1 : 2) * sizeof(float) * samples);
-	for (; v != vEnd; v++)
-		if (v->playingPreset != -1)
-			tsf_voice_render(f, v, buffer, samples);
+	f->renderKernels = TSF_RENDER_KERNELS();
+	TSF_RENDER_VOICES(f, buffer, samples);
+	tsf_active_voices_compact(f);
+	f->stealHeapValid = TSF_FALSE;
+}
+
+TSFDEF void tsf_set_render_kernels(const struct tsf_render_kernels* kernels)
+{
+	tsf_render_kernels_active = (kernels ? *kernels : tsf_render_kernels_scalar);
+}
+
+TSFDEF const struct tsf_render_kernels* tsf_get_default_render_kernels(void)
+{
+	return &tsf_render_kernels_scalar;
 }
 
 static void tsf_channel_setup_voice(tsf* f, struct tsf_voice* v)
@@ -1754,19 +3338,24 @@ static struct tsf_channel* tsf_channel_init(tsf* f, int channel)
 {
 	int i;
 	if (f->channels && channel < f->channels->channelNum) return &f->channels->channels[channel];
-	if (!f->channels)
-	{
-		f->channels = (struct tsf_channels*)TSF_MALLOC(sizeof(struct tsf_channels) + sizeof(struct tsf_channel) * channel);
-		if (!f->channels) return TSF_NULL;
-		f->channels->setupVoice = &tsf_channel_setup_voice;
-		f->channels->channelNum = 0;
-		f->channels->activeChannel = 0;
-	}
-	else
+	if (!f->channels || channel >= f->channels->channelMax)
 	{
-		struct tsf_channels *newChannels = (struct tsf_channels*)TSF_REALLOC(f->channels, sizeof(struct tsf_channels) + sizeof(struct tsf_channel) * channel);
-		if (!newChannels) return TSF_NULL;
-		f->channels = newChannels;
+		// Use the storage kept by tsf_reset or tsf_reserve first, and grow geometrically
+		struct tsf_channels** storage = (f->channels ? &f->channels : &f->spareChannels);
+		int channelMax = (*storage ? (*storage)->channelMax : 0);
+		if (channel >= channelMax)
+		{
+			channelMax = (channelMax >= 8 ? channelMax * 2 : 16);
+			if (channelMax <= channel) channelMax = channel + 1;
+			if (f->realtime || !tsf_channels_reserve(storage, channelMax)) return TSF_NULL;
+		}
+		if (!f->channels)
+		{
+			f->channels = f->spareChannels;
+			f->spareChannels = TSF_NULL;
+			f->channels->channelNum = 0;
+			f->channels->activeChannel = 0;
+		}
 	}
 	i = f->channels->channelNum;
 	f->channels->channelNum = channel + 1;
@@ -1788,10 +3377,10 @@ static struct tsf_channel* tsf_channel_init(tsf* f, int channel)
 
 static void tsf_channel_applypitch(tsf* f, int channel, struct tsf_channel* c)
 {
-	struct tsf_voice *v, *vEnd;
+	struct tsf_voice *v; int *a, *aEnd;
 	float pitchShift = (c->pitchWheel == 8192 ? c->tuning : ((c->pitchWheel / 16383.0f * c->pitchRange * 2.0f) - c->pitchRange + c->tuning));
-	for (v = f->voices, vEnd = v + f->voiceNum; v != vEnd; v++)
-		if (v->playingPreset != -1 && v->playingChannel == channel)
+	for (a = f->activeVoices, aEnd = a + f->activeVoiceNum; a != aEnd; a++)
+		if ((v = &f->voices[*a])->playingPreset != -1 && v->playingChannel == channel)
 			tsf_voice_calcpitchratio(v, pitchShift, f->outSampleRate);
 }
 
@@ -1847,11 +3436,11 @@ TSFDEF int tsf_channel_set_bank_preset(tsf* f, int channel, int bank, int preset
 
 TSFDEF int tsf_channel_set_pan(tsf* f, int channel, float pan)
 {
-	struct tsf_voice *v, *vEnd;
+	struct tsf_voice *v; int *a, *aEnd;
 	struct tsf_channel *c = tsf_channel_init(f, channel);
 	if (!c) return 0;
-	for (v = f->voices, vEnd = v + f->voiceNum; v != vEnd; v++)
-		if (v->playingChannel == channel && v->playingPreset != -1)
+	for (a = f->activeVoices, aEnd = a + f->activeVoiceNum; a != aEnd; a++)
+		if ((v = &f->voices[*a])->playingChannel == channel && v->playingPreset != -1)
 		{
 			float newpan = v->region->pan + pan - 0.5f;
 			if      (newpan <= -0.5f) { v->panFactorLeft = 1.0f; v->panFactorRight = 0.0f; }
@@ -1865,12 +3454,12 @@ TSFDEF int tsf_channel_set_pan(tsf* f, int channel, float pan)
 TSFDEF int tsf_channel_set_volume(tsf* f, int channel, float volume)
 {
 	float gainDB = tsf_gainToDecibels(volume), gainDBChange;
-	struct tsf_voice *v, *vEnd;
+	struct tsf_voice *v; int *a, *aEnd;
 	struct tsf_channel *c = tsf_channel_init(f, channel);
 	if (!c) return 0;
 	if (gainDB == c->gainDB) return 1;
-	for (v = f->voices, vEnd = v + f->voiceNum, gainDBChange = gainDB - c->gainDB; v != vEnd; v++)
-		if (v->playingPreset != -1 && v->playingChannel == channel)
+	for (a = f->activeVoices, aEnd = a + f->activeVoiceNum, gainDBChange = gainDB - c->gainDB; a != aEnd; a++)
+		if ((v = &f->voices[*a])->playingPreset != -1 && v->playingChannel == channel)
 			v->noteGainDB += gainDBChange;
 	c->gainDB = gainDB;
 	return 1;
@@ -1915,37 +3504,42 @@ TSFDEF int tsf_channel_note_on(tsf* f, int channel, int key, float vel)
 
 TSFDEF void tsf_channel_note_off(tsf* f, int channel, int key)
 {
-	struct tsf_voice *v = f->voices, *vEnd = v + f->voiceNum, *vMatchFirst = TSF_NULL, *vMatchLast = TSF_NULL;
-	for (; v != vEnd; v++)
+	struct tsf_voice *v;
+	int i, *head;
+	unsigned int matchPlayIndex = 0;
+	TSF_BOOL match = TSF_FALSE;
+	if (!f->voiceIndex) return;
+	head = tsf_voice_index_key(f, channel, key);
+	for (i = *head; i != -1; i = v->keyNext)
 	{
-		//Find the first and last entry in the voices list with matching channel, key and look up the smallest play index
+		//Find the smallest play index of the voices with matching channel and key
+		v = &f->voices[i];
 		if (v->playingPreset == -1 || v->playingChannel != channel || v->playingKey != key || v->ampenv.segment >= TSF_SEGMENT_RELEASE) continue;
-		else if (!vMatchFirst || v->playIndex < vMatchFirst->playIndex) vMatchFirst = vMatchLast = v;
-		else if (v->playIndex == vMatchFirst->playIndex) vMatchLast = v;
+		if (!match || v->playIndex < matchPlayIndex) matchPlayIndex = v->playIndex, match = TSF_TRUE;
 	}
-	if (!vMatchFirst) return;
-	for (v = vMatchFirst; v <= vMatchLast; v++)
+	if (!match) return;
+	for (i = *head; i != -1; i = v->keyNext)
 	{
 		//Stop all voices with matching channel, key and the smallest play index which was enumerated above
-		if (v != vMatchFirst && v != vMatchLast &&
-			(v->playIndex != vMatchFirst->playIndex || v->playingPreset == -1 || v->playingChannel != channel || v->playingKey != key || v->ampenv.segment >= TSF_SEGMENT_RELEASE)) continue;
+		v = &f->voices[i];
+		if (v->playIndex != matchPlayIndex || v->playingPreset == -1 || v->playingChannel != channel || v->playingKey != key || v->ampenv.segment >= TSF_SEGMENT_RELEASE) continue;
 		tsf_voice_end(f, v);
 	}
 }
 
 TSFDEF void tsf_channel_note_off_all(tsf* f, int channel)
 {
-	struct tsf_voice *v = f->voices, *vEnd = v + f->voiceNum;
-	for (; v != vEnd; v++)
-		if (v->playingPreset != -1 && v->playingChannel == channel && v->ampenv.segment < TSF_SEGMENT_RELEASE)
+	struct tsf_voice *v; int *a, *aEnd;
+	for (a = f->activeVoices, aEnd = a + f->activeVoiceNum; a != aEnd; a++)
+		if ((v = &f->voices[*a])->playingPreset != -1 && v->playingChannel == channel && v->ampenv.segment < TSF_SEGMENT_RELEASE)
 			tsf_voice_end(f, v);
 }
 
 TSFDEF void tsf_channel_sounds_off_all(tsf* f, int channel)
 {
-	struct tsf_voice *v = f->voices, *vEnd = v + f->voiceNum;
-	for (; v != vEnd; v++)
-		if (v->playingPreset != -1 && v->playingChannel == channel && (v->ampenv.segment < TSF_SEGMENT_RELEASE || v->ampenv.parameters.release))
+	struct tsf_voice *v; int *a, *aEnd;
+	for (a = f->activeVoices, aEnd = a + f->activeVoiceNum; a != aEnd; a++)
+		if ((v = &f->voices[*a])->playingPreset != -1 && v->playingChannel == channel && (v->ampenv.segment < TSF_SEGMENT_RELEASE || v->ampenv.parameters.release))
 			tsf_voice_endquick(f, v);
 }
 
@@ -0,0 +1,307 @@
+//
+// Python bindings for TinySoundFont
+// https://github.com/nwhitehead/tinysoundfont-pybind
+//
+// Copyright (C) 2024 Nathan Whitehead
+//
+// This code is licensed under the MIT license (see LICENSE for details)
+//
+
+// Specialized versions of tsf_voice_render.
+// Must be included after the TinySoundFont implementation, which calls
+// tsfpy_voice_render (through TSF_VOICE_RENDER) for every playing voice.
+//
+// tsf_voice_render decides per voice whether pitch, gain and the lowpass
+// filter are modulated and tests the output mode, loop and filter state
+// around the per-sample loops. Here every combination is a template
+// instantiation so the compiler can drop the dead code, and each voice is
+// dispatched to the right one once per render call. Knowing the loop mode
+// also lets the sample position loop run without per-frame checks until the
+// loop or sample end is near. The operations are the same as in
+// tsf_voice_render so the output is bit-identical.
+
+#pragma once
+
+#include <atomic>
+
+namespace voice_render {
+
+enum class Filter { None, Static, Dynamic };
+
+using RenderFunc = void (*)(tsf* f, struct tsf_voice* v, float* outputBuffer, int numSamples);
+
+// Positions, next positions and interpolation factors for up to count frames, returns the number of frames.
+// Stops early at the end of the sample. The bulk of the frames are produced by a loop without
+// branches, it covers the frames that can neither reach the sample end nor the loop end. Those
+// are found by a conservative estimate, the exact checks are done per frame for the rest.
+template <bool Looping>
+inline int positions_double(double& position, double pitchRatio, unsigned int loopStart, unsigned int loopEnd, double sampleEnd,
+        unsigned int* pos, unsigned int* nextPos, float* alpha, int count) {
+    const double loopEndDbl = (double)loopEnd + 1.0, safeEnd = (Looping && loopEnd < sampleEnd ? (double)loopEnd : sampleEnd);
+    double p = position;
+    int n = 0;
+    while (n != count && p < sampleEnd) {
+        // Leave a margin of one step for the accumulated rounding, tiny steps always take the checked path
+        int run = 0;
+        if (pitchRatio > 1e-3 && p < safeEnd) {
+            double frames = (safeEnd - p) / pitchRatio - 1.0;
+            run = (frames >= count - n ? count - n : (frames > 0 ? (int)frames : 0));
+        }
+        if (run) {
+            for (int i = n, iEnd = n + run; i != iEnd; i++) {
+                unsigned int ip = (unsigned int)p;
+                pos[i] = ip;
+                nextPos[i] = ip + 1;
+                alpha[i] = (float)(p - ip);
+                p += pitchRatio;
+            }
+            n += run;
+        } else {
+            unsigned int ip = (unsigned int)p;
+            pos[n] = ip;
+            nextPos[n] = (Looping && ip >= loopEnd ? loopStart : ip + 1);
+            alpha[n] = (float)(p - ip);
+            p += pitchRatio;
+            n++;
+        }
+        if (Looping && p >= loopEndDbl) p -= (loopEnd - loopStart + 1.0);
+    }
+    position = p;
+    return n;
+}
+
+template <bool Looping>
+inline int positions_fixed(tsf_u64& phase, tsf_u64 phaseIncrement, unsigned int loopStart, unsigned int loopEnd, tsf_u64 sampleEnd,
+        unsigned int* pos, unsigned int* nextPos, float* alpha, int count) {
+    const tsf_u64 loopEndPhase = ((tsf_u64)loopEnd + 1) << 32, loopLengthPhase = ((tsf_u64)(loopEnd - loopStart) + 1) << 32;
+    const tsf_u64 safeEnd = (Looping && ((tsf_u64)loopEnd << 32) < sampleEnd ? (tsf_u64)loopEnd << 32 : sampleEnd);
+    tsf_u64 p = phase;
+    int n = 0;
+    while (n != count && p < sampleEnd) {
+        // The phase is exact, so the frames before the safe end can be counted exactly
+        int run = 0;
+        if (p < safeEnd) {
+            tsf_u64 frames = (phaseIncrement ? (safeEnd - p + phaseIncrement - 1) / phaseIncrement : (tsf_u64)count);
+            run = (frames >= (tsf_u64)(count - n) ? count - n : (int)frames);
+        }
+        if (run) {
+            // Without loop carried dependencies except the phase increment this can be vectorized
+            for (int i = 0; i != run; i++) {
+                tsf_u64 ph = p + phaseIncrement * (tsf_u64)i;
+                unsigned int ip = (unsigned int)(ph >> 32);
+                pos[n + i] = ip;
+                nextPos[n + i] = ip + 1;
+                alpha[n + i] = (float)((tsf_u32)ph >> 8) * (1.0f / 16777216.0f);
+            }
+            p += phaseIncrement * (tsf_u64)run;
+            n += run;
+        } else {
+            unsigned int ip = (unsigned int)(p >> 32);
+            pos[n] = ip;
+            nextPos[n] = (Looping && ip >= loopEnd ? loopStart : ip + 1);
+            alpha[n] = (float)((tsf_u32)p >> 8) * (1.0f / 16777216.0f);
+            p += phaseIncrement;
+            n++;
+        }
+        if (Looping && p >= loopEndPhase) p -= loopLengthPhase;
+    }
+    phase = p;
+    return n;
+}
+
+template <enum TSFOutputMode Mode, Filter Lowpass, bool Looping, bool FixedPoint, bool DynamicPitch, bool DynamicGain>
+void render(tsf* f, struct tsf_voice* v, float* outputBuffer, int numSamples) {
+    struct tsf_region* region = v->region;
+    float* outL = outputBuffer;
+    float* outR = (Mode == TSF_STEREO_UNWEAVED ? outL + numSamples : nullptr);
+    const struct tsf_render_kernels* kernels = f->renderKernels;
+
+    unsigned int blockPos[TSF_RENDER_EFFECTSAMPLEBLOCK], blockNextPos[TSF_RENDER_EFFECTSAMPLEBLOCK];
+    float blockAlpha[TSF_RENDER_EFFECTSAMPLEBLOCK], blockVal[TSF_RENDER_EFFECTSAMPLEBLOCK];
+
+    const bool updateModEnv = (region->modEnvToPitch || region->modEnvToFilterFc);
+    const bool updateModLFO = (v->modlfo.delta && (region->modLfoToPitch || region->modLfoToFilterFc || region->modLfoToVolume));
+    const bool updateVibLFO = (v->viblfo.delta && (region->vibLfoToPitch));
+    const unsigned int tmpLoopStart = v->loopStart, tmpLoopEnd = v->loopEnd;
+    const double tmpSampleEndDbl = (double)region->end;
+    const tsf_u64 tmpSampleEndPhase = (tsf_u64)region->end << 32;
+    double tmpSourceSamplePosition = v->sourceSamplePosition;
+    tsf_u64 tmpSourceSamplePhase = v->sourceSamplePhase;
+    struct tsf_voice_lowpass tmpLowpass = v->lowpass;
+    struct tsf_voice_lowpassf tmpLowpassF;
+    const bool floatFilters = (Lowpass != Filter::None && f->floatFilters);
+    if (floatFilters) tsf_voice_lowpassf_load(&tmpLowpassF, &tmpLowpass);
+    const float tmpSampleRate = f->outSampleRate;
+    const int effectSampleBlock = f->effectSampleBlock;
+    const bool gainRamp = (f->gainRamp != 0);
+
+    double pitchRatio = 0;
+    if (!DynamicPitch) {
+        pitchRatio = tsf_timecents2Secsd(v->pitchInputTimecents) * v->pitchOutputFactor;
+    }
+    float noteGain = 0;
+    if (!DynamicGain) {
+        noteGain = tsf_decibelsToGain(v->noteGainDB);
+    }
+
+    while (numSamples) {
+        int blockSamples = (numSamples > effectSampleBlock ? effectSampleBlock : numSamples);
+        numSamples -= blockSamples;
+
+        if (Lowpass == Filter::Dynamic) {
+            float fres = (float)region->initialFilterFc + v->modlfo.level * (float)region->modLfoToFilterFc + v->modenv.level * (float)region->modEnvToFilterFc;
+            float lowpassFc = (fres <= 13500 ? tsf_cents2Hertz(fres) / tmpSampleRate : 1.0f);
+            tmpLowpass.active = (lowpassFc < 0.499f);
+            if (tmpLowpass.active) {
+                if (floatFilters) tsf_voice_lowpassf_setup(&tmpLowpassF, (float)tmpLowpass.QInv, lowpassFc);
+                else tsf_voice_lowpass_setup(&tmpLowpass, lowpassFc);
+            }
+        }
+
+        if (DynamicPitch) {
+            pitchRatio = tsf_timecents2Secsd(v->pitchInputTimecents + (v->modlfo.level * (float)region->modLfoToPitch + v->viblfo.level * (float)region->vibLfoToPitch + v->modenv.level * (float)region->modEnvToPitch)) * v->pitchOutputFactor;
+        }
+
+        if (DynamicGain) {
+            noteGain = tsf_decibelsToGain(v->noteGainDB + (v->modlfo.level * ((float)region->modLfoToVolume * 0.1f)));
+        }
+
+        float gainMono = noteGain * v->ampenv.level, gainStep = 0;
+
+        // Update EG.
+        tsf_voice_envelope_process(&v->ampenv, blockSamples, tmpSampleRate);
+        if (updateModEnv) tsf_voice_envelope_process(&v->modenv, blockSamples, tmpSampleRate);
+
+        // Update LFOs.
+        if (updateModLFO) tsf_voice_lfo_process(&v->modlfo, blockSamples);
+        if (updateVibLFO) tsf_voice_lfo_process(&v->viblfo, blockSamples);
+
+        // Ramp to the gain at the start of the next block.
+        if (gainRamp) {
+            float gainNext = (DynamicGain ? tsf_decibelsToGain(v->noteGainDB + (v->modlfo.level * ((float)region->modLfoToVolume * 0.1f))) : noteGain) * v->ampenv.level;
+            gainStep = (gainNext - gainMono) / blockSamples;
+        }
+
+        // Process the block in chunks that fit the sample position and value buffers.
+        bool sampleEnded = false;
+        for (int chunkSamples; blockSamples && !sampleEnded; blockSamples -= chunkSamples) {
+            chunkSamples = (blockSamples > TSF_RENDER_EFFECTSAMPLEBLOCK ? TSF_RENDER_EFFECTSAMPLEBLOCK : blockSamples);
+
+            // Sample positions of this chunk (stops early when reaching the end of the sample).
+            int blockCount;
+            if (FixedPoint) {
+                const tsf_u64 phaseIncrement = (tsf_u64)(pitchRatio * 4294967296.0 + 0.5);
+                blockCount = positions_fixed<Looping>(tmpSourceSamplePhase, phaseIncrement, tmpLoopStart, tmpLoopEnd, tmpSampleEndPhase, blockPos, blockNextPos, blockAlpha, chunkSamples);
+                sampleEnded = (tmpSourceSamplePhase >= tmpSampleEndPhase);
+            } else {
+                blockCount = positions_double<Looping>(tmpSourceSamplePosition, pitchRatio, tmpLoopStart, tmpLoopEnd, tmpSampleEndDbl, blockPos, blockNextPos, blockAlpha, chunkSamples);
+                sampleEnded = (tmpSourceSamplePosition >= tmpSampleEndDbl);
+            }
+
+            tsf_voice_interpolate(f, v, kernels, pitchRatio, blockPos, blockNextPos, blockAlpha, blockVal, blockCount);
+
+            if (Lowpass == Filter::Static || (Lowpass == Filter::Dynamic && tmpLowpass.active)) {
+                if (floatFilters) {
+                    tsf_voice_lowpassf_process(&tmpLowpassF, blockVal, blockCount);
+                } else {
+                    for (int i = 0; i != blockCount; i++) blockVal[i] = tsf_voice_lowpass_process(&tmpLowpass, blockVal[i]);
+                }
+            }
+
+            float gain = gainMono;
+            if (gainRamp) {
+                for (int i = 0; i != blockCount; i++) blockVal[i] *= gainMono + gainStep * i;
+                gainMono += gainStep * blockCount;
+                gain = 1.0f;
+            }
+
+            if (Mode == TSF_STEREO_INTERLEAVED) {
+                kernels->mix_interleaved(outL, blockVal, gain * v->panFactorLeft, gain * v->panFactorRight, blockCount);
+                outL += blockCount * 2;
+            } else if (Mode == TSF_STEREO_UNWEAVED) {
+                kernels->mix_unweaved(outL, outR, blockVal, gain * v->panFactorLeft, gain * v->panFactorRight, blockCount);
+                outL += blockCount;
+                outR += blockCount;
+            } else {
+                kernels->mix_mono(outL, blockVal, gain, blockCount);
+                outL += blockCount;
+            }
+        }
+
+        if (sampleEnded || v->ampenv.segment == TSF_SEGMENT_DONE) {
+            tsf_voice_kill(v);
+            return;
+        }
+    }
+
+    v->sourceSamplePosition = tmpSourceSamplePosition;
+    v->sourceSamplePhase = tmpSourceSamplePhase;
+    if (floatFilters) tsf_voice_lowpassf_store(&tmpLowpassF, &tmpLowpass);
+    if (Lowpass != Filter::None) v->lowpass = tmpLowpass;
+}
+
+// Select the instantiation one template parameter at a time
+template <enum TSFOutputMode Mode, Filter Lowpass, bool Looping, bool FixedPoint, bool DynamicPitch>
+RenderFunc select(bool dynamicGain) {
+    return dynamicGain ? &render<Mode, Lowpass, Looping, FixedPoint, DynamicPitch, true> : &render<Mode, Lowpass, Looping, FixedPoint, DynamicPitch, false>;
+}
+
+template <enum TSFOutputMode Mode, Filter Lowpass, bool Looping, bool FixedPoint>
+RenderFunc select(bool dynamicPitch, bool dynamicGain) {
+    return dynamicPitch ? select<Mode, Lowpass, Looping, FixedPoint, true>(dynamicGain) : select<Mode, Lowpass, Looping, FixedPoint, false>(dynamicGain);
+}
+
+template <enum TSFOutputMode Mode, Filter Lowpass, bool Looping>
+RenderFunc select(bool fixedPoint, bool dynamicPitch, bool dynamicGain) {
+    return fixedPoint ? select<Mode, Lowpass, Looping, true>(dynamicPitch, dynamicGain) : select<Mode, Lowpass, Looping, false>(dynamicPitch, dynamicGain);
+}
+
+template <enum TSFOutputMode Mode, Filter Lowpass>
+RenderFunc select(bool looping, bool fixedPoint, bool dynamicPitch, bool dynamicGain) {
+    return looping ? select<Mode, Lowpass, true>(fixedPoint, dynamicPitch, dynamicGain) : select<Mode, Lowpass, false>(fixedPoint, dynamicPitch, dynamicGain);
+}
+
+template <enum TSFOutputMode Mode>
+RenderFunc select(Filter lowpass, bool looping, bool fixedPoint, bool dynamicPitch, bool dynamicGain) {
+    switch (lowpass) {
+        case Filter::None: return select<Mode, Filter::None>(looping, fixedPoint, dynamicPitch, dynamicGain);
+        case Filter::Static: return select<Mode, Filter::Static>(looping, fixedPoint, dynamicPitch, dynamicGain);
+        default: return select<Mode, Filter::Dynamic>(looping, fixedPoint, dynamicPitch, dynamicGain);
+    }
+}
+
+inline RenderFunc select(const tsf* f, const struct tsf_voice* v) {
+    const struct tsf_region* region = v->region;
+    Filter lowpass = (region->modLfoToFilterFc || region->modEnvToFilterFc) ? Filter::Dynamic : (v->lowpass.active ? Filter::Static : Filter::None);
+    bool looping = (v->loopStart < v->loopEnd);
+    bool fixedPoint = (f->fixedPointPhase != 0);
+    bool dynamicPitch = (region->modLfoToPitch || region->modEnvToPitch || region->vibLfoToPitch);
+    bool dynamicGain = (region->modLfoToVolume != 0);
+    switch (f->outputmode) {
+        case TSF_STEREO_INTERLEAVED: return select<TSF_STEREO_INTERLEAVED>(lowpass, looping, fixedPoint, dynamicPitch, dynamicGain);
+        case TSF_STEREO_UNWEAVED: return select<TSF_STEREO_UNWEAVED>(lowpass, looping, fixedPoint, dynamicPitch, dynamicGain);
+        default: return select<TSF_MONO>(lowpass, looping, fixedPoint, dynamicPitch, dynamicGain);
+    }
+}
+
+// Whether voices are rendered by the specialized functions (true) or by tsf_voice_render.
+// Renders load it once when they start, so it can change while other threads render.
+inline std::atomic<bool>& enabled() {
+    static std::atomic<bool> value(true);
+    return value;
+}
+
+// Render one voice, specialized is the value of enabled() when the render started
+inline void render(tsf* f, struct tsf_voice* v, float* outputBuffer, int numSamples, bool specialized) {
+    if (specialized) {
+        select(f, v)(f, v, outputBuffer, numSamples);
+    } else {
+        tsf_voice_render(f, v, outputBuffer, numSamples);
+    }
+}
+
+} // end namespace voice_render
+
+static void tsfpy_voice_render(tsf* f, struct tsf_voice* v, float* outputBuffer, int numSamples) {
+    voice_render::render(f, v, outputBuffer, numSamples, voice_render::enabled().load());
+}
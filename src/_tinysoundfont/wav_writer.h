@@ -0,0 +1,222 @@
+//
+// Python bindings for TinySoundFont
+// https://github.com/nwhitehead/tinysoundfont-pybind
+//
+// Copyright (C) 2024 Nathan Whitehead
+//
+// This code is licensed under the MIT license (see LICENSE for details)
+//
+
+// Streaming WAV output. The number of frames is known before rendering starts, so the
+// header is written first with the final sizes and the file never needs to be seeked.
+// That also allows writing to pipes. Samples are converted and written one chunk at a time,
+// 16-bit samples with the kernels of convert.h, which must be included first, so they are the
+// same as the samples rendered into int16 buffers.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace wav_writer {
+
+enum class Format {
+    Float32,
+    Int16,
+    Int24,
+};
+
+inline int bytes_per_sample(Format format) {
+    switch (format) {
+        case Format::Int16:
+            return 2;
+        case Format::Int24:
+            return 3;
+        default:
+            return 4;
+    }
+}
+
+// Open a file for writing by name
+inline FILE* open_path(const std::string& path) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error("Could not open file for writing: " + path);
+    }
+    return file;
+}
+
+// Open a file for writing from a file descriptor, closing it later leaves the descriptor open
+inline FILE* open_fd(int fd) {
+#ifdef _WIN32
+    int copy = _dup(fd);
+    FILE* file = (copy == -1 ? nullptr : _fdopen(copy, "wb"));
+    if (!file && copy != -1) {
+        _close(copy);
+    }
+#else
+    int copy = dup(fd);
+    FILE* file = (copy == -1 ? nullptr : fdopen(copy, "wb"));
+    if (!file && copy != -1) {
+        close(copy);
+    }
+#endif
+    if (!file) {
+        throw std::runtime_error("Could not write to file descriptor " + std::to_string(fd));
+    }
+    return file;
+}
+
+class Writer {
+public:
+    // Takes ownership of file and writes the header for frames frames of interleaved audio
+    Writer(FILE* file, Format format, int channels, int samplerate, long long frames)
+        : file(file), format(format), channels(channels), frames_left(frames)
+    {
+        uint32_t sample_bytes = bytes_per_sample(format);
+        uint32_t block_align = sample_bytes * channels;
+        unsigned long long data_bytes = static_cast<unsigned long long>(frames) * block_align;
+        pad = data_bytes & 1;
+        bool is_float = (format == Format::Float32);
+        // Float data needs the extended fmt chunk and a fact chunk
+        uint32_t header_bytes = (is_float ? 4 + 8 + 18 + 8 + 4 + 8 : 4 + 8 + 16 + 8);
+        if (data_bytes + pad + header_bytes > 0xFFFFFFFFull) {
+            std::fclose(file);
+            throw std::runtime_error("Audio is too long for a WAV file");
+        }
+        // The destructor does not run if the constructor throws
+        try {
+            std::vector<uint8_t> header;
+            append(header, "RIFF");
+            append32(header, static_cast<uint32_t>(header_bytes + data_bytes + pad));
+            append(header, "WAVE");
+            append(header, "fmt ");
+            append32(header, is_float ? 18 : 16);
+            append16(header, is_float ? 3 : 1);
+            append16(header, channels);
+            append32(header, samplerate);
+            append32(header, samplerate * block_align);
+            append16(header, block_align);
+            append16(header, sample_bytes * 8);
+            if (is_float) {
+                append16(header, 0);
+                append(header, "fact");
+                append32(header, 4);
+                append32(header, static_cast<uint32_t>(frames));
+            }
+            append(header, "data");
+            append32(header, static_cast<uint32_t>(data_bytes));
+            output(header.data(), header.size());
+        } catch (...) {
+            std::fclose(file);
+            throw;
+        }
+    }
+
+    ~Writer() {
+        if (file) {
+            std::fclose(file);
+        }
+    }
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    // Convert and write frames of interleaved samples
+    void write(const float* samples, int frames) {
+        if (frames > frames_left) {
+            throw std::runtime_error("More frames written than the WAV header announced");
+        }
+        frames_left -= frames;
+        size_t count = static_cast<size_t>(frames) * channels;
+        if (format == Format::Float32) {
+            bytes.resize(count * 4);
+            for (size_t i = 0; i < count; i++) {
+                uint32_t value;
+                std::memcpy(&value, &samples[i], 4);
+                store(&bytes[i * 4], value, 4);
+            }
+        } else if (format == Format::Int16) {
+            shorts.resize(count);
+            convert::active().to_int16(samples, shorts.data(), static_cast<int>(count), false, nullptr);
+            bytes.resize(count * 2);
+            for (size_t i = 0; i < count; i++) {
+                store(&bytes[i * 2], static_cast<uint16_t>(shorts[i]), 2);
+            }
+        } else {
+            float scale = 8388607.0f;
+            bytes.resize(count * 3);
+            for (size_t i = 0; i < count; i++) {
+                float clipped = std::min(1.0f, std::max(-1.0f, samples[i]));
+                int32_t value = static_cast<int32_t>(std::lrint(clipped * scale));
+                store(&bytes[i * 3], static_cast<uint32_t>(value), 3);
+            }
+        }
+        output(bytes.data(), bytes.size());
+    }
+
+    // Check that all frames were written and close the file
+    void close() {
+        if (frames_left) {
+            throw std::runtime_error("Fewer frames written than the WAV header announced");
+        }
+        if (pad) {
+            uint8_t zero = 0;
+            output(&zero, 1);
+        }
+        FILE* closing = file;
+        file = nullptr;
+        if (std::fclose(closing) != 0) {
+            throw std::runtime_error("Could not write WAV file");
+        }
+    }
+
+private:
+    static void store(uint8_t* out, uint32_t value, int size) {
+        for (int i = 0; i < size; i++) {
+            out[i] = static_cast<uint8_t>(value >> (8 * i));
+        }
+    }
+
+    static void append(std::vector<uint8_t>& out, const char* tag) {
+        out.insert(out.end(), tag, tag + 4);
+    }
+
+    static void append16(std::vector<uint8_t>& out, uint32_t value) {
+        out.push_back(static_cast<uint8_t>(value));
+        out.push_back(static_cast<uint8_t>(value >> 8));
+    }
+
+    static void append32(std::vector<uint8_t>& out, uint32_t value) {
+        append16(out, value & 0xFFFF);
+        append16(out, value >> 16);
+    }
+
+    void output(const uint8_t* data, size_t size) {
+        if (std::fwrite(data, 1, size, file) != size) {
+            throw std::runtime_error("Could not write WAV file");
+        }
+    }
+
+    FILE* file;
+    Format format;
+    int channels;
+    long long frames_left;
+    bool pad = false;
+    std::vector<uint8_t> bytes;
+    std::vector<int16_t> shorts;
+};
+
+} // namespace wav_writer
@@ -2,9 +2,16 @@ import argparse
 import sys
 import time
 
+from . import _tinysoundfont
 from .synth import Synth
 from .sequencer import Sequencer
 
+WAV_FORMATS = {
+    "float32": _tinysoundfont.WavFormat.Float32,
+    "int16": _tinysoundfont.WavFormat.Int16,
+    "int24": _tinysoundfont.WavFormat.Int24,
+}
+
 
 def endswith_any(value, suffixes):
     for suffix in suffixes:
@@ -31,6 +38,23 @@ def main():
         action="store_true",
         help="Play MIDI file (requires both MIDI and SoundFont files)",
     )
+    parser.add_argument(
+        "--render",
+        metavar="OUTPUT",
+        help="Render MIDI file into a WAV file, or to standard output for - (requires both MIDI and SoundFont files)",
+    )
+    parser.add_argument(
+        "--format",
+        choices=list(WAV_FORMATS),
+        default="float32",
+        help="Sample format of rendered WAV files",
+    )
+    parser.add_argument(
+        "--tail",
+        type=float,
+        default=1.0,
+        help="Seconds to keep rendering after the last MIDI event",
+    )
     parser.add_argument("--test", action="store_true", help="Play test SoundFont file")
     parser.add_argument(
         "--info", action="store_true", help="Show information about SoundFont file"
@@ -149,6 +173,41 @@ def main():
         synth.notes_off()
         time.sleep(1)
 
+    if args.render is not None:
+        if midi_filename is None:
+            print(
+                "No MIDI file found, a MIDI file and SoundFont file are required for rendering",
+                file=sys.stderr,
+            )
+            return -1
+        if soundfont_filename is None:
+            print(
+                "No SoundFont file found, a SoundFont file is required for rendering",
+                file=sys.stderr,
+            )
+            return -2
+        synth = Synth(samplerate=args.samplerate, gain=args.gain)
+        sfid = synth.sfload(soundfont_filename)
+        with open(midi_filename, "rb") as fin:
+            midi = fin.read()
+        output = args.render
+        if output == "-":
+            sys.stdout.flush()
+            output = sys.stdout.fileno()
+        frames = _tinysoundfont.render_midi_wav(
+            synth.soundfonts[sfid],
+            midi,
+            output,
+            args.samplerate,
+            args.tail,
+            WAV_FORMATS[args.format],
+        )
+        print(
+            f"Rendered {frames / args.samplerate:.1f} seconds of {midi_filename} to {args.render}",
+            file=sys.stderr,
+        )
+        return 0
+
     if args.play:
         if midi_filename is None:
             print(
@@ -177,7 +236,7 @@ def main():
 
         return 0
 
-    print("No action to perform, need either --test, --play, or --info")
+    print("No action to perform, need either --test, --play, --render, or --info")
     return -3
 
 
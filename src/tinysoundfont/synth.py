@@ -55,6 +55,8 @@ class Synth:
         self.channel = {}
         # Function to call to perform actions during audio callback
         self.callback = None
+        # Renders all SoundFonts in parallel and mixes them together
+        self.mixer = _tinysoundfont.Mixer()
 
     def sfload(
         self, filename_or_bytes: str | bytes, gain: float = 0.0, max_voices: int = 256
@@ -443,15 +445,19 @@ class Synth:
         is not called from this method so no new events are ever triggered by
         this method.
 
+        When several SoundFonts are loaded they render in parallel on separate
+        threads, each one a few blocks behind the one loaded before it, adding
+        into the same buffer. The samples are exactly the same as rendering
+        them one after the other in the order they were loaded.
+
         See also: :meth:`generate`
         """
         CHANNELS = 2
         SIZEOF_FLOAT_IN_BYTES = 4
         if buffer is None:
             buffer = memoryview(bytearray(samples * CHANNELS * SIZEOF_FLOAT_IN_BYTES))
-        mix = False
-        for soundfont in self.soundfonts.values():
-            soundfont.render(buffer, mix)
-            # After first render turn on mix to mix together all sounds
-            mix = True
+        soundfonts = list(self.soundfonts.values())
+        # Without SoundFonts the buffer is left as it is, like before any SoundFont renders into it
+        if soundfonts:
+            self.mixer.render(soundfonts, buffer, False)
         return buffer
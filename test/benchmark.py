@@ -0,0 +1,545 @@
+"""Render engine benchmarks
+
+Run from the repository root after installing the package:
+
+    python test/benchmark.py
+"""
+
+import os
+import tempfile
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+from tinysoundfont import _tinysoundfont
+
+from test_render import sine_snr, write_sf3
+
+SAMPLERATE = 22050
+BUFFER_FRAMES = 1024
+
+
+def time_voices(soundfont, preset_index, voices=128, buffers=200, repeats=3):
+    """Returns the best time in nanoseconds per voice per output frame"""
+    buffer = bytearray(BUFFER_FRAMES * 2 * 4)
+    best = None
+    for _ in range(repeats):
+        soundfont.set_max_voices(voices)
+        for i in range(voices):
+            soundfont.note_on(preset_index, 30 + (i * 7) % 60, 0.8)
+        start = time.perf_counter()
+        for _ in range(buffers):
+            soundfont.render(buffer, False)
+        elapsed = time.perf_counter() - start
+        soundfont.note_off()
+        soundfont.reset()
+        best = elapsed if best is None else min(best, elapsed)
+    return best * 1e9 / (voices * buffers * BUFFER_FRAMES)
+
+
+def bench_specialized_render():
+    # Church organ: looping sample without filter (at this samplerate) or LFO modulation
+    soundfont = _tinysoundfont.SoundFont("test/florestan-subset.sfo")
+    soundfont.set_output(_tinysoundfont.OutputMode.StereoInterleaved, SAMPLERATE, -20.0)
+    preset_index = soundfont.get_preset_index(0, 19)
+    enabled = _tinysoundfont.get_specialized_render()
+    print("Specialized voice render (looping, no filter, no LFO)")
+    try:
+        for fixed_point_phase in (False, True):
+            soundfont.set_fixed_point_phase(fixed_point_phase)
+            _tinysoundfont.set_specialized_render(False)
+            generic = time_voices(soundfont, preset_index)
+            _tinysoundfont.set_specialized_render(True)
+            specialized = time_voices(soundfont, preset_index)
+            phase = "fixed-point" if fixed_point_phase else "double"
+            print(
+                f"  {phase:12s} generic {generic:6.2f} ns  specialized {specialized:6.2f} ns"
+                f"  speedup {generic / specialized:.2f}x  (per voice per frame)"
+            )
+    finally:
+        _tinysoundfont.set_specialized_render(enabled)
+
+
+def bench_interpolation():
+    soundfont = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+    soundfont.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -20.0)
+    print("Interpolation modes (piano at 44100 Hz, quality of a sine at 0.2 samplerate)")
+    linear = None
+    for interpolation in _tinysoundfont.Interpolation.__members__.values():
+        soundfont.set_interpolation(interpolation)
+        cost = time_voices(soundfont, 0)
+        linear = linear or cost
+        print(
+            f"  {interpolation.name:8s} {cost:6.2f} ns per voice per frame ({cost / linear:.2f}x)"
+            f"  SNR {sine_snr(interpolation, 3):5.1f} dB"
+        )
+
+
+def bench_block_size():
+    soundfont = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+    soundfont.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -20.0)
+    print("Control block size (piano at 44100 Hz)")
+    for block_size, gain_ramp in ((64, False), (64, True), (256, True), (1024, True)):
+        soundfont.set_block_size(block_size, gain_ramp)
+        cost = time_voices(soundfont, 0)
+        ramp = "ramp" if gain_ramp else "step"
+        print(f"  {block_size:5d} {ramp} {cost:6.2f} ns per voice per frame")
+
+
+def bench_float_filters():
+    # At 44100 Hz the default initial filter cutoff is below Nyquist, so every voice is filtered
+    soundfont = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+    soundfont.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -20.0)
+    print("Low-pass filters (piano at 44100 Hz)")
+    for float_filters in (False, True):
+        soundfont.set_float_filters(float_filters)
+        cost = time_voices(soundfont, 0)
+        precision = "float bank" if float_filters else "double"
+        print(f"  {precision:10s} {cost:6.2f} ns per voice per frame")
+
+
+def bench_control_rate():
+    # Violin: vibrato and tremolo, with a block size of 1 the pitch and gain conversions run for every frame
+    soundfont = _tinysoundfont.SoundFont("test/florestan-subset.sfo")
+    soundfont.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -20.0)
+    fast_math = "on" if _tinysoundfont.get_fast_math() else "off"
+    print(f"Control rate conversions, violin (build with TINYSOUNDFONT_FAST_MATH on and off to compare, now {fast_math})")
+    for block_size in (64, 1):
+        soundfont.set_block_size(block_size, False)
+        cost = time_voices(soundfont, soundfont.get_preset_index(0, 40))
+        print(f"  block size {block_size:3d} {cost:6.2f} ns per voice per frame")
+
+
+def bench_voice_scan(calls=20000):
+    # Few sounding voices out of many allocated, per-call cost should follow the sounding voices
+    soundfont = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+    soundfont.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -20.0)
+    print("Voice scans (40 sounding voices)")
+    for max_voices in (64, 1024):
+        soundfont.set_max_voices(max_voices)
+        soundfont.channel_set_preset_index(0, 0)
+        for key in range(30, 70):
+            soundfont.channel_note_on(0, key, 0.8)
+        start = time.perf_counter()
+        for _ in range(calls):
+            soundfont.note_off(0, 100)
+        middle = time.perf_counter()
+        for _ in range(calls):
+            soundfont.channel_note_off(0, 100)
+        end = time.perf_counter()
+        soundfont.note_off()
+        soundfont.reset()
+        print(
+            f"  max voices {max_voices:5d} note_off {(middle - start) * 1e9 / calls:7.1f} ns"
+            f"  channel_note_off {(end - middle) * 1e9 / calls:7.1f} ns per call"
+        )
+
+
+def bench_voice_stealing(notes=20000):
+    # All voices busy, every new note has to steal one
+    buffer = bytearray(64 * 2 * 4)
+    print("Voice stealing (1024 voices, sustained and released notes)")
+    for policy in _tinysoundfont.VoiceStealing.__members__.values():
+        # Counters are kept since loading
+        soundfont = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+        soundfont.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -20.0)
+        soundfont.set_max_voices(1024)
+        soundfont.set_voice_stealing(policy)
+        start = time.perf_counter()
+        for i in range(notes):
+            soundfont.note_on(0, 20 + i % 80, 0.5)
+            if i % 2:
+                soundfont.note_off(0, 20 + i % 80)
+            if i % 100 == 99:
+                soundfont.render(buffer, False)
+        elapsed = time.perf_counter() - start
+        print(
+            f"  {policy.name:8s} {elapsed * 1e9 / notes:7.1f} ns per note"
+            f"  stolen {soundfont.stolen_voice_count()}  dropped {soundfont.dropped_voice_count()}"
+        )
+
+
+def bench_threads(buffers=100):
+    # One SoundFont per thread, rendering runs without the GIL
+    soundfonts = []
+    for i in range(os.cpu_count() or 1):
+        soundfont = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+        soundfont.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -20.0)
+        for key in range(30, 94, 2):
+            soundfont.note_on(0, key, 0.8)
+        soundfonts.append(soundfont)
+
+    def render(soundfont):
+        buffer = bytearray(BUFFER_FRAMES * 2 * 4)
+        for _ in range(buffers):
+            soundfont.render(buffer, False)
+
+    print("Rendering SoundFonts on threads")
+    single = None
+    threads = 1
+    while threads <= len(soundfonts):
+        with ThreadPoolExecutor(threads) as pool:
+            start = time.perf_counter()
+            list(pool.map(render, soundfonts[:threads]))
+            elapsed = time.perf_counter() - start
+        single = single or elapsed
+        print(f"  {threads:3d} threads {elapsed * 1e3:7.1f} ms  speedup {single * threads / elapsed:.2f}x")
+        threads *= 2
+
+
+def bench_mixer(buffers=100):
+    # Layered SoundFonts mixed by one Mixer, serially and on all threads
+    soundfonts = []
+    for i in range(6):
+        soundfont = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+        soundfont.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -20.0)
+        for key in range(30 + i, 94, 3):
+            soundfont.note_on(0, key, 0.8)
+        soundfonts.append(soundfont)
+    mixer = _tinysoundfont.Mixer()
+    buffer = bytearray(BUFFER_FRAMES * 2 * 4)
+    threads = _tinysoundfont.get_threads()
+
+    def render(count):
+        start = time.perf_counter()
+        for _ in range(buffers):
+            mixer.render(soundfonts[:count], buffer, False)
+        return (time.perf_counter() - start) * 1e6 / buffers
+
+    print(f"Mixing SoundFonts ({threads} threads)")
+    try:
+        for count in range(1, len(soundfonts) + 1):
+            _tinysoundfont.set_threads(1)
+            serial = render(count)
+            _tinysoundfont.set_threads(threads)
+            parallel = render(count)
+            print(f"  {count} fonts  serial {serial:7.1f} us  parallel {parallel:7.1f} us  speedup {serial / parallel:.2f}x per buffer")
+    finally:
+        _tinysoundfont.set_threads(threads)
+
+
+def bench_render_threads():
+    # Many voices of one SoundFont split over the threads of the pool
+    soundfont = _tinysoundfont.SoundFont("test/florestan-subset.sfo")
+    soundfont.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -30.0)
+    preset_index = soundfont.get_preset_index(0, 19)
+    print(f"Voices of one SoundFont on several threads ({_tinysoundfont.get_threads()} threads in the pool)")
+    single = None
+    render_threads = 1
+    while render_threads <= _tinysoundfont.get_threads():
+        soundfont.set_render_threads(render_threads)
+        cost = time_voices(soundfont, preset_index, voices=512, buffers=50)
+        single = single or cost
+        print(f"  render threads {render_threads:3d} {cost:6.2f} ns per voice per frame  speedup {single / cost:.2f}x")
+        render_threads *= 2
+
+
+def bench_render_events(events_per_buffer=64, buffers=200):
+    # Dense events: one render call per event from Python, or one render_events call per buffer
+    import numpy as np
+
+    M = _tinysoundfont.MidiMessageType
+    soundfont = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+    soundfont.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -20.0)
+    soundfont.channel_set_preset_index(0, 0)
+    step = BUFFER_FRAMES // events_per_buffer
+    events = np.array(
+        [(i * step, int(M.NOTE_ON if i % 2 == 0 else M.NOTE_OFF), 0, 40 + (i // 2) % 40, 100) for i in range(events_per_buffer)],
+        dtype=np.int32,
+    )
+    buffer = memoryview(bytearray(BUFFER_FRAMES * 2 * 4))
+    start = time.perf_counter()
+    for _ in range(buffers):
+        position = 0
+        for offset, kind, channel, key, velocity in events.tolist():
+            if offset > position:
+                soundfont.render(buffer[position * 8 : offset * 8], False)
+                position = offset
+            if kind == int(M.NOTE_ON):
+                soundfont.channel_note_on(channel, key, velocity / 127.0)
+            else:
+                soundfont.channel_note_off(channel, key)
+        soundfont.render(buffer[position * 8 :], False)
+    python = (time.perf_counter() - start) * 1e6 / buffers
+    soundfont.reset()
+    soundfont.channel_set_preset_index(0, 0)
+    start = time.perf_counter()
+    for _ in range(buffers):
+        soundfont.render_events(buffer, events)
+    native = (time.perf_counter() - start) * 1e6 / buffers
+    soundfont.reset()
+    soundfont.channel_set_preset_index(0, 0)
+    start = time.perf_counter()
+    for _ in range(buffers):
+        position = soundfont.get_frame_position()
+        for offset, kind, channel, key, velocity in events.tolist():
+            soundfont.queue_event(M(kind), channel, key, velocity, position + offset)
+        soundfont.render(buffer, False)
+    queued = (time.perf_counter() - start) * 1e6 / buffers
+    print(f"Sample-accurate events ({events_per_buffer} events per {BUFFER_FRAMES} frames)")
+    print(f"  render per event {python:8.1f} us  render_events {native:8.1f} us per buffer  speedup {python / native:.2f}x")
+    print(f"  queue_event      {queued:8.1f} us per buffer  speedup {python / queued:.2f}x")
+
+
+def bench_render_midi(tail_seconds=1.0):
+    # A whole song through Sequencer and Synth.generate, or in one render_midi call
+    import tinysoundfont
+
+    with open("test/1080-c01.mid", "rb") as fin:
+        midi = fin.read()
+    synth = tinysoundfont.Synth(samplerate=SAMPLERATE)
+    sfid = synth.sfload("test/florestan-piano.sf2")
+    seq = tinysoundfont.Sequencer(synth)
+    seq.midi_load("test/1080-c01.mid")
+    start = time.perf_counter()
+    audio = _tinysoundfont.render_midi(synth.soundfonts[sfid], midi, SAMPLERATE, tail_seconds)
+    native = time.perf_counter() - start
+    seconds = len(audio) / 8 / SAMPLERATE
+    buffer = memoryview(bytearray(BUFFER_FRAMES * 2 * 4))
+    start = time.perf_counter()
+    for _ in range(0, len(audio) // 8, BUFFER_FRAMES):
+        synth.generate(BUFFER_FRAMES, buffer)
+    python = time.perf_counter() - start
+    print(f"MIDI song ({seconds:.1f} s of audio)")
+    print(f"  Sequencer + generate {seconds / python:6.1f}x realtime  render_midi {seconds / native:6.1f}x realtime")
+
+
+def bench_midi_batch(songs=8):
+    # Songs rendered one after another with render_midi, or by a MidiBatch on all threads
+    with open("test/1080-c01.mid", "rb") as fin:
+        midi = fin.read()
+    soundfont = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+    soundfont.set_output(_tinysoundfont.OutputMode.StereoInterleaved, SAMPLERATE, -20.0)
+    soundfont.set_max_voices(256)
+    start = time.perf_counter()
+    for _ in range(songs):
+        _tinysoundfont.render_midi(soundfont, midi, SAMPLERATE, 1.0)
+    serial = time.perf_counter() - start
+    start = time.perf_counter()
+    job_seconds = [result.seconds for result in _tinysoundfont.MidiBatch(soundfont, [midi] * songs, SAMPLERATE, 1.0)]
+    batch = time.perf_counter() - start
+    print(f"MIDI batch ({songs} songs, {_tinysoundfont.get_threads()} threads)")
+    print(f"  render_midi {songs / serial:6.2f} songs/s  MidiBatch {songs / batch:6.2f} songs/s  speedup {serial / batch:.2f}x  job {min(job_seconds):.2f}-{max(job_seconds):.2f} s")
+
+
+def bench_render_midi_wav():
+    # Streaming a song into a WAV file, against render_midi that keeps it in memory
+    with open("test/1080-c01.mid", "rb") as fin:
+        midi = fin.read()
+    soundfont = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+    soundfont.set_output(_tinysoundfont.OutputMode.StereoInterleaved, SAMPLERATE, -20.0)
+    start = time.perf_counter()
+    seconds = len(_tinysoundfont.render_midi(soundfont, midi, SAMPLERATE, 1.0)) / 8 / SAMPLERATE
+    memory = time.perf_counter() - start
+    print(f"MIDI song to WAV ({seconds:.1f} s of audio, render_midi {seconds / memory:6.1f}x realtime)")
+    for name in ("Float32", "Int16", "Int24"):
+        start = time.perf_counter()
+        _tinysoundfont.render_midi_wav(soundfont, midi, os.devnull, SAMPLERATE, 1.0, getattr(_tinysoundfont.WavFormat, name))
+        elapsed = time.perf_counter() - start
+        print(f"  {name:8s} {seconds / elapsed:6.1f}x realtime")
+
+
+def bench_render_integer(buffers=200, frames=4096):
+    # Rendering straight into int16 and int32 buffers, against converting a float render with numpy.
+    # The conversion is a separate pass over float blocks of 4096 frames, its cost is the difference
+    # to the float32 render.
+    import numpy as np
+
+    soundfont = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+    soundfont.set_output(_tinysoundfont.OutputMode.StereoInterleaved, SAMPLERATE, -20.0)
+    soundfont.channel_set_preset_index(0, 0)
+    for key in range(48, 72, 2):
+        soundfont.channel_note_on(0, key, 0.8)
+    float_buffer = np.zeros((frames, 2), dtype=np.float32)
+    initial_level = _tinysoundfont.get_simd()
+    print(f"Integer output ({frames} frames per buffer)")
+    for level in _tinysoundfont.simd_levels():
+        _tinysoundfont.set_simd(level)
+        cases = (
+            ("float32", np.float32, False),
+            ("float32 + numpy", None, False),
+            ("int16", np.int16, False),
+            ("int16 dither", np.int16, True),
+            ("int32", np.int32, False),
+        )
+        float_elapsed = None
+        for name, dtype, dither in cases:
+            output = np.zeros((frames, 2), dtype=dtype or np.int16)
+            start = time.perf_counter()
+            for _ in range(buffers):
+                if dtype is None:
+                    soundfont.render(float_buffer, False)
+                    output[:] = np.clip(float_buffer * 32767.5, -32768, 32767)
+                else:
+                    soundfont.render(output, False, dither=dither)
+            elapsed = time.perf_counter() - start
+            float_elapsed = float_elapsed or elapsed
+            overhead = (elapsed - float_elapsed) * 1e6 / buffers
+            print(f"  {level:7s} {name:16s} {buffers * frames / SAMPLERATE / elapsed:7.1f}x realtime {overhead:7.1f} us over float32")
+    _tinysoundfont.set_simd(initial_level)
+
+
+def bench_render_stems(buffers=100, frames=4096):
+    # 16 stems in one pass, against one SoundFont per channel that only plays that channel
+    import numpy as np
+
+    def soundfont(channels):
+        result = _tinysoundfont.SoundFont("test/florestan-subset.sfo")
+        result.set_output(_tinysoundfont.OutputMode.StereoInterleaved, SAMPLERATE, -30.0)
+        for channel in range(16):
+            result.channel_set_preset_index(channel, channel % result.get_preset_count())
+        for i in range(256):
+            if i % 16 in channels:
+                result.channel_note_on(i % 16, 30 + (i * 7) % 60, 0.8)
+        return result
+
+    print(f"Stem rendering (16 channels, {frames} frames per buffer)")
+    stereo = np.zeros((frames, 2), dtype=np.float32)
+    cases = (
+        ("stereo render", [soundfont(range(16))], False),
+        ("16 SoundFonts", [soundfont([channel]) for channel in range(16)], False),
+        ("render_stems", [soundfont(range(16))], True),
+    )
+    stems = np.zeros((16, frames, 2), dtype=np.float32)
+    for name, soundfonts, stem in cases:
+        start = time.perf_counter()
+        for _ in range(buffers):
+            if stem:
+                soundfonts[0].render_stems(stems)
+            else:
+                for sf in soundfonts:
+                    sf.render(stereo, False)
+        elapsed = time.perf_counter() - start
+        print(f"  {name:14s} {buffers * frames / SAMPLERATE / elapsed:7.1f}x realtime")
+
+
+def bench_realtime(buffers=400, frames=256):
+    # Worst buffer while the number of playing voices keeps growing, with voices allocated as
+    # needed and with voices reserved by set_realtime
+    buffer = bytearray(frames * 8)
+    print(f"Real-time mode ({frames} frames per buffer, 4 new notes per buffer)")
+    for realtime in (False, True):
+        soundfont = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+        soundfont.set_output(_tinysoundfont.OutputMode.StereoInterleaved, SAMPLERATE, -30.0)
+        if realtime:
+            soundfont.set_realtime(True, voices=2048)
+        times = []
+        for i in range(buffers):
+            start = time.perf_counter()
+            for k in range(4):
+                soundfont.note_on(0, 20 + (i * 4 + k) % 80, 0.5)
+            soundfont.render(buffer, False)
+            times.append(time.perf_counter() - start)
+        times.sort()
+        name = "set_realtime" if realtime else "allocate"
+        print(
+            f"  {name:12s} median {times[len(times) // 2] * 1e6:7.1f} us  worst {times[-1] * 1e6:7.1f} us"
+            f"  dropped {soundfont.dropped_voice_count()}"
+        )
+
+
+def bench_from_mmap(loads=200, buffers=200, frames=1024):
+    # Loading and rendering with samples converted to float at load time and read from a mapping
+    print("Memory-mapped loading (florestan-piano.sf2)")
+    buffer = bytearray(frames * 8)
+    for name, load in (("load", _tinysoundfont.SoundFont), ("from_mmap", _tinysoundfont.SoundFont.from_mmap)):
+        start = time.perf_counter()
+        for _ in range(loads):
+            soundfont = load("test/florestan-piano.sf2")
+        load_time = (time.perf_counter() - start) / loads
+        soundfont.set_output(_tinysoundfont.OutputMode.StereoInterleaved, SAMPLERATE, -30.0)
+        for key in range(21, 109, 2):
+            soundfont.note_on(0, key, 0.5)
+        start = time.perf_counter()
+        for _ in range(buffers):
+            soundfont.render(buffer, False)
+        elapsed = time.perf_counter() - start
+        print(
+            f"  {name:10s} load {load_time * 1e6:8.1f} us  samples in memory {soundfont.sample_memory_bytes():8d} bytes"
+            f"  render {buffers * frames / SAMPLERATE / elapsed:7.1f}x realtime"
+        )
+
+
+def bench_sample_format(buffers=100, frames=1024):
+    # Many voices reading different samples, with 32-bit and 16-bit sample storage
+    print("Sample storage formats (florestan-piano.sf2, 88 notes, linear and 8-tap sinc)")
+    buffer = bytearray(frames * 8)
+    for interpolation in (_tinysoundfont.Interpolation.Linear, _tinysoundfont.Interpolation.Sinc8):
+        for sample_format in _tinysoundfont.SampleFormat.__members__.values():
+            soundfont = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+            soundfont.set_sample_format(sample_format)
+            soundfont.set_output(_tinysoundfont.OutputMode.StereoInterleaved, SAMPLERATE, -30.0)
+            soundfont.set_interpolation(interpolation)
+            for key in range(21, 109):
+                soundfont.note_on(0, key, 0.5)
+            start = time.perf_counter()
+            for _ in range(buffers):
+                soundfont.render(buffer, False)
+            elapsed = time.perf_counter() - start
+            print(
+                f"  {interpolation.name:6s} {sample_format.name:8s} {soundfont.sample_memory_bytes():8d} bytes"
+                f"  {buffers * frames / SAMPLERATE / elapsed:7.1f}x realtime"
+            )
+
+
+def bench_lazy_samples(loads=20, frames=1024):
+    # Loading a compressed SoundFont and playing its first preset, decoding all samples or only those played
+    print("Lazy sample decoding (florestan-subset.sfo, one preset played)")
+    buffer = bytearray(frames * 8)
+    for name, load in (
+        ("load", lambda: _tinysoundfont.SoundFont("test/florestan-subset.sfo")),
+        ("lazy", lambda: _tinysoundfont.SoundFont.from_mmap("test/florestan-subset.sfo", lazy=True)),
+    ):
+        start = time.perf_counter()
+        for _ in range(loads):
+            soundfont = load()
+            soundfont.set_output(_tinysoundfont.OutputMode.StereoInterleaved, SAMPLERATE, -30.0)
+            for key in range(21, 109, 4):
+                soundfont.note_on(0, key, 0.5)
+            soundfont.render(buffer, False)
+        elapsed = (time.perf_counter() - start) / loads
+        print(f"  {name:5s} load and first render {elapsed * 1e3:7.2f} ms  samples in memory {soundfont.sample_memory_bytes():8d} bytes")
+
+
+def bench_load_threads(loads=5):
+    # Loading an .sf3 whose 55 compressed samples each decode an Ogg stream of 261211 samples
+    print("Decoding compressed samples at load time (florestan-subset as .sf3)")
+    with tempfile.TemporaryDirectory() as directory:
+        filename = os.path.join(directory, "subset.sf3")
+        write_sf3(filename)
+        previous = _tinysoundfont.get_threads()
+        single = None
+        threads = 1
+        while threads <= (os.cpu_count() or 1):
+            _tinysoundfont.set_threads(threads)
+            start = time.perf_counter()
+            for _ in range(loads):
+                _tinysoundfont.SoundFont(filename)
+            elapsed = (time.perf_counter() - start) / loads
+            single = single or elapsed
+            print(f"  {threads:3d} threads load {elapsed * 1e3:7.1f} ms  speedup {single / elapsed:.2f}x")
+            threads *= 2
+        _tinysoundfont.set_threads(previous)
+
+
+if __name__ == "__main__":
+    bench_specialized_render()
+    bench_interpolation()
+    bench_block_size()
+    bench_float_filters()
+    bench_control_rate()
+    bench_voice_scan()
+    bench_voice_stealing()
+    bench_threads()
+    bench_mixer()
+    bench_render_threads()
+    bench_render_events()
+    bench_render_midi()
+    bench_midi_batch()
+    bench_render_midi_wav()
+    bench_render_integer()
+    bench_render_stems()
+    bench_realtime()
+    bench_from_mmap()
+    bench_sample_format()
+    bench_lazy_samples()
+    bench_load_threads()
@@ -0,0 +1,1085 @@
+import math
+import os
+import struct
+import threading
+import time
+import wave
+from concurrent.futures import ThreadPoolExecutor
+
+import numpy as np
+import pytest
+
+from tinysoundfont import _tinysoundfont
+
+
+def render_chord(output_mode, frames=44100, fixed_point_phase=False, float_filters=False):
+    sf = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+    sf.set_output(output_mode, 44100, -14.0)
+    sf.set_fixed_point_phase(fixed_point_phase)
+    sf.set_float_filters(float_filters)
+    sf.channel_set_preset_index(0, 0)
+    for key in (48, 60, 64, 67):
+        sf.channel_note_on(0, key, 0.8)
+    channels = 1 if output_mode == _tinysoundfont.OutputMode.Mono else 2
+    buffer = bytearray(frames * channels * 4)
+    sf.render(buffer, False)
+    return np.frombuffer(buffer, dtype=np.float32)
+
+
+@pytest.fixture
+def restore_simd():
+    level = _tinysoundfont.get_simd()
+    yield
+    _tinysoundfont.set_simd(level)
+
+
+def test_simd_levels(restore_simd):
+    levels = _tinysoundfont.simd_levels()
+    assert levels[0] == "scalar"
+    assert _tinysoundfont.get_simd() in levels
+    with pytest.raises(RuntimeError):
+        _tinysoundfont.set_simd("nonexistent")
+
+
+@pytest.mark.parametrize(
+    "output_mode",
+    [
+        _tinysoundfont.OutputMode.StereoInterleaved,
+        _tinysoundfont.OutputMode.StereoUnweaved,
+        _tinysoundfont.OutputMode.Mono,
+    ],
+)
+def test_simd_matches_scalar(restore_simd, output_mode):
+    _tinysoundfont.set_simd("scalar")
+    expected = render_chord(output_mode)
+    for level in _tinysoundfont.simd_levels():
+        _tinysoundfont.set_simd(level)
+        np.testing.assert_allclose(render_chord(output_mode), expected, rtol=0, atol=1e-6)
+
+
+def test_fast_math():
+    assert isinstance(_tinysoundfont.get_fast_math(), bool)
+
+
+def test_fixed_point_phase():
+    output_mode = _tinysoundfont.OutputMode.StereoInterleaved
+    expected = render_chord(output_mode, frames=4 * 44100)
+    output = render_chord(output_mode, frames=4 * 44100, fixed_point_phase=True)
+    np.testing.assert_allclose(output, expected, rtol=0, atol=1e-6)
+
+
+@pytest.fixture
+def restore_specialized_render():
+    enabled = _tinysoundfont.get_specialized_render()
+    yield
+    _tinysoundfont.set_specialized_render(enabled)
+
+
+@pytest.mark.parametrize("fixed_point_phase", [False, True])
+@pytest.mark.parametrize(
+    "output_mode",
+    [
+        _tinysoundfont.OutputMode.StereoInterleaved,
+        _tinysoundfont.OutputMode.StereoUnweaved,
+        _tinysoundfont.OutputMode.Mono,
+    ],
+)
+def test_specialized_render(restore_specialized_render, output_mode, fixed_point_phase):
+    _tinysoundfont.set_specialized_render(False)
+    expected = render_chord(output_mode, fixed_point_phase=fixed_point_phase)
+    _tinysoundfont.set_specialized_render(True)
+    output = render_chord(output_mode, fixed_point_phase=fixed_point_phase)
+    assert output.tobytes() == expected.tobytes()
+
+
+def sine_soundfont(cycles=170, loop_length=1000, samplerate=44100, root_key=60):
+    """Returns SF2 bytes with one preset looping a sine wave of cycles / loop_length cycles per sample"""
+
+    def chunk(fourcc, data):
+        return fourcc + struct.pack("<I", len(data)) + data + (b"\0" if len(data) % 2 else b"")
+
+    def name(text):
+        return text.encode("ascii").ljust(20, b"\0")
+
+    wave = [round(16000 * math.sin(2 * math.pi * cycles * i / loop_length)) for i in range(loop_length * 2)]
+    # Sample data is followed by 46 zero samples as required by the SF2 specification
+    smpl = struct.pack(f"<{len(wave) + 46}h", *wave, *([0] * 46))
+    info = b"INFO" + chunk(b"ifil", struct.pack("<HH", 2, 1)) + chunk(b"isng", b"EMU8000\0") + chunk(b"INAM", b"Sine\0\0")
+    sdta = b"sdta" + chunk(b"smpl", smpl)
+    pdta = b"pdta" + b"".join(
+        [
+            chunk(b"phdr", struct.pack("<20sHHHIII", name("Sine"), 0, 0, 0, 0, 0, 0) + struct.pack("<20sHHHIII", name("EOP"), 0, 0, 1, 0, 0, 0)),
+            chunk(b"pbag", struct.pack("<HHHH", 0, 0, 1, 0)),
+            chunk(b"pmod", bytes(10)),
+            # instrument = 0
+            chunk(b"pgen", struct.pack("<HHHH", 41, 0, 0, 0)),
+            chunk(b"inst", struct.pack("<20sH", name("Sine"), 0) + struct.pack("<20sH", name("EOI"), 1)),
+            chunk(b"ibag", struct.pack("<HHHH", 0, 0, 2, 0)),
+            chunk(b"imod", bytes(10)),
+            # sampleModes = loop continuously, sampleID = 0
+            chunk(b"igen", struct.pack("<HHHHHH", 54, 1, 53, 0, 0, 0)),
+            chunk(
+                b"shdr",
+                struct.pack("<20sIIIIIBbHH", name("Sine"), 0, len(wave), loop_length // 2, loop_length // 2 + loop_length, samplerate, root_key, 0, 0, 1)
+                + struct.pack("<20sIIIIIBbHH", name("EOS"), 0, 0, 0, 0, 0, 0, 0, 0, 0),
+            ),
+        ]
+    )
+    return chunk(b"RIFF", b"sfbk" + chunk(b"LIST", info) + chunk(b"LIST", sdta) + chunk(b"LIST", pdta))
+
+
+def sine_snr(interpolation, semitones, cycles=170, loop_length=1000, frames=8192):
+    """Render the sine wave pitched up and return the ratio of sine to everything else in dB"""
+    sf = _tinysoundfont.SoundFont(sine_soundfont(cycles, loop_length))
+    sf.set_output(_tinysoundfont.OutputMode.Mono, 44100, 0.0)
+    sf.set_interpolation(interpolation)
+    sf.note_on(0, 60 + semitones, 1.0)
+    buffer = bytearray(frames * 2 * 4)
+    sf.render(buffer, False)
+    # Skip the attack, then fit the expected sine (with any phase) and a DC offset
+    output = np.frombuffer(buffer, dtype=np.float32)[frames:].astype(np.float64)
+    t = 2 * np.pi * cycles / loop_length * 2 ** (semitones / 12) * np.arange(len(output))
+    basis = np.stack([np.cos(t), np.sin(t), np.ones_like(t)], axis=1)
+    fit = basis @ np.linalg.lstsq(basis, output, rcond=None)[0]
+    return 10 * np.log10(np.sum(fit**2) / np.sum((output - fit) ** 2))
+
+
+def test_interpolation():
+    snr = {mode: sine_snr(mode, 3) for mode in _tinysoundfont.Interpolation.__members__.values()}
+    assert snr[_tinysoundfont.Interpolation.Linear] > 20
+    assert snr[_tinysoundfont.Interpolation.Cubic] > snr[_tinysoundfont.Interpolation.Linear] + 6
+    assert snr[_tinysoundfont.Interpolation.Sinc8] > snr[_tinysoundfont.Interpolation.Cubic] + 20
+    assert snr[_tinysoundfont.Interpolation.Sinc16] > snr[_tinysoundfont.Interpolation.Cubic] + 20
+
+
+def sine_level(interpolation, semitones, cycles, loop_length=1000, frames=8192):
+    """Render the sine wave pitched up and return its RMS level after the attack"""
+    sf = _tinysoundfont.SoundFont(sine_soundfont(cycles, loop_length))
+    sf.set_output(_tinysoundfont.OutputMode.Mono, 44100, 0.0)
+    sf.set_interpolation(interpolation)
+    sf.note_on(0, 60 + semitones, 1.0)
+    buffer = bytearray(frames * 2 * 4)
+    sf.render(buffer, False)
+    return np.sqrt(np.mean(np.frombuffer(buffer, dtype=np.float32)[frames:].astype(np.float64) ** 2))
+
+
+def test_interpolation_aliasing():
+    # A sine at 0.8 of the Nyquist frequency pitched up an octave or more is above the output
+    # Nyquist frequency. Windowed-sinc filters it out instead of folding it back into the audio band.
+    reference = sine_level(_tinysoundfont.Interpolation.Linear, 0, 400)
+    for semitones in (12, 19, 24):
+        level = {mode: 20 * np.log10(sine_level(mode, semitones, 400) / reference) for mode in _tinysoundfont.Interpolation.__members__.values()}
+        assert level[_tinysoundfont.Interpolation.Linear] > -10
+        assert level[_tinysoundfont.Interpolation.Sinc8] < -20
+        assert level[_tinysoundfont.Interpolation.Sinc16] < -60
+    # Without pitching the sine is kept
+    assert sine_level(_tinysoundfont.Interpolation.Sinc16, 0, 400) > 0.8 * reference
+
+
+@pytest.mark.parametrize("interpolation", list(_tinysoundfont.Interpolation.__members__.values()))
+def test_interpolation_specialized_render(restore_specialized_render, interpolation):
+    output_mode = _tinysoundfont.OutputMode.StereoInterleaved
+    results = []
+    for enabled in (False, True):
+        _tinysoundfont.set_specialized_render(enabled)
+        sf = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+        sf.set_output(output_mode, 44100, -14.0)
+        sf.set_interpolation(interpolation)
+        sf.note_on(0, 72, 0.8)
+        buffer = bytearray(44100 * 2 * 4)
+        sf.render(buffer, False)
+        results.append(bytes(buffer))
+    assert results[0] == results[1]
+
+
+def render_note_mono(block_size, gain_ramp):
+    sf = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+    sf.set_output(_tinysoundfont.OutputMode.Mono, 44100, -6.0)
+    sf.set_block_size(block_size, gain_ramp)
+    # Half a second of the note, then half a second of release
+    sustain = bytearray(22050 * 4)
+    release = bytearray(22050 * 4)
+    sf.note_on(0, 60, 0.8)
+    sf.render(sustain, False)
+    sf.note_off(0, 60)
+    sf.render(release, False)
+    return np.frombuffer(sustain + release, dtype=np.float32).astype(np.float64)
+
+
+def test_block_size_gain_ramp():
+    # Updating every sample is the reference without any gain steps
+    reference = render_note_mono(1, False)
+
+    def error(output):
+        return np.sum((output - reference) ** 2) / np.sum(reference**2)
+
+    default = render_note_mono(64, False)
+    large = render_note_mono(256, False)
+    large_ramp = render_note_mono(256, True)
+    assert error(large) > error(default)
+    assert error(large_ramp) < error(default)
+    with pytest.raises(RuntimeError):
+        render_note_mono(0, True)
+
+
+def test_float_filters():
+    output_mode = _tinysoundfont.OutputMode.StereoInterleaved
+    expected = render_chord(output_mode)
+    output = render_chord(output_mode, float_filters=True)
+    np.testing.assert_allclose(output, expected, rtol=0, atol=1e-5)
+
+
+@pytest.mark.parametrize(
+    "output_mode",
+    [
+        _tinysoundfont.OutputMode.StereoInterleaved,
+        _tinysoundfont.OutputMode.StereoUnweaved,
+        _tinysoundfont.OutputMode.Mono,
+    ],
+)
+def test_float_filters_specialized_render(restore_specialized_render, output_mode):
+    # Filters of several voices are processed together only with the specialized render
+    _tinysoundfont.set_specialized_render(False)
+    expected = render_chord(output_mode, float_filters=True)
+    _tinysoundfont.set_specialized_render(True)
+    output = render_chord(output_mode, float_filters=True)
+    assert output.tobytes() == expected.tobytes()
+
+
+def test_active_voice_count():
+    sf = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+    sf.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -14.0)
+    sf.set_max_voices(1024)
+    assert sf.active_voice_count() == 0
+    for key in range(40, 80):
+        sf.note_on(0, key, 0.8)
+    voices = sf.active_voice_count()
+    assert voices >= 40
+    sf.note_off(0, 60)
+    assert sf.active_voice_count() == voices
+    sf.note_off()
+    buffer = bytearray(4 * 44100 * 2 * 4)
+    sf.render(buffer, False)
+    assert sf.active_voice_count() == 0
+    # With all voices playing, new notes replace voices in their release phase
+    sf = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+    sf.set_max_voices(8)
+    for key in range(40, 80):
+        sf.note_on(0, key, 0.8)
+        sf.note_off(0, key)
+        assert sf.active_voice_count() <= 8
+    assert sf.active_voice_count() == 8
+
+
+def test_channel_note_off_index():
+    sf = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+    sf.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -14.0)
+    sf.set_max_voices(256)
+    for channel in range(16):
+        sf.channel_set_preset_index(channel, 0)
+    # Retriggered key: note off ends the oldest note only
+    for channel in range(16):
+        sf.channel_note_on(channel, 60, 0.8)
+        sf.channel_note_on(channel, 60, 0.8)
+    voices = sf.active_voice_count()
+    for channel in range(0, 16, 2):
+        sf.channel_note_off(channel, 60)
+        sf.channel_note_off(channel, 60)
+    sf.channel_note_off(1, 60)
+    buffer = bytearray(4 * 44100 * 2 * 4)
+    sf.render(buffer, False)
+    # Odd channels keep playing, channel 1 only its second note
+    assert sf.active_voice_count() == voices // 32 * 15
+
+
+def test_voice_stealing():
+    # Sustained notes with all voices playing: nothing is in its release phase to replace
+    counts = {}
+    for policy in _tinysoundfont.VoiceStealing.__members__.values():
+        sf = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+        sf.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -14.0)
+        sf.set_max_voices(8)
+        sf.set_voice_stealing(policy)
+        buffer = bytearray(64 * 2 * 4)
+        for key in range(40, 80):
+            sf.note_on(0, key, 0.8)
+            sf.render(buffer, False)
+            assert sf.active_voice_count() <= 8 + 8
+        counts[policy] = (sf.stolen_voice_count(), sf.dropped_voice_count())
+    assert counts[_tinysoundfont.VoiceStealing.Release][1] > 0
+    assert counts[_tinysoundfont.VoiceStealing.Quietest][0] > 0
+    assert counts[_tinysoundfont.VoiceStealing.Quietest][1] == 0
+
+
+def test_copy_max_voices():
+    # A copy of a SoundFont with a voice limit gets voices of its own up to the same limit
+    sf = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+    sf.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -14.0)
+    sf.set_max_voices(64)
+    copy = _tinysoundfont.SoundFont(sf)
+    buffers = []
+    for soundfont in (sf, copy):
+        for key in range(40, 80):
+            soundfont.note_on(0, key, 0.8)
+        assert 40 <= soundfont.active_voice_count() <= 64
+        buffer = bytearray(4096 * 2 * 4)
+        soundfont.render(buffer, False)
+        buffers.append(buffer)
+    assert buffers[0] == buffers[1]
+
+
+def render_song(key, frames=2 * 44100):
+    sf = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+    sf.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -14.0)
+    sf.set_interpolation(_tinysoundfont.Interpolation.Sinc16)
+    for offset in range(0, 36, 3):
+        sf.note_on(0, key + offset, 0.8)
+    buffer = bytearray(frames * 2 * 4)
+    sf.render(buffer, False)
+    return bytes(buffer)
+
+
+def test_render_threads():
+    # Separate SoundFont objects rendering at the same time give the same output as one by one
+    # (bench_threads in benchmark.py measures how rendering scales with threads)
+    keys = [30 + 5 * i for i in range(4)]
+    expected = [render_song(key) for key in keys]
+    with ThreadPoolExecutor(4) as pool:
+        output = list(pool.map(render_song, keys))
+    assert output == expected
+
+
+def test_render_threads_shared():
+    # Calls on one SoundFont from several threads wait for each other
+    sf = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+    sf.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -14.0)
+    sf.set_max_voices(64)
+    done = threading.Event()
+    counts = []
+
+    def play():
+        # Plays at least once, and once more after the last render
+        while True:
+            stop = done.is_set()
+            for key in range(40, 80):
+                sf.note_on(0, key, 0.8)
+                sf.note_off(0, key)
+            counts.append(sf.active_voice_count())
+            if stop:
+                return
+
+    player = threading.Thread(target=play)
+    player.start()
+    buffer = bytearray(1024 * 2 * 4)
+    try:
+        for _ in range(200):
+            sf.render(buffer, False)
+    finally:
+        done.set()
+        player.join()
+    assert counts and max(counts) <= 64
+    # The player released its last notes after the final render. Copies share the samples but not the voices
+    copy = _tinysoundfont.SoundFont(sf)
+    assert sf.active_voice_count() > 0
+    assert copy.active_voice_count() == 0
+
+
+@pytest.fixture
+def restore_threads():
+    threads = _tinysoundfont.get_threads()
+    yield
+    _tinysoundfont.set_threads(threads)
+
+
+def mixer_soundfonts(count):
+    soundfonts = []
+    for i in range(count):
+        sf = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+        sf.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -14.0)
+        for key in range(36 + i, 84, 4):
+            sf.note_on(0, key, 0.8)
+        soundfonts.append(sf)
+    return soundfonts
+
+
+def test_mixer(restore_threads):
+    frames = 1000
+    # Reference: the loop Synth.generate_simple used before the mixer, rendering each SoundFont
+    # in turn with mix=True after the first
+    expected = bytearray()
+    soundfonts = mixer_soundfonts(4)
+    soundfonts[1].set_block_size(256, True)
+    soundfonts[2].set_float_filters(True)
+    for _ in range(20):
+        buffer = bytearray(frames * 2 * 4)
+        for i, sf in enumerate(soundfonts):
+            sf.render(buffer, i > 0)
+        expected += buffer
+    for threads in (1, 2, 4):
+        _tinysoundfont.set_threads(threads)
+        assert _tinysoundfont.get_threads() == threads
+        output = bytearray()
+        soundfonts = mixer_soundfonts(4)
+        soundfonts[1].set_block_size(256, True)
+        soundfonts[2].set_float_filters(True)
+        mixer = _tinysoundfont.Mixer()
+        for _ in range(20):
+            buffer = bytearray(frames * 2 * 4)
+            mixer.render(soundfonts, buffer, False)
+            output += buffer
+        assert output == expected
+    # A single SoundFont renders directly
+    buffer = bytearray(frames * 2 * 4)
+    mixer_soundfonts(1)[0].render(buffer, False)
+    single = bytearray(frames * 2 * 4)
+    _tinysoundfont.Mixer().render(mixer_soundfonts(1), single, False)
+    assert single == buffer
+    with pytest.raises(RuntimeError):
+        _tinysoundfont.set_threads(0)
+
+
+def test_mixer_errors():
+    mixer = _tinysoundfont.Mixer()
+    soundfonts = mixer_soundfonts(2)
+    buffer = bytearray(1024 * 2 * 4)
+    with pytest.raises(RuntimeError):
+        mixer.render([soundfonts[0], soundfonts[0]], buffer, False)
+    soundfonts[1].set_output(_tinysoundfont.OutputMode.Mono, 44100, -14.0)
+    with pytest.raises(RuntimeError):
+        mixer.render(soundfonts, buffer, False)
+    buffer[:] = b"\1" * len(buffer)
+    mixer.render([], buffer, False)
+    assert buffer == bytearray(len(buffer))
+
+
+def render_many_voices(render_threads, frames=44100):
+    sf = _tinysoundfont.SoundFont("test/florestan-subset.sfo")
+    sf.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -30.0)
+    sf.set_render_threads(render_threads)
+    for i in range(300):
+        sf.note_on(i % 20, 30 + (i * 7) % 60, 0.8)
+    buffer = bytearray(frames * 2 * 4)
+    sf.render(buffer, False)
+    return np.frombuffer(buffer, dtype=np.float32)
+
+
+def test_set_render_threads(restore_threads):
+    expected = render_many_voices(1)
+    outputs = []
+    for threads in (1, 2, 4):
+        _tinysoundfont.set_threads(threads)
+        outputs.append(render_many_voices(4).tobytes())
+    # Same chunks and summation order for any number of threads in the pool
+    assert outputs[0] == outputs[1] == outputs[2]
+    np.testing.assert_allclose(np.frombuffer(outputs[0], dtype=np.float32), expected, rtol=0, atol=1e-5)
+    with pytest.raises(RuntimeError):
+        _tinysoundfont.SoundFont("test/florestan-piano.sf2").set_render_threads(0)
+
+
+def event_soundfont():
+    sf = _tinysoundfont.SoundFont("test/florestan-subset.sfo")
+    sf.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -14.0)
+    for channel in range(4):
+        sf.channel_set_preset_number(channel, 0, False)
+    return sf
+
+
+def test_render_events():
+    M = _tinysoundfont.MidiMessageType
+    frames = 4096
+    events = np.array(
+        [
+            (0, int(M.NOTE_ON), 0, 60, 100),
+            (0, int(M.NOTE_ON), 1, 64, 80),
+            (100, int(M.PITCH_BEND), 0, 12000, 0),
+            (513, int(M.CONTROL_CHANGE), 1, 7, 40),
+            (513, int(M.NOTE_OFF), 0, 60, 0),
+            (1500, int(M.PROGRAM_CHANGE), 2, 40, 0),
+            (1500, int(M.NOTE_ON), 2, 67, 127),
+            (3000, int(M.NOTE_ON), 1, 64, 0),
+            (frames, int(M.NOTE_OFF), 2, 67, 0),
+        ],
+        dtype=np.int32,
+    )
+    sf = event_soundfont()
+    buffer = bytearray(frames * 2 * 4)
+    sf.render_events(buffer, events)
+    # Same as applying the events between render calls that end at each offset
+    expected_sf = event_soundfont()
+    expected = memoryview(bytearray(frames * 2 * 4))
+    position = 0
+    for offset, kind, channel, data1, data2 in events.tolist():
+        if offset > position:
+            expected_sf.render(expected[position * 8 : offset * 8], False)
+            position = offset
+        if kind == int(M.NOTE_ON):
+            expected_sf.channel_note_on(channel, data1, data2 / 127.0)
+        elif kind == int(M.NOTE_OFF):
+            expected_sf.channel_note_off(channel, data1)
+        elif kind == int(M.CONTROL_CHANGE):
+            expected_sf.channel_midi_control(channel, data1, data2)
+        elif kind == int(M.PROGRAM_CHANGE):
+            expected_sf.channel_set_preset_number(channel, data1, data2 != 0)
+        elif kind == int(M.PITCH_BEND):
+            expected_sf.channel_set_pitch_wheel(channel, data1)
+    assert bytes(buffer) == bytes(expected)
+    assert sf.active_voice_count() == expected_sf.active_voice_count()
+    # Events can also be flat, and an empty list renders like render
+    sf.render_events(buffer, events[:0].reshape(-1))
+    with pytest.raises(RuntimeError):
+        sf.render_events(buffer, events[::-1].copy())
+    with pytest.raises(RuntimeError):
+        sf.render_events(bytearray(1000 * 2 * 4), events)
+    with pytest.raises(RuntimeError):
+        sf.render_events(buffer, events.astype(np.float32))
+    with pytest.raises(RuntimeError):
+        sf.render_events(buffer, np.array([(0, int(M.NOTE_ON), 16, 60, 100)], dtype=np.int32))
+
+
+def test_render_midi():
+    with open("test/1080-c01.mid", "rb") as fin:
+        midi = fin.read()
+    sf = _tinysoundfont.SoundFont("test/florestan-subset.sfo")
+    sf.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -14.0)
+    # Copies used to be silent when the original had a voice limit
+    sf.set_max_voices(256)
+    audio = _tinysoundfont.render_midi(sf, midi, 22050, 0.5)
+    length = _tinysoundfont._midi_load_memory(midi)[-1]["t"]
+    assert abs(len(audio) // 8 - (length + 0.5) * 22050) <= 1
+    block = np.frombuffer(audio, dtype=np.float32)
+    assert np.all(np.isfinite(block))
+    assert block.min() < -0.01 and block.max() > 0.01
+    assert _tinysoundfont.render_midi(sf, midi, 22050, 0.5) == audio
+    # The SoundFont itself does not play anything
+    assert sf.active_voice_count() == 0
+    sf.set_output(_tinysoundfont.OutputMode.Mono, 44100, -14.0)
+    assert len(_tinysoundfont.render_midi(sf, midi, 22050, 0.5)) == len(audio) // 2
+    with pytest.raises(RuntimeError):
+        _tinysoundfont.render_midi(sf, b"not a midi file", 22050, 0.5)
+    with pytest.raises(RuntimeError):
+        _tinysoundfont.render_midi(sf, midi, 22050, -1.0)
+
+
+def test_midi_batch():
+    with open("test/1080-c01.mid", "rb") as fin:
+        midi = fin.read()
+    with open("test/drum.mid", "rb") as fin:
+        drum = fin.read()
+    sf = _tinysoundfont.SoundFont("test/florestan-subset.sfo")
+    sf.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -14.0)
+    sf.set_max_voices(64)
+    batch = _tinysoundfont.MidiBatch(sf, [midi, "test/drum.mid", b"not a midi file", "test/1080-c01.mid"], 22050, 0.5, 2)
+    assert len(batch) == 4
+    results = sorted(batch, key=lambda result: result.index)
+    assert [result.index for result in results] == [0, 1, 2, 3]
+    # Copies are reused between songs, but each song renders like with a new copy
+    expected = _tinysoundfont.render_midi(sf, midi, 22050, 0.5)
+    assert results[0].audio == expected
+    assert results[1].audio == _tinysoundfont.render_midi(sf, drum, 22050, 0.5)
+    assert results[3].audio == expected
+    assert results[2].audio is None
+    assert "MIDI" in results[2].error
+    assert results[0].error is None
+    assert all(result.seconds > 0.0 for result in results)
+    # Deleting a batch cancels the songs that have not started
+    batch = _tinysoundfont.MidiBatch(sf, [midi] * 8, 22050, 0.5, 1)
+    assert next(batch).audio == expected
+    del batch
+    with pytest.raises(RuntimeError):
+        _tinysoundfont.MidiBatch(sf, [1234])
+
+
+def test_render_midi_wav(tmp_path):
+    with open("test/1080-c01.mid", "rb") as fin:
+        midi = fin.read()
+    sf = _tinysoundfont.SoundFont("test/florestan-subset.sfo")
+    sf.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -14.0)
+    expected = _tinysoundfont.render_midi(sf, midi, 22050, 0.5)
+    # Rendering a piece at a time gives the same samples as render_midi
+    path = str(tmp_path / "song.wav")
+    frames = _tinysoundfont.render_midi_wav(sf, midi, path, 22050, 0.5)
+    assert frames == len(expected) // 8
+    with open(path, "rb") as fin:
+        contents = fin.read()
+    assert contents[:4] == b"RIFF" and contents[8:12] == b"WAVE"
+    assert contents[-len(expected) :] == expected
+    # Integer formats can be read by the wave module, also when written to a file descriptor
+    for wav_format, width in ((_tinysoundfont.WavFormat.Int16, 2), (_tinysoundfont.WavFormat.Int24, 3)):
+        with open(path, "wb") as fout:
+            _tinysoundfont.render_midi_wav(sf, midi, fout.fileno(), 22050, 0.5, wav_format)
+        with wave.open(path) as fin:
+            assert fin.getnchannels() == 2
+            assert fin.getsampwidth() == width
+            assert fin.getframerate() == 22050
+            assert fin.getnframes() == frames
+    with wave.open(path) as fin:
+        samples = np.frombuffer(fin.readframes(1000), dtype=np.uint8).reshape(-1, 3)
+    values = (samples[:, 0].astype(np.int32) | (samples[:, 1].astype(np.int32) << 8) | (samples[:, 2].astype(np.int32) << 16)) << 8 >> 8
+    reference = np.clip(np.frombuffer(expected[: 1000 * 8], dtype=np.float32), -1.0, 1.0) * 8388607
+    assert np.max(np.abs(values - reference)) <= 0.5
+    # int16 samples are the same as rendering into an int16 buffer, converted like tsf_render_short
+    _tinysoundfont.render_midi_wav(sf, midi, path, 22050, 0.5, _tinysoundfont.WavFormat.Int16)
+    with wave.open(path) as fin:
+        values = np.frombuffer(fin.readframes(1000), dtype="<i2")
+    reference = np.frombuffer(expected[: 1000 * 8], dtype=np.float32)
+    low, high = reference < -1.00004566, reference > 1.00001514
+    np.testing.assert_array_equal(values, np.where(low, -32768, np.where(high, 32767, np.trunc(reference * np.float32(32767.5)))))
+    with pytest.raises(RuntimeError):
+        _tinysoundfont.render_midi_wav(sf, midi, 1.5, 22050, 0.5)
+    with pytest.raises(RuntimeError):
+        _tinysoundfont.render_midi_wav(sf, midi, str(tmp_path / "missing" / "song.wav"), 22050, 0.5)
+
+
+def loud_soundfont():
+    sf = _tinysoundfont.SoundFont("test/florestan-subset.sfo")
+    sf.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, 6.0)
+    sf.channel_set_preset_index(0, 0)
+    for key in range(40, 90, 3):
+        sf.channel_note_on(0, key, 1.0)
+    return sf
+
+
+@pytest.mark.parametrize("level", _tinysoundfont.simd_levels())
+def test_render_integer(restore_simd, level):
+    _tinysoundfont.set_simd(level)
+    reference = np.zeros((10000, 2), dtype=np.float32)
+    loud_soundfont().render(reference, False)
+    # Without dither int16 samples are converted like tsf_render_short
+    low, high = reference < -1.00004566, reference > 1.00001514
+    expected = np.where(low, -32768, np.where(high, 32767, np.trunc(reference * np.float32(32767.5)))).astype(np.int16)
+    sf = loud_soundfont()
+    output = np.zeros((10000, 2), dtype=np.int16)
+    sf.render(output, False)
+    np.testing.assert_array_equal(output, expected)
+    clipped = int(np.count_nonzero(low | high))
+    assert clipped > 0
+    assert sf.clipped_sample_count() == clipped
+    # Mixing saturates and counts the saturated sums as clipped
+    sf = loud_soundfont()
+    output = np.full((10000, 2), 30000, dtype=np.int16)
+    sf.render(output, True)
+    total = expected.astype(np.int32) + 30000
+    np.testing.assert_array_equal(output, np.clip(total, -32768, 32767))
+    assert sf.clipped_sample_count() == np.count_nonzero(low | high | (total > 32767) | (total < -32768))
+    # int32 samples are rounded, 1.0 and above clip to the maximum
+    sf = loud_soundfont()
+    output = np.zeros((10000, 2), dtype=np.int32)
+    sf.render(output, False)
+    scaled = reference.astype(np.float64) * 2**31
+    expected32 = np.where(reference >= 1.0, 2**31 - 1, np.where(reference < -1.0, -(2**31), np.rint(scaled)))
+    np.testing.assert_array_equal(output, expected32.astype(np.int32))
+    assert sf.clipped_sample_count() == np.count_nonzero((reference >= 1.0) | (reference < -1.0))
+    # Dither is repeatable from a new SoundFont and adds no offset
+    outputs = []
+    for _ in range(2):
+        sf = loud_soundfont()
+        output = np.zeros((10000, 2), dtype=np.int16)
+        sf.render(output, False, dither=True)
+        outputs.append(output)
+    np.testing.assert_array_equal(outputs[0], outputs[1])
+    assert np.any(outputs[0] != expected)
+    inside = ~(low | high)
+    error = outputs[0][inside].astype(np.float64) - reference[inside].astype(np.float64) * 32767.5
+    assert abs(np.mean(error)) < 0.05
+    assert np.max(np.abs(error)) <= 1.5
+    # Other integer types are not accepted
+    with pytest.raises(RuntimeError):
+        loud_soundfont().render(np.zeros((100, 2), dtype=np.int8), False)
+
+
+def stem_soundfont(output_mode=_tinysoundfont.OutputMode.StereoInterleaved):
+    sf = _tinysoundfont.SoundFont("test/florestan-subset.sfo")
+    sf.set_output(output_mode, 44100, -20.0)
+    for channel in range(16):
+        sf.channel_set_preset_index(channel, channel % sf.get_preset_count())
+    for i in range(60):
+        sf.channel_note_on(i % 5, 30 + (i * 7) % 60, 0.8)
+    return sf
+
+
+def test_render_stems(restore_threads):
+    frames = 4096
+    expected = np.zeros((frames, 2), dtype=np.float32)
+    stem_soundfont().render(expected, False)
+    stems = np.zeros((16, frames, 2), dtype=np.float32)
+    sf = stem_soundfont()
+    sf.render_stems(stems)
+    # Each channel renders into its own stem, together they give the normal render
+    assert np.any(stems[0])
+    assert not np.any(stems[5:])
+    np.testing.assert_allclose(np.sum(stems, axis=0), expected, rtol=0, atol=1e-6)
+    # Stems are stereo in any output mode, and the same when rendered in parallel
+    output = np.zeros((16, frames, 2), dtype=np.float32)
+    stem_soundfont(_tinysoundfont.OutputMode.Mono).render_stems(output)
+    np.testing.assert_array_equal(output, stems)
+    for threads in (1, 4):
+        _tinysoundfont.set_threads(threads)
+        sf = stem_soundfont()
+        sf.set_render_threads(4)
+        sf.render_stems(output)
+        np.testing.assert_array_equal(output, stems)
+    # Fewer stems drop the other channels, mixing adds to the buffer
+    output = np.ones((3, frames, 2), dtype=np.float32)
+    stem_soundfont().render_stems(output, True)
+    np.testing.assert_allclose(output, stems[:3] + np.float32(1.0), rtol=0, atol=1e-6)
+    # Bus gain and pan scale the sides of a stem
+    sf = stem_soundfont()
+    sf.set_stem_bus(1, -6.0, 0.0)
+    sf.set_stem_bus(2, pan=0.75)
+    output = np.zeros((16, frames, 2), dtype=np.float32)
+    sf.render_stems(output)
+    np.testing.assert_allclose(output[1, :, 0], stems[1, :, 0] * 10 ** (-6.0 / 20), rtol=1e-5, atol=1e-7)
+    assert not np.any(output[1, :, 1])
+    np.testing.assert_array_equal(output[2, :, 0], stems[2, :, 0] * np.float32(0.5))
+    np.testing.assert_array_equal(output[2, :, 1], stems[2, :, 1])
+    np.testing.assert_array_equal(output[3:], stems[3:])
+    with pytest.raises(RuntimeError):
+        sf.render_stems(np.zeros((16, frames), dtype=np.float32))
+    with pytest.raises(RuntimeError):
+        sf.render_stems(np.zeros((16, frames, 2), dtype=np.float32)[:, ::2])
+    with pytest.raises(RuntimeError):
+        sf.set_stem_bus(-1, 0.0, 0.5)
+
+
+def test_queue_event():
+    M = _tinysoundfont.MidiMessageType
+    sf = event_soundfont()
+    assert sf.get_frame_position() == 0
+    # Queued out of order, the event at frame 300 waits for the event at frame 700 before it
+    assert sf.queue_event(M.NOTE_ON, 0, 60, 100, frame=100)
+    assert sf.queue_event(M.NOTE_ON, 1, 64, 80, frame=700)
+    assert sf.queue_event(M.NOTE_OFF, 0, 60, frame=300)
+    assert sf.queue_event(M.PITCH_BEND, 1, 12000, frame=1500)
+    buffer = bytearray(1024 * 8)
+    output = b""
+    for _ in range(2):
+        sf.render(buffer)
+        output += bytes(buffer)
+    assert sf.get_frame_position() == 2048
+    # Same as render_events with the events at their offsets in each buffer
+    expected_sf = event_soundfont()
+    expected = b""
+    for events in ([(100, int(M.NOTE_ON), 0, 60, 100), (700, int(M.NOTE_ON), 1, 64, 80), (700, int(M.NOTE_OFF), 0, 60, 0)], [(476, int(M.PITCH_BEND), 1, 12000, 0)]):
+        expected_sf.render_events(buffer, np.array(events, dtype=np.int32))
+        expected += bytes(buffer)
+    assert output == expected
+    # Events for past frames apply at the start of the next render, also with render_events and render_stems
+    sf.queue_event(M.NOTE_ON, 2, 67, 127)
+    stems = np.zeros((16, 256, 2), dtype=np.float32)
+    sf.render_stems(stems)
+    assert np.any(stems[2])
+    sf.queue_event(M.NOTE_OFF, 2, 67, frame=sf.get_frame_position() + 10)
+    sf.render_events(buffer, np.zeros((0, 5), dtype=np.int32))
+    assert sf.get_frame_position() == 2048 + 256 + 1024
+    with pytest.raises(RuntimeError):
+        sf.queue_event(M.NOTE_ON, 16, 60, 100)
+    with pytest.raises(RuntimeError):
+        sf.queue_event(M.NOTE_ON, 0, 128, 100)
+    # A full queue refuses events without waiting
+    queued = 0
+    while sf.queue_event(M.CONTROL_CHANGE, 0, 7, 100, frame=10**9):
+        queued += 1
+    assert queued == 4096
+
+
+def test_queue_event_threads():
+    # Events queued by another thread while a Mixer renders are applied in order
+    M = _tinysoundfont.MidiMessageType
+    sf = event_soundfont()
+    mixer = _tinysoundfont.Mixer()
+    buffer = bytearray(256 * 8)
+    stop = threading.Event()
+
+    def control():
+        for i in range(2000):
+            key = 40 + i % 40
+            while not sf.queue_event(M.NOTE_ON, i % 4, key, 100, frame=sf.get_frame_position() + 64):
+                time.sleep(0.001)
+            sf.queue_event(M.NOTE_OFF, i % 4, key, frame=sf.get_frame_position() + 128)
+        stop.set()
+
+    thread = threading.Thread(target=control)
+    thread.start()
+    renders = 0
+    while not stop.is_set():
+        mixer.render([sf], buffer, False)
+        renders += 1
+    thread.join()
+    mixer.render([sf], buffer, False)
+    assert sf.get_frame_position() == (renders + 1) * 256
+    # All events were taken off the queue
+    queued = 0
+    while sf.queue_event(M.CONTROL_CHANGE, 0, 7, 100, frame=10**9):
+        queued += 1
+    assert queued == 4096
+
+
+def test_queue_event_producers():
+    # Several threads queueing at once fill the queue exactly once
+    M = _tinysoundfont.MidiMessageType
+    sf = event_soundfont()
+
+    def producer(channel):
+        queued = 0
+        while sf.queue_event(M.CONTROL_CHANGE, channel, 7, 100, frame=10**9):
+            queued += 1
+        return queued
+
+    with ThreadPoolExecutor(max_workers=4) as executor:
+        counts = list(executor.map(producer, range(4)))
+    assert sum(counts) == 4096
+
+
+def realtime_song(sf, renders=40, frames=512):
+    output = b""
+    buffer = bytearray(frames * 8)
+    for i in range(renders):
+        for k in range(4):
+            sf.note_on(0, 0, 30 + (i * 7 + k * 5) % 60, 0.7)
+        if i == 20:
+            sf.reset()
+            sf.channel_set_preset_number(5, 0, False)
+            sf.channel_note_on(5, 60, 1.0)
+        sf.render(buffer)
+        output += bytes(buffer)
+    return output
+
+
+def test_realtime():
+    assert isinstance(_tinysoundfont.get_realtime_checks(), bool)
+    expected = realtime_song(event_soundfont())
+    # Reserving enough voices and channels up front does not change the output
+    sf = event_soundfont()
+    assert not sf.get_realtime()
+    sf.set_realtime(True, voices=1024, channels=16)
+    assert sf.get_realtime()
+    assert realtime_song(sf) == expected
+    assert sf.dropped_voice_count() == 0
+    # Channels beyond the reserve fail instead of allocating
+    with pytest.raises(RuntimeError):
+        sf.channel_set_pan(16, 0.5)
+    # Notes beyond the reserved voices are dropped
+    sf = event_soundfont()
+    sf.set_realtime(True, voices=8)
+    for key in range(40, 80):
+        sf.note_on(0, 0, key, 1.0)
+    assert sf.active_voice_count() <= 8
+    assert sf.dropped_voice_count() > 0
+    # A render with few free voices left asks the next queue_event to double them
+    sf.render(bytearray(64 * 8))
+    sf.queue_event(_tinysoundfont.MidiMessageType.NOTE_OFF, 0, 40)
+    sf.reset()
+    sf.render(bytearray(4096 * 8))
+    assert sf.active_voice_count() == 0
+    for key in range(40, 80):
+        sf.note_on(0, 0, key, 1.0)
+    assert 8 < sf.active_voice_count() <= 16
+    sf.set_realtime(False)
+    sf.channel_set_pan(16, 0.5)
+    with pytest.raises(RuntimeError):
+        sf.set_realtime(True, voices=-1)
+
+
+def test_realtime_no_allocation(restore_threads):
+    # In a build with realtime checks, any allocation below aborts the process: notes and channel
+    # events, and every kind of render on one and several threads, with scratch buffers reserved
+    # by set_realtime
+    M = _tinysoundfont.MidiMessageType
+    frames = 1024
+    _tinysoundfont.set_threads(4)
+    for render_threads in (1, 4):
+        sf = event_soundfont()
+        sf.set_render_threads(render_threads)
+        sf.set_realtime(True, voices=256, channels=16, frames=frames)
+        stems = np.zeros((16, frames, 2), dtype=np.float32)
+        events = np.array([(0, int(M.NOTE_ON), 3, 50, 90), (500, int(M.NOTE_OFF), 3, 50, 0)], dtype=np.int32)
+        for i in range(24):
+            for channel in range(16):
+                sf.channel_set_preset_number(channel, 0, False)
+                sf.channel_set_pan(channel, channel / 15)
+                sf.channel_midi_control(channel, 7, 100)
+            for k in range(8):
+                sf.channel_note_on(i % 16, 30 + (i * 7 + k * 5) % 60, 0.8)
+            sf.note_on(0, 0, 40 + i, 0.7)
+            sf.note_off(0, 0, 40 + i - 1)
+            sf.channel_note_off((i + 3) % 16, 40)
+            sf.channel_set_pitch_wheel(i % 16, 4096 + i * 100)
+            sf.queue_event(M.NOTE_ON, i % 4, 60 + i, 100, frame=sf.get_frame_position() + 100)
+            kind = i % 4
+            if kind == 0:
+                sf.render(bytearray(frames * 8))
+            elif kind == 1:
+                sf.render(np.zeros((frames, 2), dtype=np.int16), dither=True)
+            elif kind == 2:
+                sf.render_stems(stems)
+            else:
+                sf.render_events(bytearray(frames * 8), events)
+        assert sf.active_voice_count() > 16
+        sf.reset()
+
+
+def render_loaded(sf, interpolation, frames=22050):
+    sf.set_output(_tinysoundfont.OutputMode.StereoInterleaved, 44100, -14.0)
+    sf.set_interpolation(interpolation)
+    for key in range(30, 90, 7):
+        sf.note_on(0, key, 0.8)
+    buffer = bytearray(frames * 2 * 4)
+    sf.render(buffer, False)
+    return bytes(buffer)
+
+
+@pytest.mark.parametrize("level", _tinysoundfont.simd_levels())
+def test_from_mmap(restore_simd, level):
+    _tinysoundfont.set_simd(level)
+    # Uncompressed samples are read from the mapping with the same output
+    for interpolation in _tinysoundfont.Interpolation.__members__.values():
+        mapped = _tinysoundfont.SoundFont.from_mmap("test/florestan-piano.sf2")
+        assert mapped.sample_memory_bytes() == 0
+        expected = render_loaded(_tinysoundfont.SoundFont("test/florestan-piano.sf2"), interpolation)
+        assert render_loaded(mapped, interpolation) == expected
+    # Copies keep the mapping after the original is gone
+    copy = _tinysoundfont.SoundFont(mapped)
+    del mapped
+    assert render_loaded(copy, _tinysoundfont.Interpolation.Linear) == render_loaded(
+        _tinysoundfont.SoundFont("test/florestan-piano.sf2"), _tinysoundfont.Interpolation.Linear
+    )
+    # Compressed samples are decoded into memory
+    mapped = _tinysoundfont.SoundFont.from_mmap("test/florestan-subset.sfo")
+    assert mapped.sample_memory_bytes() == _tinysoundfont.SoundFont("test/florestan-subset.sfo").sample_memory_bytes() > 0
+    with pytest.raises(RuntimeError):
+        _tinysoundfont.SoundFont.from_mmap("test/missing.sf2")
+    with pytest.raises(RuntimeError):
+        _tinysoundfont.SoundFont.from_mmap("test/drum.mid")
+
+
+@pytest.mark.parametrize("level", _tinysoundfont.simd_levels())
+def test_sample_format(restore_simd, level):
+    _tinysoundfont.set_simd(level)
+    F = _tinysoundfont.SampleFormat
+    for interpolation in (_tinysoundfont.Interpolation.Linear, _tinysoundfont.Interpolation.Sinc8):
+        expected = render_loaded(_tinysoundfont.SoundFont("test/florestan-piano.sf2"), interpolation)
+        sf = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+        assert sf.get_sample_format() == F.Float32
+        size = sf.sample_memory_bytes()
+        # 16-bit integers hold the original samples exactly
+        sf.set_sample_format(F.Int16)
+        assert sf.get_sample_format() == F.Int16
+        assert sf.sample_memory_bytes() == size // 2
+        assert render_loaded(sf, interpolation) == expected
+        # Half-precision floats are close, and the same for every SIMD level
+        sf = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+        sf.set_sample_format(F.Float16)
+        assert sf.sample_memory_bytes() == size // 2
+        output = render_loaded(sf, interpolation)
+        np.testing.assert_allclose(np.frombuffer(output, dtype=np.float32), np.frombuffer(expected, dtype=np.float32), rtol=0, atol=1e-3)
+        _tinysoundfont.set_simd("scalar")
+        sf = _tinysoundfont.SoundFont("test/florestan-piano.sf2")
+        sf.set_sample_format(F.Float16)
+        assert render_loaded(sf, interpolation) == output
+        _tinysoundfont.set_simd(level)
+    # Samples read from a mapping are Int16 and can be converted
+    mapped = _tinysoundfont.SoundFont.from_mmap("test/florestan-piano.sf2")
+    assert mapped.get_sample_format() == F.Int16
+    mapped.set_sample_format(F.Float32)
+    assert mapped.sample_memory_bytes() == size
+    assert render_loaded(mapped, _tinysoundfont.Interpolation.Linear) == render_loaded(
+        _tinysoundfont.SoundFont("test/florestan-piano.sf2"), _tinysoundfont.Interpolation.Linear
+    )
+    # Shared sample data cannot be converted
+    copy = _tinysoundfont.SoundFont(mapped)
+    with pytest.raises(RuntimeError):
+        mapped.set_sample_format(F.Float16)
+    del copy
+    mapped.set_sample_format(F.Float16)
+
+
+@pytest.mark.parametrize("level", _tinysoundfont.simd_levels())
+def test_lazy_samples(restore_simd, level):
+    _tinysoundfont.set_simd(level)
+    # Samples decoded on first use give the same output as decoding all of them at load time
+    for interpolation in _tinysoundfont.Interpolation.__members__.values():
+        lazy = _tinysoundfont.SoundFont.from_mmap("test/florestan-subset.sfo", lazy=True)
+        assert lazy.sample_memory_bytes() == 0
+        expected = render_loaded(_tinysoundfont.SoundFont("test/florestan-subset.sfo"), interpolation)
+        assert render_loaded(lazy, interpolation) == expected
+        stats = lazy.sample_cache_stats()
+        assert stats["misses"] == stats["decodes"] > 0
+        assert stats["bytes"] == lazy.sample_memory_bytes() > 0
+    with pytest.raises(RuntimeError):
+        lazy.set_sample_format(_tinysoundfont.SampleFormat.Int16)
+    # Samples of ended notes are evicted to stay below the maximum
+    lazy = _tinysoundfont.SoundFont.from_mmap("test/florestan-subset.sfo", lazy=True)
+    lazy.set_output(_tinysoundfont.OutputMode.Mono, 44100, 0.0)
+    lazy.set_sample_cache(100000)
+    buffer = bytearray(44100 * 4 * 4)
+    for preset in range(lazy.get_preset_count()):
+        lazy.note_on(preset, 60, 1.0)
+        lazy.note_off()
+        lazy.render(buffer, False)
+    stats = lazy.sample_cache_stats()
+    assert stats["evictions"] > 0 and stats["hits"] == 0
+    lazy.note_on(lazy.get_preset_count() - 1, 60, 1.0)
+    assert lazy.sample_cache_stats()["hits"] == 1
+    # In real-time mode notes only play samples decoded up front
+    lazy = _tinysoundfont.SoundFont.from_mmap("test/florestan-subset.sfo", lazy=True)
+    lazy.set_realtime(True, voices=64)
+    lazy.note_on(0, 60, 1.0)
+    assert lazy.active_voice_count() == 0 and lazy.dropped_voice_count() > 0
+    lazy.decode_presets([0])
+    lazy.note_on(0, 60, 1.0)
+    assert lazy.active_voice_count() > 0
+    # Copies decode into caches of their own
+    copy = _tinysoundfont.SoundFont(lazy)
+    assert copy.sample_cache_stats()["decodes"] == 0
+    with pytest.raises(RuntimeError):
+        lazy.decode_presets([lazy.get_preset_count()])
+    # Uncompressed SoundFonts have nothing to decode
+    mapped = _tinysoundfont.SoundFont.from_mmap("test/florestan-piano.sf2", lazy=True)
+    assert render_loaded(mapped, _tinysoundfont.Interpolation.Linear) == render_loaded(
+        _tinysoundfont.SoundFont("test/florestan-piano.sf2"), _tinysoundfont.Interpolation.Linear
+    )
+    assert mapped.sample_cache_stats()["decodes"] == 0
+
+
+def write_sf3(path):
+    # Rewrite the .sfo as an .sf3 where every sample is compressed and decodes the whole Ogg stream
+    data = open("test/florestan-subset.sfo", "rb").read()
+
+    def chunks(start, end):
+        while start + 8 <= end:
+            size = struct.unpack("<I", data[start + 4 : start + 8])[0]
+            yield data[start : start + 4], start + 8, size
+            start += 8 + size
+
+    lists = {data[start : start + 4]: (start - 8, start + 4, start + size) for _, start, size in chunks(12, len(data))}
+    pdta = {name: data[start : start + size] for name, start, size in chunks(*lists[b"pdta"][1:])}
+    ogg = next(data[start : start + size] for name, start, size in chunks(*lists[b"sdta"][1:]) if name == b"smpo")
+    shdr = bytearray(pdta[b"shdr"])
+    for offset in range(0, len(shdr) - 46, 46):
+        fields = list(struct.unpack("<20sIIIIIBbHH", shdr[offset : offset + 46]))
+        fields[1:3] = [0, len(ogg)]
+        fields[9] |= 0x10
+        shdr[offset : offset + 46] = struct.pack("<20sIIIIIBbHH", *fields)
+    pdta[b"shdr"] = bytes(shdr)
+
+    def chunk(name, body):
+        return name + struct.pack("<I", len(body)) + body
+
+    info = data[lists[b"INFO"][0] : lists[b"INFO"][2]]
+    sdta = chunk(b"LIST", b"sdta" + chunk(b"smpl", ogg + b"\0" * (len(ogg) & 1)))
+    body = b"sfbk" + info + sdta + chunk(b"LIST", b"pdta" + b"".join(chunk(k, v) for k, v in pdta.items()))
+    with open(path, "wb") as f:
+        f.write(chunk(b"RIFF", body))
+
+
+def test_load_threads(restore_threads, tmp_path):
+    # Compressed samples decoded on several threads at load time are the same as on one thread
+    sf3 = str(tmp_path / "subset.sf3")
+    write_sf3(sf3)
+    for filename in ("test/florestan-subset.sfo", sf3):
+        _tinysoundfont.set_threads(1)
+        expected = render_loaded(_tinysoundfont.SoundFont(filename), _tinysoundfont.Interpolation.Linear)
+        for threads in (2, 4):
+            _tinysoundfont.set_threads(threads)
+            for sf in (_tinysoundfont.SoundFont(filename), _tinysoundfont.SoundFont.from_mmap(filename)):
+                assert render_loaded(sf, _tinysoundfont.Interpolation.Linear) == expected
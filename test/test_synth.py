@@ -99,3 +99,10 @@ def test_midi_generate():
     buffer = synth.generate(44100)
     block = np.frombuffer(bytes(buffer), dtype=np.float32)
     assert block.min() < block.max()
+
+
+def test_generate_simple_without_soundfonts():
+    # Nothing renders into the buffer, so its contents are kept
+    synth = tinysoundfont.Synth()
+    buffer = memoryview(bytearray(b"\x01" * 64))
+    assert synth.generate_simple(8, buffer).tobytes() == b"\x01" * 64